@@ -0,0 +1,302 @@
+#include "parser.h"
+#include "pipes.h"
+#include "parse_cache.h"
+#include <time.h>
+
+// Microbenchmark for the parser front end: parse_input(), tokenize(),
+// parse_pipeline() and parse_command_sequence(), each timed on its own
+// over a set of generated command lines, plus a warm parse cache lookup.
+//
+// Output is one JSON object per (workload, stage) on stdout:
+//   {"workload":"short","stage":"tokenize","lines":N,"ns_per_line":X,
+//    "allocs_per_line":Y,"bytes_per_line":Z}
+//
+// Allocations are counted by wrapping malloc/calloc/realloc at link
+// time (see BENCH_LDFLAGS in the makefile).
+
+#define BENCH_LINE_MAX 8192
+#define DEFAULT_MIN_NS 250000000LL  // calibrate each stage to run >= 250ms
+
+// ---- allocation accounting -------------------------------------------
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static unsigned long long alloc_calls = 0;
+static unsigned long long alloc_bytes = 0;
+
+void *__wrap_malloc(size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    alloc_calls++;
+    alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+// ---- workloads ---------------------------------------------------------
+
+typedef struct {
+    const char *name;
+    char line[BENCH_LINE_MAX];
+} workload_t;
+
+static workload_t workloads[] = {
+    { "short", "" },
+    { "pipeline32", "" },
+    { "quoted", "" },
+    { "redirections", "" },
+    { "sequence", "" },
+    { "arglist", "" },
+};
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+static void build_workloads() {
+    char *p;
+    size_t left;
+
+    snprintf(workloads[0].line, BENCH_LINE_MAX, "reveal -la /usr/local");
+
+    // 32 single-word stages: 32 words and 31 pipes
+    static const char *stages[] = { "cat", "grep", "sort", "uniq" };
+    p = workloads[1].line;
+    left = BENCH_LINE_MAX;
+    for (int i = 0; i < MAX_PIPELINE_COMMANDS; i++) {
+        int n = snprintf(p, left, "%s%s", i ? " | " : "", stages[i % 4]);
+        p += n;
+        left -= n;
+    }
+
+    // Three quoted arguments of 200 bytes each
+    char body[201];
+    for (int i = 0; i < 200; i++) {
+        body[i] = (i % 8 == 7) ? ' ' : (char)('a' + i % 26);
+    }
+    body[200] = '\0';
+    snprintf(workloads[2].line, BENCH_LINE_MAX, "echo \"%s\" '%s' \"%s\"",
+             body, body, body);
+
+    snprintf(workloads[3].line, BENCH_LINE_MAX,
+             "sort < in1 < in2 < in3 > out1 > out2 >> out3 > out4 >> out5 > out6 < in4");
+
+    p = workloads[4].line;
+    left = BENCH_LINE_MAX;
+    for (int i = 0; i < MAX_SEQUENCE_PIPELINES; i++) {
+        int n = snprintf(p, left, "%secho step%d", i ? " ; " : "", i);
+        p += n;
+        left -= n;
+    }
+
+    // A generated command with 40 long path arguments, about 7KB
+    p = workloads[5].line;
+    left = BENCH_LINE_MAX;
+    int n = snprintf(p, left, "process");
+    p += n;
+    left -= n;
+    for (int i = 0; i < 40; i++) {
+        n = snprintf(p, left, " /data/generated/batch-%04d/partition-%02d/", i, i % 16);
+        p += n;
+        left -= n;
+        for (int j = n; j < 180; j++) {
+            *p++ = (char)('a' + (i + j) % 26);
+            left--;
+        }
+        *p = '\0';
+    }
+}
+
+// ---- stages ------------------------------------------------------------
+
+// Large parse results live in static storage, as they would be far too big
+// for the benchmark's stack frame.  The token values of the pre-built array
+// live in an arena of their own, as the stages reset the scratch arena.
+static token_t tokens[MAX_TOKENS];
+static token_t stage_tokens[MAX_TOKENS];
+static arena_t token_arena;
+static pipeline_t pipeline;
+static command_sequence_t sequence;
+static volatile int sink;
+
+static int has_semicolon(const token_t *toks, int count) {
+    for (int i = 0; i < count; i++) {
+        if (toks[i].type == TOKEN_SEMICOLON) return 1;
+    }
+    return 0;
+}
+
+static void run_validate(const char *line) {
+    sink += parse_input(line);
+}
+
+static void run_tokenize(const char *line) {
+    sink += tokenize(line, stage_tokens);
+    parser_reset_scratch();
+}
+
+// Parse from a pre-built token array, the same way execute_command_line()
+// picks between a single pipeline and a ';' sequence.
+static int parse_is_sequence;
+static void run_parse(const char *line) {
+    memcpy(stage_tokens, tokens, sizeof(tokens));
+    if (parse_is_sequence) {
+        sink += parse_command_sequence(stage_tokens, &sequence);
+        free_command_sequence(&sequence);
+    } else {
+        sink += parse_pipeline(stage_tokens, &pipeline);
+        free_pipeline(&pipeline);
+    }
+    parser_reset_scratch();
+}
+
+// Everything execute_command_line() does before running anything
+static void run_full(const char *line) {
+    if (!parse_input(line)) return;
+    int count = tokenize(line, stage_tokens);
+    if (has_semicolon(stage_tokens, count)) {
+        sink += parse_command_sequence(stage_tokens, &sequence);
+        free_command_sequence(&sequence);
+    } else {
+        sink += parse_pipeline(stage_tokens, &pipeline);
+        free_pipeline(&pipeline);
+    }
+    parser_reset_scratch();
+}
+
+// What execute_command_line() pays for a line it has seen before
+static void run_cache_hit(const char *line) {
+    parse_cache_entry_t *entry = parse_cache_acquire(line);
+    sink += entry != NULL;
+    parse_cache_release(entry);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(const char *line);
+} stage_t;
+
+static const stage_t stage_list[] = {
+    { "parse_input", run_validate },
+    { "tokenize", run_tokenize },
+    { "parse", run_parse },
+    { "full", run_full },
+    { "cache_hit", run_cache_hit },
+};
+#define NUM_STAGES ((int)(sizeof(stage_list) / sizeof(stage_list[0])))
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_stage(const workload_t *w, const stage_t *s, long fixed_iterations) {
+    long iterations = fixed_iterations > 0 ? fixed_iterations : 16;
+    long long elapsed;
+    unsigned long long calls, bytes;
+
+    // Warm up once so lazily-initialised state does not skew the first pass
+    s->run(w->line);
+
+    for (;;) {
+        unsigned long long calls_before = alloc_calls;
+        unsigned long long bytes_before = alloc_bytes;
+        long long start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            s->run(w->line);
+        }
+        elapsed = now_ns() - start;
+        calls = alloc_calls - calls_before;
+        bytes = alloc_bytes - bytes_before;
+
+        if (fixed_iterations > 0 || elapsed >= DEFAULT_MIN_NS) break;
+        iterations *= 2;
+    }
+
+    printf("{\"workload\":\"%s\",\"stage\":\"%s\",\"lines\":%ld,"
+           "\"ns_per_line\":%.1f,\"allocs_per_line\":%.2f,\"bytes_per_line\":%.1f}\n",
+           w->name, s->name, iterations,
+           (double)elapsed / iterations,
+           (double)calls / iterations,
+           (double)bytes / iterations);
+    fflush(stdout);
+}
+
+// parse_command_with_multiple_redirections() creates intermediate output
+// files while parsing, so run inside a scratch directory.
+static char scratch_dir[] = "/tmp/parser_bench.XXXXXX";
+
+static void remove_scratch_dir() {
+    DIR *dir = opendir(scratch_dir);
+    if (dir != NULL) {
+        struct dirent *entry;
+        char path[MAX_PATH_LENGTH];
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s/%s", scratch_dir, entry->d_name);
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    rmdir(scratch_dir);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n iterations] [-w workload]\n", prog);
+    fprintf(stderr, "Workloads:");
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        fprintf(stderr, " %s", workloads[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+    long fixed_iterations = 0;
+    const char *only = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            fixed_iterations = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (mkdtemp(scratch_dir) == NULL || chdir(scratch_dir) != 0) {
+        perror("parser_bench: scratch directory");
+        return 1;
+    }
+
+    build_workloads();
+
+    for (int w = 0; w < NUM_WORKLOADS; w++) {
+        if (only && strcmp(only, workloads[w].name) != 0) continue;
+
+        arena_reset(&token_arena);
+        arena_t *previous = parser_set_arena(&token_arena);
+        int count = tokenize(workloads[w].line, tokens);
+        parser_set_arena(previous);
+        parse_is_sequence = has_semicolon(tokens, count);
+
+        for (int s = 0; s < NUM_STAGES; s++) {
+            bench_stage(&workloads[w], &stage_list[s], fixed_iterations);
+        }
+    }
+
+    remove_scratch_dir();
+    return 0;
+}
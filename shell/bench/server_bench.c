@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include "prompt.h"
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Throughput benchmark for the command server (shell.out --server).
+// Starts a server on a private socket and sends each command line N times
+// over one connection, then runs the same lines N times as separate
+// `shell.out -c` processes for comparison.  This is also the reference
+// client for the protocol described in server.c: one SOCK_SEQPACKET
+// packet per request with stdin, stdout and stderr as SCM_RIGHTS, one
+// packet back with the exit status.
+//
+// Output is one JSON object per mode and line on stdout:
+//   {"mode":"server","command":"true","requests":N,
+//    "requests_per_sec":X,"p50_us":Y,"p99_us":Z}
+
+#define DEFAULT_REQUESTS 2000
+#define DEFAULT_SHELL "./shell.out"
+#define CONNECT_ATTEMPTS 200
+
+static const char *const command_lines[] = {
+    "true",              // external command
+    "echo hi",           // external command with output
+    "hop .",             // builtin, no process at all
+    "true | true",       // pipeline
+};
+#define NUM_COMMAND_LINES ((int)(sizeof(command_lines) / sizeof(command_lines[0])))
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *mode, const char *command, int requests, long long elapsed,
+                   long long *samples) {
+    qsort(samples, requests, sizeof(long long), compare_ll);
+    long long p50 = samples[requests / 2];
+    long long p99 = samples[(requests * 99) / 100 < requests ? (requests * 99) / 100 : requests - 1];
+
+    printf("{\"mode\":\"%s\",\"command\":\"%s\",\"requests\":%d,"
+           "\"requests_per_sec\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f}\n",
+           mode, command, requests, (double)requests * 1e9 / elapsed, p50 / 1000.0, p99 / 1000.0);
+    fflush(stdout);
+}
+
+static int connect_to(const char *path) {
+    struct sockaddr_un address;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        struct timespec pause = { 0, 10 * 1000 * 1000 };
+        nanosleep(&pause, NULL);  // the server is still starting
+    }
+    return -1;
+}
+
+// One request: send line with fds as stdin, stdout and stderr, return the
+// exit status from the reply, -1 on a protocol error
+static int request(int fd, const char *line, const int fds[3]) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct iovec iov = { (void *)line, strlen(line) };
+    struct msghdr message;
+    char reply[16];
+
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&message);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(c), fds, 3 * sizeof(int));
+
+    if (sendmsg(fd, &message, 0) == -1) {
+        return -1;
+    }
+    ssize_t n = recv(fd, reply, sizeof(reply) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    reply[n] = '\0';
+    return (int)strtol(reply, NULL, 10);
+}
+
+static void bench_server(int fd, const char *line, int requests, const int fds[3], long long *samples) {
+    long long start = now_ns();
+    for (int i = 0; i < requests; i++) {
+        long long t0 = now_ns();
+        if (request(fd, line, fds) != 0) {
+            fprintf(stderr, "server_bench: '%s' failed\n", line);
+            exit(1);
+        }
+        samples[i] = now_ns() - t0;
+    }
+    report("server", line, requests, now_ns() - start, samples);
+}
+
+static void bench_launch(char *shell, const char *line, int requests, int null_fd, long long *samples) {
+    char dash_c[] = "-c";
+    char *argv[] = { shell, dash_c, (char *)line, NULL };
+    int status;
+
+    long long start = now_ns();
+    for (int i = 0; i < requests; i++) {
+        long long t0 = now_ns();
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            execv(shell, argv);
+            _exit(127);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "server_bench: %s -c '%s' failed\n", shell, line);
+            exit(1);
+        }
+        samples[i] = now_ns() - t0;
+    }
+    report("launch", line, requests, now_ns() - start, samples);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n requests] [-s shell]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int requests = DEFAULT_REQUESTS;
+    char *shell = DEFAULT_SHELL;
+    char path[64];
+    char server_flag[] = "--server";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            requests = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            shell = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (requests <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long long *samples = malloc(sizeof(long long) * requests);
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (samples == NULL || null_fd == -1) {
+        perror("server_bench");
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "/tmp/server_bench.%d.sock", (int)getpid());
+    char *server_argv[] = { shell, server_flag, path, NULL };
+    pid_t server = fork();
+    if (server == 0) {
+        execv(shell, server_argv);
+        _exit(127);
+    }
+    int fd = server > 0 ? connect_to(path) : -1;
+    if (fd == -1) {
+        fprintf(stderr, "server_bench: could not start %s --server %s\n", shell, path);
+        return 1;
+    }
+
+    int fds[3] = { null_fd, null_fd, null_fd };
+    for (int i = 0; i < NUM_COMMAND_LINES; i++) {
+        bench_server(fd, command_lines[i], requests, fds, samples);
+        bench_launch(shell, command_lines[i], requests, null_fd, samples);
+    }
+
+    close(fd);
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    free(samples);
+    return 0;
+}
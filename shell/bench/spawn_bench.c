@@ -0,0 +1,183 @@
+#include "pipes.h"
+#include "zygote.h"
+#include <time.h>
+
+// Launch-latency benchmark for the shell's own spawn path.
+// Runs `true` N times through execute_external_command() (one stage) or
+// execute_pipeline() (several stages), optionally with < and > redirections,
+// while the benchmark's heap is deliberately grown to show how fork() cost
+// scales with the shell's RSS.
+//
+// Output is one JSON object per configuration on stdout:
+//   {"stages":S,"redirect":R,"heap_mb":M,"rss_kb":K,"launches":N,
+//    "spawns_per_sec":X,"p50_us":Y,"p99_us":Z}
+// where spawns_per_sec counts processes (launches * stages).
+// With -z the single-stage launches go through the zygote (see zygote.c),
+// which is started before the heap is grown, and each object also carries
+// "zygote":1.
+
+#define DEFAULT_LAUNCHES 200
+#define MAX_HEAP_STEPS 16
+
+static const int stage_counts[] = { 1, 2, 4, 8 };
+#define NUM_STAGE_COUNTS ((int)(sizeof(stage_counts) / sizeof(stage_counts[0])))
+
+static pipeline_t pipeline;
+static command_t commands[MAX_PIPELINE_COMMANDS];
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long read_rss_kb() {
+    long pages_total = 0, pages_resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) return -1;
+    if (fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+    fclose(f);
+    return pages_resident < 0 ? -1 : pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Grow the heap to at least target_mb, touching every page so it is
+// resident and has to be mapped into each forked child.
+static char *heap_blocks[1024];
+static int heap_block_count = 0;
+static void grow_heap(int target_mb) {
+    while (heap_block_count < target_mb && heap_block_count < 1024) {
+        char *block = malloc(1024 * 1024);
+        if (block == NULL) {
+            perror("spawn_bench: malloc");
+            exit(1);
+        }
+        memset(block, heap_block_count & 0xff, 1024 * 1024);
+        heap_blocks[heap_block_count++] = block;
+    }
+}
+
+static char true_cmd[] = "true";
+static char null_path[] = "/dev/null";
+static char *true_args[] = { true_cmd, NULL };
+static redirection_t null_redirections[] = {   // < /dev/null > /dev/null
+    { REDIRECT_READ, STDIN_FILENO, -1, null_path, 0, 0 },
+    { REDIRECT_WRITE, STDOUT_FILENO, -1, null_path, 0, 0 },
+};
+
+static void build_pipeline(int stages, int redirect) {
+    init_pipeline(&pipeline);
+    pipeline.commands = commands;
+    for (int i = 0; i < stages; i++) {
+        command_t *cmd = &pipeline.commands[i];
+        init_command(cmd);
+        cmd->args = true_args;
+        cmd->argc = 1;
+    }
+    if (redirect) {
+        command_t *first = &pipeline.commands[0];
+        command_t *last = &pipeline.commands[stages - 1];
+        first->redirections = &null_redirections[0];
+        first->num_redirections = 1;
+        if (last == first) {
+            first->num_redirections = 2;
+        } else {
+            last->redirections = &null_redirections[1];
+            last->num_redirections = 1;
+        }
+    }
+    pipeline.num_commands = stages;
+}
+
+static int launch(int stages) {
+    if (stages == 1) {
+        command_t *cmd = &pipeline.commands[0];
+        return execute_external_command(cmd, 0);
+    }
+    return execute_pipeline(&pipeline);
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_config(int stages, int redirect, int heap_mb, int launches, long long *samples) {
+    build_pipeline(stages, redirect);
+
+    long long start = now_ns();
+    for (int i = 0; i < launches; i++) {
+        long long t0 = now_ns();
+        if (launch(stages) != 0) {
+            fprintf(stderr, "spawn_bench: launch failed\n");
+            exit(1);
+        }
+        samples[i] = now_ns() - t0;
+    }
+    long long elapsed = now_ns() - start;
+
+    qsort(samples, launches, sizeof(long long), compare_ll);
+    long long p50 = samples[launches / 2];
+    long long p99 = samples[(launches * 99) / 100 < launches ? (launches * 99) / 100 : launches - 1];
+
+    printf("{\"stages\":%d,\"redirect\":%d,\"heap_mb\":%d,\"rss_kb\":%ld,\"launches\":%d,"
+           "\"spawns_per_sec\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f%s}\n",
+           stages, redirect, heap_mb, read_rss_kb(), launches,
+           (double)launches * stages * 1e9 / elapsed,
+           p50 / 1000.0, p99 / 1000.0, zygote_running() ? ",\"zygote\":1" : "");
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n launches] [-m heap_mb[,heap_mb...]] [-z]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int launches = DEFAULT_LAUNCHES;
+    int heap_steps[MAX_HEAP_STEPS] = { 0, 64, 256 };
+    int num_heap_steps = 3;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            launches = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-z") == 0) {
+            setenv(ZYGOTE_ENV, "1", 1);
+            start_zygote();
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            char *list = argv[++i];
+            num_heap_steps = 0;
+            for (char *tok = strtok(list, ","); tok && num_heap_steps < MAX_HEAP_STEPS;
+                 tok = strtok(NULL, ",")) {
+                heap_steps[num_heap_steps++] = (int)strtol(tok, NULL, 10);
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (launches <= 0 || num_heap_steps == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long long *samples = malloc(sizeof(long long) * launches);
+    if (samples == NULL) {
+        perror("spawn_bench: malloc");
+        return 1;
+    }
+
+    // Heap only ever grows, so walk the sizes in the order given
+    for (int h = 0; h < num_heap_steps; h++) {
+        grow_heap(heap_steps[h]);
+        for (int s = 0; s < NUM_STAGE_COUNTS; s++) {
+            for (int redirect = 0; redirect <= 1; redirect++) {
+                bench_config(stage_counts[s], redirect, heap_steps[h], launches, samples);
+            }
+        }
+    }
+
+    free(samples);
+    return 0;
+}
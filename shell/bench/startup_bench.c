@@ -0,0 +1,124 @@
+#include "prompt.h"
+#include <time.h>
+
+// Startup benchmark for shell.out -c.
+// Launches each command line N times the way a build system would: fork,
+// exec the launcher, wait.  The same lines go through /bin/sh -c as the
+// baseline, and `true` is also exec'd directly to show the floor.
+//
+// Output is one JSON object per launcher and line on stdout:
+//   {"launcher":"shell.out","command":"true","launches":N,
+//    "launches_per_sec":X,"p50_us":Y,"p99_us":Z}
+
+#define DEFAULT_LAUNCHES 1000
+#define DEFAULT_SHELL "./shell.out"
+#define BASELINE_SHELL "/bin/sh"
+
+static const char *const command_lines[] = {
+    "/bin/true",             // exec'd in place, no PATH search
+    "true",                  // PATH search, a builtin in sh
+    "true; true",            // one fork, then exec in place
+    "true | true",           // forked pipeline
+    "echo hi > /dev/null",   // redirection, exec'd in place
+};
+#define NUM_COMMAND_LINES ((int)(sizeof(command_lines) / sizeof(command_lines[0])))
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static int run(char *const argv[]) {
+    int status;
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) == -1) {
+        perror("startup_bench");
+        exit(1);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static void bench(const char *label, const char *command, char *const argv[], int launches,
+                  long long *samples) {
+    long long start = now_ns();
+    for (int i = 0; i < launches; i++) {
+        long long t0 = now_ns();
+        if (run(argv) != 0) {
+            fprintf(stderr, "startup_bench: %s -c '%s' failed\n", argv[0], command);
+            exit(1);
+        }
+        samples[i] = now_ns() - t0;
+    }
+    long long elapsed = now_ns() - start;
+
+    qsort(samples, launches, sizeof(long long), compare_ll);
+    long long p50 = samples[launches / 2];
+    long long p99 = samples[(launches * 99) / 100 < launches ? (launches * 99) / 100 : launches - 1];
+
+    printf("{\"launcher\":\"%s\",\"command\":\"%s\",\"launches\":%d,"
+           "\"launches_per_sec\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f}\n",
+           label, command, launches, (double)launches * 1e9 / elapsed, p50 / 1000.0, p99 / 1000.0);
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n launches] [-s shell]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int launches = DEFAULT_LAUNCHES;
+    char *shell = DEFAULT_SHELL;
+    char baseline[] = BASELINE_SHELL;
+    char true_path[] = "/bin/true";
+    char dash_c[] = "-c";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            launches = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            shell = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (launches <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (access(shell, X_OK) == -1) {
+        fprintf(stderr, "startup_bench: %s: %s (build it with make)\n", shell, strerror(errno));
+        return 1;
+    }
+
+    long long *samples = malloc(sizeof(long long) * launches);
+    if (samples == NULL) {
+        perror("startup_bench: malloc");
+        return 1;
+    }
+
+    char *direct[] = { true_path, NULL };
+    bench("exec", "true", direct, launches, samples);
+    for (int i = 0; i < NUM_COMMAND_LINES; i++) {
+        char *line = (char *)command_lines[i];
+        char *with_shell[] = { shell, dash_c, line, NULL };
+        char *with_baseline[] = { baseline, dash_c, line, NULL };
+        bench("shell.out", line, with_shell, launches, samples);
+        bench("sh", line, with_baseline, launches, samples);
+    }
+
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#include "prompt.h"
+#include "parser.h"
+#include "jobs.h"
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#define ADMISSION_ENV "CSHELL_ADMIT"
+#define ADMISSION_DEFAULT_GAP 1.0      // seconds between two job starts
+#define ADMISSION_CHECK_MS 500         // idle re-check while jobs wait
+
+int queue_background_pipeline(const pipeline_t *pipeline);
+int admission_due();
+int admission_waiting();
+void run_admission();
+int start_queued_job(job_t *job, int foreground);
+
+#endif
@@ -0,0 +1,31 @@
+#include "prompt.h"
+#ifndef ARENA_H
+#define ARENA_H
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN 8
+
+// Bump allocator for memory that dies all at once (everything parsed from
+// one command line, for example).  Blocks are kept across arena_reset(),
+// so an arena that is reused line after line stops calling malloc().
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *head;     // block currently being filled
+    arena_block_t *blocks;   // every block, oldest first
+} arena_t;
+
+void arena_init(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_extend(arena_t *arena, void *p, size_t old_size, size_t new_size);
+char *arena_strdup(arena_t *arena, const char *s);
+char *arena_strndup(arena_t *arena, const char *s, size_t length);
+void arena_reset(arena_t *arena);
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,16 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef CMDSUBST_H
+#define CMDSUBST_H
+
+#define CMDSUBST_ENV "CSHELL_SUBST_MAX"
+#define CMDSUBST_DEFAULT_LIMIT (16 * 1024 * 1024)
+#define CMDSUBST_READ_SIZE (64 * 1024)
+
+int has_substitution(const char *word);
+void reset_expansions();
+int pipeline_needs_expansion(const pipeline_t *pipeline);
+int expand_pipeline(const pipeline_t *pipeline, pipeline_t *expanded);
+char *expand_text(const char *word);
+
+#endif
@@ -0,0 +1,16 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#define CONTROL_MAX_BLOCK (64 * 1024)  // longest block read from input
+#define CONTROL_MAX_DEPTH 32           // for loops nested in one block
+
+int control_is_block(const char *text);
+int control_block_open(const char *text);
+char *control_read_block(const char *first_line);
+const char *control_history_line(const char *block);
+int control_execute(const char *text);
+const char *control_variable(const char *name, size_t length);
+
+#endif
@@ -0,0 +1,30 @@
+#include "prompt.h"
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#define DIRSCAN_BUFFER_SIZE (32 * 1024)
+
+typedef enum {
+    DIRSCAN_UNKNOWN,
+    DIRSCAN_DIRECTORY,
+    DIRSCAN_REGULAR,
+    DIRSCAN_SYMLINK,
+    DIRSCAN_OTHER
+} dirscan_type_t;
+
+// One directory entry as returned by the kernel, valid only during the
+// callback.
+typedef struct {
+    const char *name;
+    size_t name_length;
+    dirscan_type_t type;
+    int dir_fd;
+} dirscan_entry_t;
+
+// Return 0 from the callback to stop the scan early
+typedef int (*dirscan_fn)(const dirscan_entry_t *entry, void *context);
+
+int dirscan(const char *path, dirscan_fn visit, void *context);
+int dirscan_is_directory(const dirscan_entry_t *entry);
+
+#endif
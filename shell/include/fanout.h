@@ -0,0 +1,20 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#define FANOUT_CHUNK (1 << 16)   // most bytes passed on per tee()/splice()
+
+// The consumers of one pipeline's |+ fan-out and the process feeding them
+typedef struct {
+    pid_t pids[MAX_FANOUT_BRANCHES];
+    int count;
+    pid_t splicer;       // -1 when the pipeline has no fan-out
+    int input_fd;        // write end for the last stage, -1 once closed
+} fanout_state_t;
+
+int start_fanout(const pipeline_t *pipeline, int capture_fd, fanout_state_t *state);
+void close_fanout_input(fanout_state_t *state);
+int finish_fanout(fanout_state_t *state, int wait_now);
+
+#endif
@@ -0,0 +1,14 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef FASTPATH_H
+#define FASTPATH_H
+
+#define FASTPATH_ENV "CSHELL_FASTPATH"
+#define FASTPATH_CHUNK (128 * 1024)     // bytes per read() or splice() from a stream
+#define FASTPATH_DEFAULT_LINES 10       // head and tail without -n
+#define FASTPATH_LANES 32               // byte counters in the newline count
+
+int fast_path_applies(const command_t *cmd, int stdin_is_pipe);
+int run_fast_path(int argc, char *argv[]);
+
+#endif
@@ -1,5 +1,7 @@
 #include "prompt.h"
 #include "jobs.h"
+#include "history.h"
+#include "parse_cache.h"
 
 #ifndef FUNCTS_H
 #define FUNCTS_H
@@ -8,14 +10,37 @@
 
 
 
+// Structure for directory entries
+typedef struct {
+    char name[256];
+    int is_directory;
+} dir_entry_t;
+
+// Builtin command table entry
+typedef struct {
+    const char *name;
+    int (*handler)(int argc, char *argv[]);
+    int threaded;   // may run on a thread of the shell as a pipeline stage
+} builtin_t;
+
+extern const builtin_t builtin_table[];
+
 // void my_function();
 void init_shell_directories();
+void swap_previous_directory(char *saved);
 int directory_exists(const char *path);
 int resolve_path(const char *arg, char *resolved_path);
 int hop_command(int argc, char *argv[]);
 int reveal_command(int argc, char *argv[]); 
 int compare_entries(const void *a, const void *b);
 int execute_builtin_command(int argc, char *argv[]);
+int is_builtin_command(const char *name);
+int builtin_runs_on_thread(const char *name);
+FILE *builtin_output();
+int builtin_input();
+void set_builtin_io(FILE *output, int input_fd);
+int read_directory(const char *path, int show_hidden, const char *prefix,
+                   dir_entry_t entries[], int max_entries);
 int ping_command(int argc, char *argv[]);
 
 
@@ -0,0 +1,12 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef HEREDOC_H
+#define HEREDOC_H
+
+#define HEREDOC_MAX_SIZE (16 * 1024 * 1024)
+
+char *read_heredoc_body(const char *delimiter, size_t *length);
+char *herestring_body(const char *word, size_t *length);
+int heredoc_open(const char *text, size_t length);
+
+#endif
@@ -0,0 +1,25 @@
+#include "prompt.h"
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#define HISTORY_FILE_NAME ".cshell_history"
+#define HISTORY_DEFAULT_COUNT 10
+
+// On-disk record: header, then the line text with its NUL terminator,
+// padded so the next header is 4-byte aligned.  Each record is appended
+// with a single O_APPEND write(), so shells sharing the file never see
+// interleaved records.
+#define HISTORY_RECORD_MAGIC 0x54534948u  // "HIST"
+typedef struct {
+    unsigned int magic;
+    unsigned int length;    // text length, excluding the NUL
+    unsigned int checksum;  // FNV-1a of the text
+} history_record_t;
+
+void init_history();
+void history_add(const char *line);
+int history_count();
+const char *history_get(int index);
+int history_command(int argc, char *argv[]);
+
+#endif
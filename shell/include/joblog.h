@@ -0,0 +1,15 @@
+#include "prompt.h"
+#ifndef JOBLOG_H
+#define JOBLOG_H
+
+#define JOBLOG_ENV "CSHELL_JOBLOG"
+#define JOBLOG_MAX_LOGS 32
+#define JOBLOG_CHUNK_SIZE (64 * 1024)  // bytes copied out of a ring at a time
+#define JOBLOG_FOLLOW_MS 200           // joblog -f polling interval
+
+int joblog_begin();
+void joblog_attach(int job_id, const char *command_name);
+void joblog_cancel();
+int joblog_command(int argc, char *argv[]);
+
+#endif
@@ -4,10 +4,12 @@
 
 #define MAX_JOBS 100
 #define MAX_COMMAND_NAME 256
+#define MAX_JOB_HELPERS 64
 
 typedef enum {
     JOB_RUNNING,
     JOB_STOPPED,
+    JOB_QUEUED,              // waiting for admission, pid is 0 (admission.c)
     JOB_TERMINATED
 } job_state_t;
 
@@ -24,6 +26,7 @@ extern job_t jobs[MAX_JOBS];
 extern int next_job_id;
 extern pid_t current_foreground_pid;  // Track current foreground process
 extern pid_t current_foreground_pgid; // Track current foreground process group
+extern volatile sig_atomic_t interrupted; // Set by Ctrl-C
 
 // Function declarations
 int add_background_job(pid_t pid, const char *command_name);
@@ -32,8 +35,11 @@ void init_job_system();
 int activities_command(); // New function for activities command
 void update_job_states(); // New function to update job states
 int add_stopped_job(pid_t pid, const char *command_name);
+job_t *add_queued_job(const char *command_name);
+void claim_background_job(job_t *job);
 void setup_signal_handlers();
 void kill_all_children();
+void add_job_helper(pid_t pid);
 int fg_command(int argc, char *argv[]);
 int bg_command(int argc, char *argv[]);
 job_t* find_job_by_id(int job_id);
@@ -0,0 +1,11 @@
+#include "prompt.h"
+#ifndef JOBSTAT_H
+#define JOBSTAT_H
+
+#define JOBSTAT_BUFFER_SIZE 1024
+#define JOBSTAT_DEFAULT_INTERVAL 1.0
+
+int activities_verbose();
+int activities_watch(double interval);
+
+#endif
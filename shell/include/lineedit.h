@@ -0,0 +1,27 @@
+#include "functs.h"
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include <termios.h>
+
+#define MAX_COMPLETIONS 256
+#define MAX_PATH_DIRS 64
+#define LINE_INPUT_BUFFER 65536   // bytes read() from a script at a time
+
+// Completion candidates for one Tab press.  Names point into the
+// executable index or into the entries array, never into freed memory.
+typedef struct {
+    const char *names[MAX_COMPLETIONS];
+    int is_directory[MAX_COMPLETIONS];
+    int count;
+    dir_entry_t entries[MAX_ENTRIES];
+} completion_t;
+
+int read_line(char *buffer, int size);
+int read_continuation_line(char *buffer, int size);
+void set_line_input(int fd);
+int complete_command_name(const char *prefix, completion_t *out);
+int complete_file_name(const char *word, completion_t *out);
+void set_idle_handler(int interval_ms, int (*due)(), void (*run)());
+
+#endif
@@ -0,0 +1,30 @@
+#include "parser.h"
+#ifndef PARSE_CACHE_H
+#define PARSE_CACHE_H
+
+#define PARSE_CACHE_CAPACITY 256
+#define PARSE_CACHE_BUCKETS 512  // power of two
+
+// A parsed command line.  Everything it points to lives in its own arena,
+// and nothing modifies it after parsing, so a cached entry can be run any
+// number of times.
+typedef struct parse_cache_entry {
+    unsigned long long hash;
+    char *text;
+    size_t length;
+    int is_sequence;              // parsed as a ';' sequence, not one pipeline
+    command_sequence_t sequence;
+    arena_t arena;
+    int pins;                     // acquired and not yet released
+    int cached;                   // linked into the cache
+    struct parse_cache_entry *bucket_next;
+    struct parse_cache_entry *lru_prev;
+    struct parse_cache_entry *lru_next;
+} parse_cache_entry_t;
+
+parse_cache_entry_t *parse_cache_acquire(const char *line);
+void parse_cache_release(parse_cache_entry_t *entry);
+void parse_cache_clear();
+int parsecache_command(int argc, char *argv[]);
+
+#endif
@@ -1,19 +1,32 @@
 #include "prompt.h"
+#include "arena.h"
+#include "placement.h"
 #ifndef PARSER_H
 #define PARSER_H
 
-#define MAX_TOKENS 64
-#define MAX_TOKEN_LENGTH 256
-#define MAX_INPUT_LENGTH 1024
+#define MAX_TOKENS 4096           // words and operators in one line, EOF included
+#define MAX_INPUT_LENGTH 65536    // bytes in one line, terminator included
 #define MAX_PIPELINE_COMMANDS 32  
 #define MAX_SEQUENCE_PIPELINES 16
+#define MAX_FANOUT_BRANCHES 8
 // Token types
 typedef enum {
     TOKEN_WORD,
     TOKEN_PIPE,
+    TOKEN_FANOUT,         // |+
+    TOKEN_BRANCH,         // (command) after |+, value holds the command
     TOKEN_REDIRECT_IN,
     TOKEN_REDIRECT_OUT,
     TOKEN_REDIRECT_APPEND,
+    TOKEN_REDIRECT_READ_WRITE, // <>
+    TOKEN_DUP_IN,         // <&
+    TOKEN_DUP_OUT,        // >&
+    TOKEN_REDIRECT_ALL,   // &>
+    TOKEN_APPEND_ALL,     // &>>
+    TOKEN_HEREDOC,
+    TOKEN_HERESTRING,
+    TOKEN_PROCSUB_IN,     // <(command), value holds the command
+    TOKEN_PROCSUB_OUT,    // >(command)
     TOKEN_BACKGROUND,
     TOKEN_AND,
     TOKEN_OR,
@@ -24,38 +37,117 @@ typedef enum {
 // Token structure
 typedef struct {
     token_type_t type;
-    char value[MAX_TOKEN_LENGTH];
+    int quoted;              // Quote character ('\'' or '"') or 0; quoted words are never globbed
+    int assignment;          // NAME=value with an unquoted NAME
+    int io_number;           // Descriptor written before a redirection (2>), or -1
+    char *value;             // In the parse arena, see tokenize()
 } token_t;
 
+#define MAX_PROCESS_SUBS 8
+
+// A <(command) or >(command) argument.  The argument at arg_index is
+// replaced by /dev/fd/N when the command is started.  As the target of a
+// redirection (cmd > >(command)), the redirection's descriptor becomes a
+// copy of the pipe instead.
+typedef struct {
+    int arg_index;           // -1 for a redirection target
+    int redirection;         // Index of that redirection, or -1
+    int output;              // >(command): the command writes into it
+    char *command;
+} process_sub_t;
+
+// A word containing $(command) or `command`, expanded when the command
+// runs (see cmdsubst.c).  Quoted ones are not split into fields.
+typedef struct {
+    int arg_index;
+    int quoted;
+} substitution_t;
+
+// A NAME=value word before the command name.  The value is expanded when
+// the command runs unless it was single-quoted.
+typedef struct {
+    char *text;              // "NAME=value"
+    int expand;
+} assignment_t;
+
+#define MAX_REDIRECTIONS 16
+
+typedef enum {
+    REDIRECT_READ,           // [n]<file
+    REDIRECT_WRITE,          // [n]>file
+    REDIRECT_APPEND,         // [n]>>file
+    REDIRECT_READ_WRITE,     // [n]<>file
+    REDIRECT_TEXT,           // [n]<<word, [n]<<<word
+    REDIRECT_DUP,            // [n]>&m, [n]<&m
+    REDIRECT_CLOSE           // [n]>&-, [n]<&-
+} redirect_type_t;
+
+// One redirection of descriptor fd.  A command's redirections are kept in
+// the order written and carried out when it starts (see redirect.c).
+typedef struct {
+    redirect_type_t type;
+    int fd;
+    int source_fd;           // REDIRECT_DUP: the descriptor copied
+    char *target;            // File name, or the text for REDIRECT_TEXT
+    size_t length;           // Length of the text
+    int expand;              // Target has $var or $(command) to expand when run
+} redirection_t;
+
 // Command structure
 typedef struct {
-    char *args[MAX_TOKENS];  // Command arguments
+    char **args;             // NULL-terminated arguments, grown in the parse arena
     int argc;                // Argument count
-    char *input_file;        // Input redirection file
-    char *output_file;       // Output redirection file
-    int append_output;       // Append to output file (1) or overwrite (0)
+    int args_capacity;       // Slots in args, including the terminator
+    redirection_t *redirections; // In the order written
+    int num_redirections;
+    process_sub_t *subs;     // Process substitutions among the arguments
+    int num_subs;
+    substitution_t *substitutions; // Words with command substitutions
+    int num_substitutions;
+    assignment_t *assignments; // NAME=value prefixes, for the command's environment
+    int num_assignments;
+    placement_t *placement;  // From a "place [options]" prefix, or NULL
+    char **environment;      // Fixed when a background job was queued, or NULL
     int background;          // Run in background
 } command_t;
 
-// Pipeline structure
+// Pipeline structure.  The commands array and every string hanging off
+// it live in the parse arena (see parser_set_arena()).
 typedef struct {
-    command_t commands[MAX_TOKENS];
+    command_t *commands;
     int num_commands;
+    char **branches;         // Consumers of a "|+ (command)..." fan-out
+    int num_branches;
     int background;
 } pipeline_t;
 typedef struct {
-    pipeline_t pipelines[MAX_TOKENS];
+    pipeline_t *pipelines;
     int num_pipelines;
 } command_sequence_t;
 
+// Cleared by the parser when a line's parse result depends on more than
+// its text (e.g. a here-document read from input, or a wildcard expanded
+// against the directory), so the result must not be reused for another
+// execution of the same text.  Per thread, like the rest of the parser's
+// state.
+extern __thread int parse_cacheable;
+
 
 int parse_input(const char *input);
 int tokenize(const char *input, token_t tokens[]);
 void init_command(command_t *cmd);
+void command_add_argument(command_t *cmd, char *arg);
+void command_add_word(command_t *cmd, const token_t *token);
+int command_add_redirection(command_t *cmd, const token_t *op, const token_t *target);
+void command_add_process_sub(command_t *cmd, const token_t *token);
+void command_add_assignment(command_t *cmd, const token_t *token);
+void command_take_placement(command_t *cmd);
 int parse_command(token_t tokens[], int *token_index, command_t *cmd);
 int parse_pipeline(token_t tokens[], pipeline_t *pipeline);
+int parse_single_pipeline_from_tokens(token_t tokens[], int *token_index, pipeline_t *pipeline);
 void free_command(command_t *cmd);
 void free_pipeline(pipeline_t *pipeline) ;
+void copy_pipeline(pipeline_t *dst, const pipeline_t *src);
 void print_command(const command_t *cmd);
 void print_pipeline(const pipeline_t *pipeline);
 // sequential for
@@ -65,4 +157,12 @@ int execute_command_sequence(command_sequence_t *sequence);
 void init_pipeline(pipeline_t *pipeline);
 void init_command_sequence(command_sequence_t *sequence);
 int parse_command_with_multiple_redirections(token_t tokens[], int *token_index, command_t *cmd);
+arena_t *parser_set_arena(arena_t *arena);
+void *parser_alloc(size_t size);
+char *parser_strdup(const char *s);
+void parser_reset_scratch();
+int parser_defer_wildcards(int on);
+void parser_collect_messages(FILE *output, FILE *errors);
+FILE *parser_output();
+FILE *parser_errors();
 #endif
@@ -0,0 +1,23 @@
+#include "prompt.h"
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#define PLACEMENT_MAX_CPUS 1024
+
+// Where a command runs: its CPU set, nice value and I/O priority.  Set
+// with "place [options] command" and applied in the child before exec.
+typedef struct {
+    int has_cpus;
+    unsigned char cpus[PLACEMENT_MAX_CPUS / 8];
+    int has_nice;
+    int nice;
+    int has_ioprio;
+    int ioprio;              // class << 13 | level, as for ioprio_set(2)
+} placement_t;
+
+int parse_placement(int argc, char *argv[], placement_t *placement, int report);
+int apply_placement(pid_t pid, const placement_t *placement);
+int describe_placement(pid_t pid, char *buffer, size_t size);
+int place_command(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,19 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef PROCSUB_H
+#define PROCSUB_H
+
+// Pipes and producer processes of one command's process substitutions
+typedef struct {
+    pid_t pids[MAX_PROCESS_SUBS];
+    int fds[MAX_PROCESS_SUBS];   // the command's end of each pipe
+    int count;
+} procsub_state_t;
+
+int start_process_subs(const command_t *cmd, procsub_state_t *state);
+void attach_process_subs(command_t *cmd, const procsub_state_t *state);
+void close_process_subs(procsub_state_t *state);
+void reap_process_subs(procsub_state_t *state, int wait_now);
+void close_all_process_subs();
+
+#endif
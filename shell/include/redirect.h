@@ -0,0 +1,13 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef REDIRECT_H
+#define REDIRECT_H
+
+#define REDIRECT_PARK_FD 10   // lowest descriptor used to park one while swapping
+
+int apply_redirections(const command_t *cmd);
+int redirect_standard_fds(const command_t *cmd, int fds[3]);
+void close_standard_fds(const int fds[3], const int base[3]);
+int redirects_stdio_to_files(const command_t *cmd);
+
+#endif
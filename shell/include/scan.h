@@ -0,0 +1,11 @@
+#include "prompt.h"
+#ifndef SCAN_H
+#define SCAN_H
+
+#define SCAN_ENV "CSHELL_SCAN"   // scalar, sse2 or avx2: use at most this scanner
+
+size_t scan_word(const char *s, size_t length);
+size_t scan_double_quoted(const char *s, size_t length);
+const char *scan_implementation();
+
+#endif
@@ -0,0 +1,11 @@
+#include "prompt.h"
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#define SCRIPT_AHEAD_ENV "CSHELL_PARSE_AHEAD"
+#define SCRIPT_AHEAD_DEFAULT 64     // lines parsed ahead of the one running
+#define SCRIPT_AHEAD_MAX 1024
+
+int run_script(const char *path);
+
+#endif
@@ -0,0 +1,11 @@
+#include "prompt.h"
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_MAX_CLIENTS 64
+#define SERVER_BACKLOG 16
+#define SERVER_CHECK_MS 500   // background jobs are checked at least this often
+
+int run_server(const char *path);
+
+#endif
@@ -0,0 +1,14 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#define VARIABLE_TABLE_SIZE 256   // initial hash table slots, a power of two
+
+const char *variable_value(const char *name, size_t length);
+int set_variable(const char *name, size_t length, const char *value, int export);
+int assign_variables(const command_t *cmd);
+char **command_environment(const command_t *cmd);
+int export_command(int argc, char *argv[]);
+
+#endif
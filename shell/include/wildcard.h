@@ -0,0 +1,46 @@
+#include "prompt.h"
+#include "parser.h"
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#define WILDCARD_MAX_SEGMENTS 64
+#define WILDCARD_MAX_LENGTH 256
+
+typedef enum {
+    WILDCARD_LITERAL,     // fixed bytes
+    WILDCARD_ANY_CHAR,    // ?
+    WILDCARD_ANY_STRING,  // *
+    WILDCARD_CLASS        // [...]
+} wildcard_segment_type_t;
+
+typedef struct {
+    wildcard_segment_type_t type;
+    const char *literal;          // WILDCARD_LITERAL, points into pattern->text
+    size_t length;
+    unsigned char bits[32];       // WILDCARD_CLASS, one bit per byte value
+} wildcard_segment_t;
+
+// A pattern compiled once and matched against every directory entry.
+// Names are first filtered on length and on the literal prefix and suffix;
+// only the segments in between go through the backtracking matcher.
+typedef struct {
+    char text[WILDCARD_MAX_LENGTH];
+    wildcard_segment_t segments[WILDCARD_MAX_SEGMENTS];
+    int num_segments;
+    int first;                    // segments[first..last) still need matching
+    int last;
+    const char *prefix;
+    size_t prefix_length;
+    const char *suffix;
+    size_t suffix_length;
+    size_t min_length;
+    int only_star;                // nothing but a single * between prefix and suffix
+    int match_hidden;             // pattern itself starts with '.'
+} wildcard_t;
+
+int has_wildcard(const char *word);
+int wildcard_compile(wildcard_t *pattern, const char *text);
+int wildcard_match(const wildcard_t *pattern, const char *name, size_t length);
+int expand_wildcard(const char *word, command_t *cmd);
+
+#endif
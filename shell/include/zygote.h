@@ -0,0 +1,34 @@
+#include "prompt.h"
+#include "placement.h"
+#ifndef ZYGOTE_H
+#define ZYGOTE_H
+
+#define ZYGOTE_ENV "CSHELL_ZYGOTE"
+#define ZYGOTE_MAX_MESSAGE (64 * 1024)
+
+// Request header; cwd, argv and the environment follow as NUL-terminated
+// strings.  stdin, stdout and stderr for the child travel as SCM_RIGHTS.
+typedef struct {
+    int argc;
+    int envc;
+    size_t length;               // bytes of strings after the header
+    placement_t placement;       // applied in the child before exec
+} zygote_request_t;
+
+typedef enum {
+    ZYGOTE_SPAWNED,              // reply to a request, pid -1 if fork failed
+    ZYGOTE_STATUS                // a child exited, was killed or stopped
+} zygote_event_type_t;
+
+typedef struct {
+    zygote_event_type_t type;
+    pid_t pid;
+    int status;                  // as returned by waitpid()
+} zygote_event_t;
+
+void start_zygote();
+int zygote_running();
+pid_t zygote_spawn(char *const argv[], char *const envp[], const int fds[3], const placement_t *placement);
+pid_t wait_process(pid_t pid, int *status, int options);
+
+#endif
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include "admission.h"
+#include "pipes.h"
+#include "cmdsubst.h"
+#include "variables.h"
+#include <time.h>
+
+// Admission control for background jobs.
+//
+// With CSHELL_ADMIT set, e.g. "cpu=20,memory=10,io=30,load=8,gap=1", a
+// background pipeline only starts while every configured figure is at or
+// below its threshold: the "some avg10" percentage of
+// /proc/pressure/{cpu,memory,io} and the 1-minute load average.  Otherwise
+// it is copied into an arena of its own and waits as a Queued job.  Queued
+// jobs start in order, at most one per gap seconds so the averages can
+// catch up with each new job, whenever the shell is at its prompt.
+//
+// A queued job runs as it would have when it was typed: its variables and
+// substitutions are expanded and its commands' environments copied when it
+// is queued, and it starts in the directory it was queued in, whatever
+// hop and export have done since.
+
+typedef struct {
+    const char *name;
+    const char *path;
+    int fd;                  // kept open and re-read with pread()
+    double threshold;        // < 0 when not configured
+} pressure_source_t;
+
+static pressure_source_t sources[] = {
+    { "cpu", "/proc/pressure/cpu", -1, -1 },
+    { "memory", "/proc/pressure/memory", -1, -1 },
+    { "io", "/proc/pressure/io", -1, -1 },
+    { "load", "/proc/loadavg", -1, -1 },
+};
+#define NUM_SOURCES ((int)(sizeof(sources) / sizeof(sources[0])))
+
+// A pipeline waiting for admission, in its own arena
+typedef struct {
+    int job_id;              // 0 when the slot is free
+    arena_t arena;
+    pipeline_t pipeline;
+    int directory;           // O_PATH descriptor of the directory to start in
+} queued_pipeline_t;
+
+static queued_pipeline_t queue[MAX_JOBS];
+static int queued_count = 0;
+static double gap = ADMISSION_DEFAULT_GAP;
+static long long last_start_ns = 0;
+static char config[256] = "";  // CSHELL_ADMIT as last parsed
+static int admitting = 0;      // a queued pipeline is being started
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Parse CSHELL_ADMIT when it changed.  Returns 0 when admission control
+// is off.
+static int load_config() {
+    const char *value = getenv(ADMISSION_ENV);
+    char copy[sizeof(config)];
+
+    if (value == NULL || *value == '\0') {
+        config[0] = '\0';
+        return 0;
+    }
+    if (strcmp(value, config) == 0) {
+        return 1;
+    }
+    snprintf(config, sizeof(config), "%s", value);
+    snprintf(copy, sizeof(copy), "%s", value);
+
+    gap = ADMISSION_DEFAULT_GAP;
+    for (int i = 0; i < NUM_SOURCES; i++) {
+        sources[i].threshold = -1;
+    }
+    for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *equals = strchr(item, '=');
+        char *end = NULL;
+        double threshold = equals ? strtod(equals + 1, &end) : -1;
+        int known = 0;
+
+        if (equals == NULL || *end != '\0' || threshold < 0) {
+            fprintf(stderr, "%s: ignoring '%s'\n", ADMISSION_ENV, item);
+            continue;
+        }
+        *equals = '\0';
+        if (strcmp(item, "gap") == 0) {
+            gap = threshold;
+            known = 1;
+        }
+        for (int i = 0; i < NUM_SOURCES; i++) {
+            if (strcmp(item, sources[i].name) == 0) {
+                sources[i].threshold = threshold;
+                known = 1;
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "%s: unknown setting '%s'\n", ADMISSION_ENV, item);
+        }
+    }
+    return 1;
+}
+
+// Current figure for source, or -1 when the kernel does not provide it
+static double read_source(pressure_source_t *source) {
+    char buffer[256];
+    double value;
+
+    if (source->fd == -1) {
+        source->fd = open(source->path, O_RDONLY | O_CLOEXEC);
+        if (source->fd == -1) {
+            return -1;
+        }
+    }
+    ssize_t n = pread(source->fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buffer[n] = '\0';
+
+    const char *format = strcmp(source->name, "load") == 0 ? "%lf" : "some avg10=%lf";
+    return sscanf(buffer, format, &value) == 1 ? value : -1;
+}
+
+// Whether a job may start now: the gap since the last start has passed
+// and no configured figure is over its threshold
+static int can_start_now() {
+    if (now_ns() < last_start_ns + (long long)(gap * 1e9)) {
+        return 0;
+    }
+    for (int i = 0; i < NUM_SOURCES; i++) {
+        if (sources[i].threshold >= 0 && read_source(&sources[i]) > sources[i].threshold) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Copy of the environment envp, strings included, in the parse arena
+static char **copy_environment(char **envp) {
+    int count = 0;
+    while (envp[count] != NULL) count++;
+
+    char **copy = parser_alloc((count + 1) * sizeof(char *));
+    for (int i = 0; i < count; i++) {
+        copy[i] = parser_strdup(envp[i]);
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+// Give each command of pipeline the environment it would get now, so a
+// later export or assignment does not change what the queued job sees
+static void fix_environments(pipeline_t *pipeline) {
+    char **shared = NULL;   // for the commands without NAME=value prefixes
+
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        command_t *cmd = &pipeline->commands[i];
+        if (cmd->num_assignments > 0) {
+            cmd->environment = copy_environment(command_environment(cmd));
+        } else {
+            if (shared == NULL) {
+                shared = copy_environment(command_environment(cmd));
+            }
+            cmd->environment = shared;
+        }
+    }
+}
+
+// Release what a queued pipeline held once it has run or been dropped
+static void free_slot(queued_pipeline_t *slot) {
+    if (slot->directory != -1) {
+        close(slot->directory);
+    }
+    arena_free(&slot->arena);
+}
+
+// Called by execute_pipeline() for background pipelines.  Returns 1 when
+// the pipeline was queued instead of being started, and -1 when its words
+// could not be expanded (it is then neither queued nor started).
+int queue_background_pipeline(const pipeline_t *pipeline) {
+    if (admitting || !load_config()) {
+        return 0;
+    }
+    if (queued_count == 0 && can_start_now()) {
+        last_start_ns = now_ns();
+        return 0;
+    }
+
+    queued_pipeline_t *slot = NULL;
+    for (int i = 0; i < MAX_JOBS && slot == NULL; i++) {
+        if (queue[i].job_id == 0) slot = &queue[i];
+    }
+    const char *name = pipeline->commands[0].args[0] ? pipeline->commands[0].args[0] : "unknown";
+    job_t *job = slot ? add_queued_job(name) : NULL;
+    if (job == NULL) {
+        return 0; // No room to wait, start it after all
+    }
+
+    pipeline_t expanded;
+    if (pipeline_needs_expansion(pipeline)) {
+        if (expand_pipeline(pipeline, &expanded) == -1) {
+            job->active = 0;
+            job->state = JOB_TERMINATED;
+            return -1;
+        }
+        pipeline = &expanded;
+    }
+    arena_t *previous = parser_set_arena(&slot->arena);
+    copy_pipeline(&slot->pipeline, pipeline);
+    fix_environments(&slot->pipeline);
+    parser_set_arena(previous);
+    slot->directory = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    slot->job_id = job->job_id;
+    queued_count++;
+    return 1;
+}
+
+static queued_pipeline_t *find_queued(int job_id) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (queue[i].job_id == job_id) return &queue[i];
+    }
+    return NULL;
+}
+
+// Start a queued job now, in the background under its own job number or
+// in the foreground (fg).  Returns the pipeline's status.
+int start_queued_job(job_t *job, int foreground) {
+    queued_pipeline_t *slot = find_queued(job->job_id);
+    int status;
+
+    if (slot == NULL || job->state != JOB_QUEUED) {
+        return 1;
+    }
+    pipeline_t pipeline = slot->pipeline;
+    slot->job_id = 0;
+    queued_count--;
+    last_start_ns = now_ns();
+
+    // Start it where it was queued, and come back afterwards
+    int home = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (slot->directory != -1 && fchdir(slot->directory) == -1) {
+        perror("queued job: fchdir");
+    }
+
+    admitting = 1;
+    if (foreground) {
+        job->active = 0;
+        job->state = JOB_TERMINATED;
+        pipeline.background = 0;
+        status = execute_pipeline(&pipeline);
+    } else {
+        claim_background_job(job);
+        status = execute_pipeline(&pipeline);
+        claim_background_job(NULL);
+        if (job->state == JOB_QUEUED) {
+            // Nothing was left running (fork failed or a builtin ran)
+            job->active = 0;
+            job->state = JOB_TERMINATED;
+        }
+    }
+    admitting = 0;
+
+    if (home != -1) {
+        if (fchdir(home) == -1) {
+            perror("queued job: fchdir");
+        }
+        close(home);
+    }
+    free_slot(slot);
+    return status;
+}
+
+int admission_due() {
+    if (queued_count == 0) {
+        return 0;
+    }
+    return !load_config() || can_start_now();
+}
+
+// Whether any background job is still waiting to start
+int admission_waiting() {
+    return queued_count > 0;
+}
+
+// Start the longest-waiting queued job if the system has room for it
+void run_admission() {
+    queued_pipeline_t *oldest = NULL;
+
+    if (!admission_due()) {
+        return;
+    }
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (queue[i].job_id != 0 && (oldest == NULL || queue[i].job_id < oldest->job_id)) {
+            oldest = &queue[i];
+        }
+    }
+    job_t *job = oldest ? find_job_by_id(oldest->job_id) : NULL;
+    if (job != NULL) {
+        start_queued_job(job, 0);
+    } else if (oldest != NULL) {
+        // The job slot went away (shell shutting down); drop the pipeline
+        oldest->job_id = 0;
+        queued_count--;
+        free_slot(oldest);
+    }
+}
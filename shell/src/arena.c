@@ -0,0 +1,105 @@
+#include "arena.h"
+
+void arena_init(arena_t *arena) {
+    arena->head = NULL;
+    arena->blocks = NULL;
+}
+
+static arena_block_t *new_block(size_t min_size) {
+    size_t size = ARENA_BLOCK_SIZE - sizeof(arena_block_t);
+    if (size < min_size) {
+        size = min_size;
+    }
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // Reuse blocks kept by arena_reset() before asking for new memory
+    while (arena->head != NULL && arena->head->used + size > arena->head->size &&
+           arena->head->next != NULL) {
+        arena->head = arena->head->next;
+        arena->head->used = 0;
+    }
+
+    if (arena->head == NULL || arena->head->used + size > arena->head->size) {
+        arena_block_t *block = new_block(size);
+        if (block == NULL) {
+            return NULL;
+        }
+        if (arena->head == NULL) {
+            arena->blocks = block;
+        } else {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        }
+        arena->head = block;
+    }
+
+    void *p = arena->head->data + arena->head->used;
+    arena->head->used += size;
+    return p;
+}
+
+// Grow p, the most recent allocation, from old_size to new_size.  It is
+// extended in place when its block has room, otherwise moved.
+void *arena_extend(arena_t *arena, void *p, size_t old_size, size_t new_size) {
+    arena_block_t *head = arena->head;
+    size_t old_aligned = (old_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    size_t new_aligned = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (p == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+    if (head != NULL && (char *)p + old_aligned == head->data + head->used &&
+        (size_t)((char *)p - head->data) + new_aligned <= head->size) {
+        head->used = (size_t)((char *)p - head->data) + new_aligned;
+        return p;
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    if (moved != NULL) {
+        memcpy(moved, p, old_size < new_size ? old_size : new_size);
+    }
+    return moved;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t length) {
+    char *copy = arena_alloc(arena, length + 1);
+    if (copy != NULL) {
+        memcpy(copy, s, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+char *arena_strdup(arena_t *arena, const char *s) {
+    return arena_strndup(arena, s, strlen(s));
+}
+
+// Forget every allocation but keep the blocks for reuse
+void arena_reset(arena_t *arena) {
+    arena->head = arena->blocks;
+    if (arena->head != NULL) {
+        arena->head->used = 0;
+    }
+}
+
+void arena_free(arena_t *arena) {
+    arena_block_t *block = arena->blocks;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->blocks = NULL;
+}
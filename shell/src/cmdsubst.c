@@ -0,0 +1,402 @@
+#include "cmdsubst.h"
+#include "pipes.h"
+#include "zygote.h"
+#include "control.h"
+#include "wildcard.h"
+#include "variables.h"
+
+// Command substitution: $(command) and `command`, and $name, ${name}
+// and $? variable references, in arguments and in NAME=value prefixes.
+//
+// The parser keeps such a word as typed and records where it is
+// (command_t.substitutions), so parse results stay cacheable.  Before a
+// pipeline runs, a copy of it is made in the expansion arena with each
+// such word replaced by the output of its command or the variable's value.
+// The output is read from the pipe in large chunks straight into the arena
+// and split into words in place; unquoted words are then globbed.  The
+// arena is recycled once per command line (once per statement in blocks).
+
+static arena_t expansion_arena;
+
+static int is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int starts_variable(const char *word, size_t i) {
+    return word[i] == '$' && (is_name_start(word[i + 1]) || word[i + 1] == '?' ||
+                              (word[i + 1] == '{' && strchr(word + i, '}') != NULL));
+}
+
+int has_substitution(const char *word) {
+    for (size_t i = 0; word[i]; i++) {
+        if (word[i] == '`' || (word[i] == '$' && word[i + 1] == '(') || starts_variable(word, i)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Drop the expansions of the previous command line
+void reset_expansions() {
+    arena_reset(&expansion_arena);
+}
+
+static int command_needs_expansion(const command_t *cmd) {
+    if (cmd->num_substitutions > 0) {
+        return 1;
+    }
+    for (int i = 0; i < cmd->num_assignments; i++) {
+        if (cmd->assignments[i].expand) return 1;
+    }
+    for (int i = 0; i < cmd->num_redirections; i++) {
+        if (cmd->redirections[i].expand) return 1;
+    }
+    return 0;
+}
+
+int pipeline_needs_expansion(const pipeline_t *pipeline) {
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        if (command_needs_expansion(&pipeline->commands[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Most output kept from one substitution, CSHELL_SUBST_MAX bytes if set
+static size_t substitution_limit() {
+    const char *value = getenv(CMDSUBST_ENV);
+    if (value != NULL && *value) {
+        char *end;
+        unsigned long long limit = strtoull(value, &end, 10);
+        if (*end == '\0' && limit > 0) {
+            return (size_t)limit;
+        }
+    }
+    return CMDSUBST_DEFAULT_LIMIT;
+}
+
+// Run command with its stdout on a pipe and read everything it writes
+// into the expansion arena.  Trailing newlines are dropped.  Returns the
+// NUL-terminated output, or NULL if the command could not be started.
+static char *capture_output(const char *command, size_t *length) {
+    size_t limit = substitution_limit();
+    int fds[2];
+
+    if (pipe(fds) == -1) {
+        perror("Command substitution failed");
+        return NULL;
+    }
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The shell is blocked reading the output, so Ctrl-Z must not stop it
+        signal(SIGTSTP, SIG_IGN);
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        int status = execute_command_line((char *)command);
+        fflush(stdout);
+        exit(status);
+    } else if (pid < 0) {
+        perror("fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    close(fds[1]);
+
+    // Read straight into the arena, doubling the region in place
+    size_t capacity = CMDSUBST_READ_SIZE < limit ? CMDSUBST_READ_SIZE : limit;
+    size_t used = 0;
+    int truncated = 0;
+    char *buffer = arena_alloc(&expansion_arena, capacity + 1);
+    while (buffer != NULL) {
+        if (used == capacity) {
+            if (capacity == limit) {
+                char probe;
+                truncated = read(fds[0], &probe, 1) > 0;
+                break;
+            }
+            size_t grown = capacity * 2 < limit ? capacity * 2 : limit;
+            buffer = arena_extend(&expansion_arena, buffer, capacity + 1, grown + 1);
+            capacity = grown;
+            continue;
+        }
+        ssize_t n = read(fds[0], buffer + used, capacity - used);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    // Closing our end first lets a writer that is still going die of SIGPIPE
+    close(fds[0]);
+
+    int status;
+    wait_process(pid, &status, 0);
+
+    if (buffer == NULL) {
+        fprintf(stderr, "Command substitution: out of memory\n");
+        return NULL;
+    }
+    if (truncated) {
+        fprintf(stderr, "Command substitution: output truncated to %zu bytes (see %s)\n",
+                limit, CMDSUBST_ENV);
+    }
+    while (used > 0 && buffer[used - 1] == '\n') {
+        used--;
+    }
+    buffer[used] = '\0';
+    *length = used;
+    return buffer;
+}
+
+static int starts_substitution(const char *word, size_t i) {
+    return word[i] == '`' || (word[i] == '$' && word[i + 1] == '(');
+}
+
+// Value of the variable reference at word[i] ($?, $name or ${name}); sets
+// *end just past it.  Loop variables come first, then shell variables
+// and the environment (variables.c); unknown names are empty.
+static const char *reference_value(const char *word, size_t i, size_t *end) {
+    static char status[16];
+    size_t start = i + 1, stop;
+
+    if (word[start] == '?') {
+        *end = start + 1;
+        snprintf(status, sizeof(status), "%d", last_exit_status);
+        return status;
+    }
+    if (word[start] == '{') {
+        start++;
+        stop = strchr(word + start, '}') - word;
+        *end = stop + 1;
+    } else {
+        for (stop = start; isalnum((unsigned char)word[stop]) || word[stop] == '_'; stop++) {
+        }
+        *end = stop;
+    }
+
+    const char *value = control_variable(word + start, stop - start);
+    if (value == NULL) {
+        value = variable_value(word + start, stop - start);
+    }
+    return value ? value : "";
+}
+
+// Copy out the command of the substitution at word[i] and set *end just
+// past it.  An unclosed substitution runs to the end of the word.
+static char *substitution_command(const char *word, size_t i, size_t *end) {
+    size_t start, stop;
+
+    if (word[i] == '`') {
+        const char *close = strchr(word + i + 1, '`');
+        start = i + 1;
+        stop = close ? (size_t)(close - word) : strlen(word);
+        *end = close ? stop + 1 : stop;
+    } else {
+        int depth = 0;
+        size_t j = i + 1;
+        for (; word[j]; j++) {
+            if (word[j] == '(') depth++;
+            else if (word[j] == ')' && --depth == 0) break;
+        }
+        start = i + 2;
+        stop = j;
+        *end = word[j] ? j + 1 : j;
+    }
+    return arena_strndup(&expansion_arena, word + start, stop - start);
+}
+
+// Expand every substitution in word.  A word that is nothing but one
+// substitution is the captured output itself; otherwise the literal text
+// and the outputs are joined in the arena.
+static char *expand_word(const char *word, size_t *length) {
+    char *result = NULL;
+    size_t used = 0, capacity = 0;
+
+    for (size_t i = 0, next; word[i]; i = next) {
+        const char *piece;
+        size_t piece_length;
+
+        if (starts_substitution(word, i)) {
+            char *command = substitution_command(word, i, &next);
+            char *output = command ? capture_output(command, &piece_length) : NULL;
+            if (output == NULL) {
+                return NULL;
+            }
+            if (i == 0 && word[next] == '\0') {
+                *length = piece_length;
+                return output;
+            }
+            piece = output;
+        } else if (starts_variable(word, i)) {
+            piece = reference_value(word, i, &next);
+            piece_length = strlen(piece);
+        } else {
+            for (next = i + 1; word[next] && !starts_substitution(word, next) &&
+                               !starts_variable(word, next); next++) {
+            }
+            piece = word + i;
+            piece_length = next - i;
+        }
+
+        if (used + piece_length + 1 > capacity) {
+            size_t grown = capacity ? capacity * 2 : 64;
+            while (grown < used + piece_length + 1) grown *= 2;
+            result = arena_extend(&expansion_arena, result, capacity, grown);
+            if (result == NULL) {
+                return NULL;
+            }
+            capacity = grown;
+        }
+        memcpy(result + used, piece, piece_length);
+        used += piece_length;
+    }
+
+    if (result == NULL && (result = arena_alloc(&expansion_arena, 1)) == NULL) {
+        return NULL;
+    }
+    result[used] = '\0';
+    *length = used;
+    return result;
+}
+
+static int is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Expand every substitution and variable in word into the expansion
+// arena, without splitting or globbing.  Returns NULL if a substitution
+// could not be started.
+char *expand_text(const char *word) {
+    size_t length;
+    return expand_word(word, &length);
+}
+
+// Split text into words in place and add them to cmd, globbing those with
+// wildcards
+static void add_fields(command_t *cmd, char *text) {
+    char *p = text;
+    for (;;) {
+        while (is_separator(*p)) p++;
+        if (*p == '\0') {
+            break;
+        }
+        char *start = p;
+        while (*p && !is_separator(*p)) p++;
+        if (*p) {
+            *p++ = '\0';
+        }
+        if (has_wildcard(start) && expand_wildcard(start, cmd) > 0) {
+            continue;
+        }
+        command_add_argument(cmd, start);
+    }
+}
+
+// Rebuild cmd's arguments, assignments and redirection targets with their
+// substitutions and variables expanded.  Process substitutions move along
+// with the arguments they belong to.
+static int expand_command(command_t *cmd) {
+    static char *no_args[1] = { NULL };
+    char **args = cmd->args;
+    int argc = cmd->argc;
+    const process_sub_t *subs = cmd->subs;
+    int next_sub = 0, next_substitution = 0;
+
+    if (cmd->num_subs > 0) {
+        cmd->subs = parser_alloc(cmd->num_subs * sizeof(process_sub_t));
+        memcpy(cmd->subs, subs, cmd->num_subs * sizeof(process_sub_t));
+    }
+    cmd->args = no_args;
+    cmd->argc = 0;
+    cmd->args_capacity = 0;
+
+    for (int i = 0; i < argc; i++) {
+        while (next_sub < cmd->num_subs && subs[next_sub].arg_index < 0) {
+            next_sub++;  // a redirection target, not an argument
+        }
+        if (next_sub < cmd->num_subs && subs[next_sub].arg_index == i) {
+            cmd->subs[next_sub++].arg_index = cmd->argc;
+        }
+        if (next_substitution < cmd->num_substitutions &&
+            cmd->substitutions[next_substitution].arg_index == i) {
+            int quoted = cmd->substitutions[next_substitution++].quoted;
+            size_t length;
+            char *text = expand_word(args[i], &length);
+            if (text == NULL) {
+                return -1;
+            }
+            if (quoted) {
+                command_add_argument(cmd, text);
+            } else {
+                add_fields(cmd, text);
+            }
+        } else {
+            command_add_argument(cmd, args[i]);
+        }
+    }
+
+    cmd->substitutions = NULL;
+    cmd->num_substitutions = 0;
+
+    // NAME=value prefixes are expanded but never split or globbed
+    if (cmd->num_assignments > 0) {
+        const assignment_t *assignments = cmd->assignments;
+        cmd->assignments = parser_alloc(cmd->num_assignments * sizeof(assignment_t));
+        for (int i = 0; i < cmd->num_assignments; i++) {
+            cmd->assignments[i].text = assignments[i].text;
+            cmd->assignments[i].expand = 0;
+            if (assignments[i].expand) {
+                size_t length;
+                cmd->assignments[i].text = expand_word(assignments[i].text, &length);
+                if (cmd->assignments[i].text == NULL) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // So are redirection targets: each stays one file name
+    if (cmd->num_redirections > 0) {
+        const redirection_t *redirections = cmd->redirections;
+        cmd->redirections = parser_alloc(cmd->num_redirections * sizeof(redirection_t));
+        memcpy(cmd->redirections, redirections, cmd->num_redirections * sizeof(redirection_t));
+        for (int i = 0; i < cmd->num_redirections; i++) {
+            redirection_t *redirection = &cmd->redirections[i];
+            if (redirection->expand) {
+                size_t length;
+                redirection->target = expand_word(redirection->target, &length);
+                redirection->expand = 0;
+                if (redirection->target == NULL) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// Copy pipeline into the expansion arena with all substitutions run.
+// Returns -1 if one of them could not be started.
+int expand_pipeline(const pipeline_t *pipeline, pipeline_t *expanded) {
+    arena_t *previous = parser_set_arena(&expansion_arena);
+    int result = 0;
+
+    *expanded = *pipeline;
+    expanded->commands = parser_alloc(pipeline->num_commands * sizeof(command_t));
+    memcpy(expanded->commands, pipeline->commands, pipeline->num_commands * sizeof(command_t));
+    for (int i = 0; i < expanded->num_commands && result == 0; i++) {
+        if (command_needs_expansion(&expanded->commands[i])) {
+            result = expand_command(&expanded->commands[i]);
+        }
+    }
+
+    parser_set_arena(previous);
+    return result;
+}
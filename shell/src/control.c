@@ -0,0 +1,927 @@
+#include "control.h"
+#include "pipes.h"
+#include "jobs.h"
+#include "cmdsubst.h"
+#include "wildcard.h"
+#include "lineedit.h"
+
+// if/while/until/for/case blocks.
+//
+// A block is compiled once into a short bytecode program whose operands
+// are ordinary parse results: every simple statement in it is parsed with
+// the usual parser into the program's arena, so a loop body is tokenized
+// and parsed once, not once per iteration.  The instructions only add the
+// jumps around those statements, exit-status tests, loop frames and case
+// matching.  Words that depend on the iteration ($var, $(...), wildcards)
+// are kept as typed and expanded each time the statement runs.
+
+typedef enum {
+    OP_RUN,            // run statement a; status = its exit status
+    OP_JUMP,           // continue at a
+    OP_JUMP_IF_FALSE,  // continue at a if status != 0
+    OP_JUMP_IF_TRUE,   // continue at a if status == 0
+    OP_FOR_START,      // expand word list a into a new loop over variable b
+    OP_FOR_NEXT,       // next item into the loop variable, or drop the loop and continue at a
+    OP_LOOP_POP,       // drop the innermost loop (break out of a for)
+    OP_CASE_WORD,      // expand word list a into the case subject
+    OP_CASE_MATCH,     // continue at b if the subject matches pattern a
+    OP_SET_STATUS      // status = a
+} opcode_t;
+
+typedef struct {
+    opcode_t op;
+    int a;
+    int b;
+} instruction_t;
+
+typedef struct {
+    char *text;              // the pattern, quotes removed
+    int quoted;              // matched literally
+    int expand;              // has substitutions or variables, expanded per match
+    wildcard_t *compiled;    // compiled once when neither
+} case_pattern_t;
+
+// A compiled block.  Everything it points to lives in arena.
+typedef struct {
+    instruction_t *code;
+    int length, code_capacity;
+    command_sequence_t *statements;
+    int num_statements, statements_capacity;
+    pipeline_t *words;       // for lists and case subjects, one command each
+    int num_words, words_capacity;
+    case_pattern_t *patterns;
+    int num_patterns, patterns_capacity;
+    char **names;            // loop variable names
+    int num_names, names_capacity;
+    arena_t arena;
+} program_t;
+
+typedef struct loop_context {
+    int continue_target;
+    int break_chain;         // pending break jumps, chained through .a
+    int is_for;
+    struct loop_context *outer;
+} loop_context_t;
+
+typedef struct {
+    const char *text;
+    size_t pos;
+    program_t *program;
+    loop_context_t *loop;
+    int for_depth;
+    char error[128];         // first error, empty if none
+} compiler_t;
+
+static const char *const reserved_words[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "for", "in", "do", "done",
+    "case", "esac", "break", "continue", NULL
+};
+
+// ---- scanning ------------------------------------------------------------
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Quotes, $(...), `...` and <(...)/>(...) hide separators and keywords
+static int starts_quoted(const char *s, size_t i) {
+    return s[i] == '\'' || s[i] == '"' || s[i] == '`' ||
+           ((s[i] == '$' || s[i] == '<' || s[i] == '>') && s[i + 1] == '(');
+}
+
+// Index just past the quoted part starting at s[i]
+static size_t skip_quoted(const char *s, size_t i) {
+    char quote = s[i];
+    int depth = 0;
+
+    if (quote == '\'' || quote == '"' || quote == '`') {
+        for (i++; s[i] && s[i] != quote; i++) {
+            if (quote == '"' && s[i] == '\\' && s[i + 1]) i++;
+        }
+        return s[i] ? i + 1 : i;
+    }
+    for (i++; s[i]; i++) {
+        if (s[i] == '(') depth++;
+        else if (s[i] == ')' && --depth == 0) return i + 1;
+    }
+    return i;
+}
+
+// Index just past the word starting at s[i]
+static size_t word_end(const char *s, size_t i) {
+    while (s[i]) {
+        if (starts_quoted(s, i)) {
+            i = skip_quoted(s, i);
+        } else if (isspace((unsigned char)s[i]) || strchr(";&|<>()", s[i])) {
+            break;
+        } else {
+            i++;
+        }
+    }
+    return i;
+}
+
+static int word_is(const char *s, size_t start, size_t end, const char *word) {
+    return end - start == strlen(word) && strncmp(s + start, word, end - start) == 0;
+}
+
+// Net count of if/while/until/for/case opened minus fi/done/esac closed
+// in text, looking only at words in command position.  *opened is set
+// when a block starts anywhere in text.
+static int block_depth(const char *text, int *opened) {
+    int depth = 0, command_position = 1;
+    size_t i = 0;
+
+    *opened = 0;
+    while (text[i]) {
+        if (isspace((unsigned char)text[i]) && text[i] != '\n') {
+            i++;
+        } else if (text[i] == '\n' || text[i] == ';' || text[i] == '&' || text[i] == ')') {
+            command_position = 1;
+            i++;
+        } else if (text[i] == '|' || text[i] == '<' || text[i] == '>' || text[i] == '(') {
+            command_position = 0;
+            i = starts_quoted(text, i) ? skip_quoted(text, i) : i + 1;
+        } else {
+            size_t end = word_end(text, i);
+            int was_command_position = command_position;
+            command_position = 0;
+            if (was_command_position) {
+                if (word_is(text, i, end, "if") || word_is(text, i, end, "while") ||
+                    word_is(text, i, end, "until") || word_is(text, i, end, "for") ||
+                    word_is(text, i, end, "case")) {
+                    depth++;
+                    *opened = 1;
+                    command_position = !word_is(text, i, end, "for") && !word_is(text, i, end, "case");
+                } else if (word_is(text, i, end, "fi") || word_is(text, i, end, "done") ||
+                           word_is(text, i, end, "esac")) {
+                    depth--;
+                } else if (word_is(text, i, end, "then") || word_is(text, i, end, "do") ||
+                           word_is(text, i, end, "else") || word_is(text, i, end, "elif")) {
+                    command_position = 1;
+                }
+            }
+            i = end > i ? end : i + 1;
+        }
+    }
+    return depth;
+}
+
+// Whether text holds a block that control_execute() has to run
+int control_is_block(const char *text) {
+    int opened;
+    block_depth(text, &opened);
+    return opened;
+}
+
+// Whether text starts a block that is not closed yet
+int control_block_open(const char *text) {
+    int opened;
+    return block_depth(text, &opened) > 0;
+}
+
+// Read lines after first_line behind the continuation prompt until the
+// block it starts is closed.  Returns the whole block, lines separated by
+// newlines, or NULL (after a message) at end of input or when it gets too
+// long.
+char *control_read_block(const char *first_line) {
+    static char block[CONTROL_MAX_BLOCK];
+    char line[MAX_INPUT_LENGTH];
+    size_t used = strlen(first_line);
+
+    if (used >= sizeof(block)) {
+        return NULL;
+    }
+    memcpy(block, first_line, used + 1);
+    while (control_block_open(block)) {
+        if (!read_continuation_line(line, sizeof(line))) {
+            fprintf(parser_output(), "Syntax error: unexpected end of input in block\n");
+            return NULL;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        size_t length = strlen(line);
+        if (used + length + 2 > sizeof(block)) {
+            fprintf(parser_output(), "Syntax error: block longer than %d bytes\n", CONTROL_MAX_BLOCK);
+            return NULL;
+        }
+        block[used++] = '\n';
+        memcpy(block + used, line, length + 1);
+        used += length;
+    }
+    return block;
+}
+
+// The block on one line for the history: newlines become "; ", or just
+// a space where a separator is already there or not allowed (after do,
+// then, else).  Running the result again runs the same block.
+const char *control_history_line(const char *block) {
+    static char line[CONTROL_MAX_BLOCK];
+    size_t used = 0;
+
+    for (const char *p = block; *p && used + 3 < sizeof(line); p++) {
+        if (*p != '\n') {
+            line[used++] = *p;
+            continue;
+        }
+        size_t end = used;
+        while (end > 0 && is_blank(line[end - 1])) end--;
+        size_t start = end;
+        while (start > 0 && !isspace((unsigned char)line[start - 1]) && line[start - 1] != ';') start--;
+        if (end == 0 || strchr(";&|", line[end - 1]) != NULL ||
+            word_is(line, start, end, "do") || word_is(line, start, end, "then") ||
+            word_is(line, start, end, "else")) {
+            if (end > 0) line[used++] = ' ';
+        } else {
+            used = end;
+            line[used++] = ';';
+            line[used++] = ' ';
+        }
+    }
+    line[used] = '\0';
+    return line;
+}
+
+// ---- compiler ------------------------------------------------------------
+
+// Room for one more element in a program array (parse arena installed)
+static void *grow(void *array, int count, int *capacity, size_t size) {
+    if (count < *capacity) {
+        return array;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 16;
+    void *grown = parser_alloc(new_capacity * size);
+    if (count > 0) {
+        memcpy(grown, array, count * size);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+static void fail(compiler_t *c, const char *message, const char *word, size_t length) {
+    if (c->error[0] == '\0') {
+        snprintf(c->error, sizeof(c->error), "%s%s%.*s%s", message, word ? " '" : "",
+                 (int)length, word ? word : "", word ? "'" : "");
+    }
+}
+
+static int emit(compiler_t *c, opcode_t op, int a, int b) {
+    program_t *p = c->program;
+    p->code = grow(p->code, p->length, &p->code_capacity, sizeof(instruction_t));
+    p->code[p->length].op = op;
+    p->code[p->length].a = a;
+    p->code[p->length].b = b;
+    return p->length++;
+}
+
+// Point every jump in the chain starting at head (linked through .a) at target
+static void patch_chain(compiler_t *c, int head, int target) {
+    while (head != -1) {
+        int next = c->program->code[head].a;
+        c->program->code[head].a = target;
+        head = next;
+    }
+}
+
+static void skip_blanks(compiler_t *c) {
+    while (is_blank(c->text[c->pos])) c->pos++;
+}
+
+static void skip_newlines(compiler_t *c) {
+    while (is_blank(c->text[c->pos]) || c->text[c->pos] == '\n') c->pos++;
+}
+
+// Skip blanks, newlines and single ';' (";;" ends a case item)
+static int skip_separators(compiler_t *c) {
+    int skipped = 0;
+    for (;;) {
+        skip_blanks(c);
+        char ch = c->text[c->pos];
+        if (ch != '\n' && (ch != ';' || c->text[c->pos + 1] == ';')) {
+            return skipped;
+        }
+        c->pos++;
+        skipped = 1;
+    }
+}
+
+static int at_word(compiler_t *c, const char *word) {
+    return word_is(c->text, c->pos, word_end(c->text, c->pos), word);
+}
+
+static int at_reserved_word(compiler_t *c) {
+    for (int i = 0; reserved_words[i]; i++) {
+        if (at_word(c, reserved_words[i])) return 1;
+    }
+    return 0;
+}
+
+static int expect_word(compiler_t *c, const char *word) {
+    if (!at_word(c, word)) {
+        size_t end = word_end(c->text, c->pos);
+        char message[64];
+        snprintf(message, sizeof(message), "expected '%s'%s", word, end > c->pos ? " at" : "");
+        fail(c, message, end > c->pos ? c->text + c->pos : NULL, end - c->pos);
+        return 0;
+    }
+    c->pos += strlen(word);
+    return 1;
+}
+
+// Parse a statement's text with the ordinary parser
+static void add_statement(compiler_t *c, const char *text, size_t length) {
+    program_t *p = c->program;
+    token_t tokens[MAX_TOKENS];
+    char *line = parser_alloc(length + 1);
+
+    memcpy(line, text, length);
+    line[length] = '\0';
+    if (!parse_input(line)) {
+        fail(c, "invalid command", line, length);
+        return;
+    }
+    int count = tokenize(line, tokens);
+    if (count < 0) {
+        fail(c, "invalid command", line, length);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].type == TOKEN_HEREDOC) {
+            fail(c, "here-documents are not supported in blocks", NULL, 0);
+            return;
+        }
+    }
+
+    p->statements = grow(p->statements, p->num_statements, &p->statements_capacity,
+                         sizeof(command_sequence_t));
+    if (!parse_command_sequence(tokens, &p->statements[p->num_statements])) {
+        fail(c, "invalid command", line, length);
+        return;
+    }
+    emit(c, OP_RUN, p->num_statements++, 0);
+}
+
+// A word list (for ... in LIST, case WORD) as the arguments of one command
+static int add_words(compiler_t *c, const char *text, size_t length) {
+    program_t *p = c->program;
+    token_t tokens[MAX_TOKENS];
+    char *line = parser_alloc(length + 1);
+
+    memcpy(line, text, length);
+    line[length] = '\0';
+    int count = tokenize(line, tokens);
+    if (count < 0) {
+        fail(c, "too many words", NULL, 0);
+        return -1;
+    }
+
+    p->words = grow(p->words, p->num_words, &p->words_capacity, sizeof(pipeline_t));
+    pipeline_t *words = &p->words[p->num_words];
+    init_pipeline(words);
+    words->commands = parser_alloc(sizeof(command_t));
+    words->num_commands = 1;
+    init_command(&words->commands[0]);
+    for (int i = 0; i < count; i++) {
+        if (tokens[i].type != TOKEN_WORD) {
+            fail(c, "unexpected", tokens[i].value, strlen(tokens[i].value));
+            return -1;
+        }
+        tokens[i].assignment = 0;  // a list of words, no command name
+        command_add_word(&words->commands[0], &tokens[i]);
+    }
+    return p->num_words++;
+}
+
+static const char *compile_list(compiler_t *c, const char *const *stop);
+
+static void compile_simple(compiler_t *c) {
+    const char *s = c->text;
+    size_t start = c->pos, i = start;
+
+    while (s[i] && s[i] != '\n' && s[i] != ';') {
+        if (starts_quoted(s, i)) {
+            i = skip_quoted(s, i);
+        } else if (s[i] == '&' && s[i + 1] != '&') {
+            i++;  // "cmd &" runs in the background, the statement ends here
+            break;
+        } else {
+            i++;
+        }
+    }
+    c->pos = i;
+    add_statement(c, s + start, i - start);
+}
+
+static void compile_if(compiler_t *c) {
+    static const char *const then_word[] = { "then", NULL };
+    static const char *const branch_end[] = { "elif", "else", "fi", NULL };
+    static const char *const fi_word[] = { "fi", NULL };
+    int end_chain = -1;
+
+    c->pos += 2;
+    for (;;) {
+        compile_list(c, then_word);
+        if (!expect_word(c, "then")) return;
+        int skip = emit(c, OP_JUMP_IF_FALSE, -1, 0);
+        const char *stop = compile_list(c, branch_end);
+        if (c->error[0]) return;
+        if (stop == NULL || strcmp(stop, ";;") == 0) {
+            fail(c, "expected 'fi'", NULL, 0);
+            return;
+        }
+        end_chain = emit(c, OP_JUMP, end_chain, 0);
+        patch_chain(c, skip, c->program->length);
+        c->pos += strlen(stop);
+        if (strcmp(stop, "elif") == 0) {
+            continue;
+        }
+        if (strcmp(stop, "else") == 0) {
+            compile_list(c, fi_word);
+            if (!expect_word(c, "fi")) return;
+        } else {
+            emit(c, OP_SET_STATUS, 0, 0);  // no branch taken
+        }
+        break;
+    }
+    patch_chain(c, end_chain, c->program->length);
+}
+
+static void compile_while(compiler_t *c, int until) {
+    static const char *const do_word[] = { "do", NULL };
+    static const char *const done_word[] = { "done", NULL };
+    loop_context_t loop;
+
+    c->pos += 5;  // "while" or "until"
+    loop.continue_target = c->program->length;
+    compile_list(c, do_word);
+    if (!expect_word(c, "do")) return;
+    int exit = emit(c, until ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, -1, 0);
+
+    loop.break_chain = -1;
+    loop.is_for = 0;
+    loop.outer = c->loop;
+    c->loop = &loop;
+    compile_list(c, done_word);
+    c->loop = loop.outer;
+    if (!expect_word(c, "done")) return;
+
+    emit(c, OP_JUMP, loop.continue_target, 0);
+    patch_chain(c, exit, c->program->length);
+    emit(c, OP_SET_STATUS, 0, 0);
+    patch_chain(c, loop.break_chain, c->program->length);
+}
+
+static int is_name(const char *s, size_t length) {
+    if (length == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_')) return 0;
+    for (size_t i = 1; i < length; i++) {
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_') return 0;
+    }
+    return 1;
+}
+
+static void compile_for(compiler_t *c) {
+    static const char *const done_word[] = { "done", NULL };
+    program_t *p = c->program;
+    const char *s = c->text;
+    loop_context_t loop;
+
+    c->pos += 3;
+    skip_blanks(c);
+    size_t end = word_end(s, c->pos);
+    if (!is_name(s + c->pos, end - c->pos)) {
+        fail(c, "invalid loop variable", s + c->pos, end - c->pos);
+        return;
+    }
+    p->names = grow(p->names, p->num_names, &p->names_capacity, sizeof(char *));
+    p->names[p->num_names] = parser_alloc(end - c->pos + 1);
+    memcpy(p->names[p->num_names], s + c->pos, end - c->pos);
+    p->names[p->num_names][end - c->pos] = '\0';
+    c->pos = end;
+
+    skip_newlines(c);
+    if (!expect_word(c, "in")) return;
+    size_t start = c->pos;
+    while (s[c->pos] && s[c->pos] != ';' && s[c->pos] != '\n') {
+        c->pos = starts_quoted(s, c->pos) ? skip_quoted(s, c->pos) : c->pos + 1;
+    }
+    int list = add_words(c, s + start, c->pos - start);
+    skip_separators(c);
+    if (list == -1 || !expect_word(c, "do")) return;
+    if (++c->for_depth > CONTROL_MAX_DEPTH) {
+        fail(c, "for loops nested too deeply", NULL, 0);
+        return;
+    }
+
+    emit(c, OP_FOR_START, list, p->num_names++);
+    loop.continue_target = emit(c, OP_FOR_NEXT, -1, 0);
+    loop.break_chain = -1;
+    loop.is_for = 1;
+    loop.outer = c->loop;
+    c->loop = &loop;
+    compile_list(c, done_word);
+    c->loop = loop.outer;
+    c->for_depth--;
+    if (!expect_word(c, "done")) return;
+
+    emit(c, OP_JUMP, loop.continue_target, 0);
+    patch_chain(c, loop.continue_target, p->length);
+    patch_chain(c, loop.break_chain, p->length);
+}
+
+// A case pattern; wildcards in it match the subject, not file names
+static int add_pattern(compiler_t *c, const char *text, size_t length) {
+    program_t *p = c->program;
+    token_t tokens[MAX_TOKENS];
+    char *line = parser_alloc(length + 1);
+
+    memcpy(line, text, length);
+    line[length] = '\0';
+    if (tokenize(line, tokens) != 1 || tokens[0].type != TOKEN_WORD) {
+        fail(c, "unsupported pattern", line, length);
+        return -1;
+    }
+
+    p->patterns = grow(p->patterns, p->num_patterns, &p->patterns_capacity, sizeof(case_pattern_t));
+    case_pattern_t *pattern = &p->patterns[p->num_patterns];
+    pattern->text = parser_strdup(tokens[0].value);
+    pattern->quoted = tokens[0].quoted != 0;
+    pattern->expand = tokens[0].quoted != '\'' && has_substitution(pattern->text);
+    pattern->compiled = NULL;
+    if (!pattern->quoted && !pattern->expand && has_wildcard(pattern->text)) {
+        pattern->compiled = parser_alloc(sizeof(wildcard_t));
+        if (!wildcard_compile(pattern->compiled, pattern->text)) {
+            pattern->compiled = NULL;
+        } else {
+            pattern->compiled->match_hidden = 1;
+        }
+    }
+    return p->num_patterns++;
+}
+
+static void compile_case(compiler_t *c) {
+    static const char *const esac_word[] = { "esac", NULL };
+    const char *s = c->text;
+    int end_chain = -1;
+
+    c->pos += 4;
+    skip_blanks(c);
+    size_t end = word_end(s, c->pos);
+    if (end == c->pos) {
+        fail(c, "expected a word after 'case'", NULL, 0);
+        return;
+    }
+    int subject = add_words(c, s + c->pos, end - c->pos);
+    c->pos = end;
+    skip_newlines(c);
+    if (subject == -1 || !expect_word(c, "in")) return;
+    emit(c, OP_CASE_WORD, subject, 0);
+
+    for (;;) {
+        skip_separators(c);
+        if (at_word(c, "esac")) {
+            break;
+        }
+        if (s[c->pos] == '(') {
+            c->pos++;
+        }
+
+        int match_chain = -1;
+        for (;;) {
+            skip_blanks(c);
+            end = word_end(s, c->pos);
+            if (end == c->pos) {
+                fail(c, s[c->pos] ? "expected a pattern at" : "expected 'esac'",
+                     s[c->pos] ? s + c->pos : NULL, 1);
+                return;
+            }
+            int pattern = add_pattern(c, s + c->pos, end - c->pos);
+            if (pattern == -1) return;
+            // The b operands are chained like jump targets until patched
+            match_chain = emit(c, OP_CASE_MATCH, pattern, match_chain);
+            c->pos = end;
+            skip_blanks(c);
+            if (s[c->pos] == '|') {
+                c->pos++;
+            } else if (s[c->pos] == ')') {
+                c->pos++;
+                break;
+            } else {
+                fail(c, "expected ')' after a case pattern", NULL, 0);
+                return;
+            }
+        }
+        int next = emit(c, OP_JUMP, -1, 0);
+        while (match_chain != -1) {
+            int previous = c->program->code[match_chain].b;
+            c->program->code[match_chain].b = c->program->length;
+            match_chain = previous;
+        }
+
+        const char *stop = compile_list(c, esac_word);
+        if (c->error[0]) return;
+        end_chain = emit(c, OP_JUMP, end_chain, 0);
+        patch_chain(c, next, c->program->length);
+        if (stop == NULL) {
+            fail(c, "expected 'esac'", NULL, 0);
+            return;
+        }
+        if (strcmp(stop, ";;") == 0) {
+            c->pos += 2;
+        }
+    }
+    c->pos += 4;
+    emit(c, OP_SET_STATUS, 0, 0);  // nothing matched
+    patch_chain(c, end_chain, c->program->length);
+}
+
+// break [n] / continue [n]
+static void compile_break(compiler_t *c, int is_continue) {
+    loop_context_t *target = c->loop;
+    int levels = 1;
+
+    c->pos += is_continue ? 8 : 5;
+    skip_blanks(c);
+    if (isdigit((unsigned char)c->text[c->pos])) {
+        levels = (int)strtol(c->text + c->pos, NULL, 10);
+        c->pos = word_end(c->text, c->pos);
+    }
+    if (target == NULL || levels < 1) {
+        fail(c, is_continue ? "'continue' outside a loop" : "'break' outside a loop", NULL, 0);
+        return;
+    }
+
+    // Leave the loops in between, dropping the frames of for loops
+    for (int i = 1; i < levels && target->outer != NULL; i++) {
+        if (target->is_for) emit(c, OP_LOOP_POP, 0, 0);
+        target = target->outer;
+    }
+    if (is_continue) {
+        emit(c, OP_JUMP, target->continue_target, 0);
+    } else {
+        if (target->is_for) emit(c, OP_LOOP_POP, 0, 0);
+        emit(c, OP_SET_STATUS, 0, 0);
+        target->break_chain = emit(c, OP_JUMP, target->break_chain, 0);
+    }
+}
+
+// Compile statements up to one of the reserved words in stop, ";;" or the
+// end of the text.  Returns the word found (not consumed), ";;", or NULL
+// at the end.
+static const char *compile_list(compiler_t *c, const char *const *stop) {
+    int separated = 1;
+
+    while (c->error[0] == '\0') {
+        separated |= skip_separators(c);
+        const char *s = c->text + c->pos;
+
+        if (*s == '\0') {
+            return NULL;
+        }
+        if (s[0] == ';' && s[1] == ';') {
+            return ";;";
+        }
+        for (int i = 0; stop && stop[i]; i++) {
+            if (at_word(c, stop[i])) return stop[i];
+        }
+        size_t end = word_end(c->text, c->pos);
+        if (!separated) {
+            fail(c, "expected ';' or a newline before", s, end > c->pos ? end - c->pos : 1);
+            break;
+        }
+
+        if (at_word(c, "if")) {
+            compile_if(c);
+        } else if (at_word(c, "while") || at_word(c, "until")) {
+            compile_while(c, at_word(c, "until"));
+        } else if (at_word(c, "for")) {
+            compile_for(c);
+        } else if (at_word(c, "case")) {
+            compile_case(c);
+        } else if (at_word(c, "break") || at_word(c, "continue")) {
+            compile_break(c, at_word(c, "continue"));
+        } else if (at_reserved_word(c)) {
+            fail(c, "unexpected", s, end - c->pos);
+            break;
+        } else {
+            compile_simple(c);
+            separated = 0;
+            continue;
+        }
+
+        // Blocks end at their closing word; a pipe or redirection after it
+        // is not supported
+        skip_blanks(c);
+        if (strchr("|<>&", c->text[c->pos]) != NULL && c->text[c->pos] != '\0') {
+            fail(c, "pipes, redirections and & after a block are not supported", NULL, 0);
+            break;
+        }
+        separated = 0;
+    }
+    return NULL;
+}
+
+// ---- virtual machine -----------------------------------------------------
+
+typedef struct {
+    const char *name;
+    char **items;
+    int count;
+    int index;               // item currently in the variable
+    arena_t arena;           // the items, reused by the next loop at this depth
+} loop_frame_t;
+
+static loop_frame_t frames[CONTROL_MAX_DEPTH];
+static int depth = 0;
+
+// Value of a running for loop's variable, innermost first, or NULL
+const char *control_variable(const char *name, size_t length) {
+    for (int i = depth - 1; i >= 0; i--) {
+        const loop_frame_t *frame = &frames[i];
+        if (strlen(frame->name) == length && strncmp(frame->name, name, length) == 0 &&
+            frame->index >= 0 && frame->index < frame->count) {
+            return frame->items[frame->index];
+        }
+    }
+    return NULL;
+}
+
+// Expand a word list into the expansion arena
+static int expand_words(const program_t *p, int index, char ***args, int *argc) {
+    const pipeline_t *words = &p->words[index];
+    pipeline_t expanded;
+
+    if (pipeline_needs_expansion(words)) {
+        if (expand_pipeline(words, &expanded) == -1) {
+            return -1;
+        }
+        words = &expanded;
+    }
+    *args = words->commands[0].args;
+    *argc = words->commands[0].argc;
+    return 0;
+}
+
+static int start_loop(const program_t *p, int list, int name) {
+    loop_frame_t *frame = &frames[depth];
+    char **args;
+    int argc;
+
+    reset_expansions();
+    if (depth == CONTROL_MAX_DEPTH || expand_words(p, list, &args, &argc) == -1) {
+        return -1;
+    }
+    arena_reset(&frame->arena);
+    frame->items = arena_alloc(&frame->arena, (argc + 1) * sizeof(char *));
+    if (frame->items == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < argc; i++) {
+        frame->items[i] = arena_strdup(&frame->arena, args[i]);
+        if (frame->items[i] == NULL) return -1;
+    }
+    frame->name = p->names[name];
+    frame->count = argc;
+    frame->index = -1;
+    depth++;
+    return 0;
+}
+
+// The case subject: the expanded words joined by spaces
+static const char *case_subject(const program_t *p, int index) {
+    static char subject[MAX_INPUT_LENGTH];
+    char **args;
+    int argc;
+
+    reset_expansions();
+    if (expand_words(p, index, &args, &argc) == -1) {
+        return NULL;
+    }
+    if (argc == 1) {
+        return args[0];
+    }
+    size_t used = 0;
+    subject[0] = '\0';
+    for (int i = 0; i < argc && used < sizeof(subject); i++) {
+        used += snprintf(subject + used, sizeof(subject) - used, i > 0 ? " %s" : "%s", args[i]);
+    }
+    return subject;
+}
+
+static int pattern_matches(const case_pattern_t *pattern, const char *subject) {
+    static wildcard_t scratch;
+    const char *text = pattern->text;
+    const wildcard_t *compiled = pattern->compiled;
+
+    if (pattern->expand) {
+        text = expand_text(pattern->text);
+        if (text == NULL) return 0;
+    }
+    if (pattern->quoted || !has_wildcard(text)) {
+        return strcmp(text, subject) == 0;
+    }
+    if (compiled == NULL) {
+        if (!wildcard_compile(&scratch, text)) {
+            return strcmp(text, subject) == 0;
+        }
+        scratch.match_hidden = 1;
+        compiled = &scratch;
+    }
+    return wildcard_match(compiled, subject, strlen(subject));
+}
+
+static int run_program(const program_t *p) {
+    int base = depth;
+    int status = 0;
+    const char *subject = "";
+
+    interrupted = 0;
+    for (int pc = 0; pc < p->length;) {
+        const instruction_t *in = &p->code[pc++];
+
+        switch (in->op) {
+            case OP_RUN:
+                reset_expansions();
+                status = execute_command_sequence(&p->statements[in->a]);
+                last_exit_status = status;
+                break;
+            case OP_JUMP:
+                pc = in->a;
+                break;
+            case OP_JUMP_IF_FALSE:
+                if (status != 0) pc = in->a;
+                break;
+            case OP_JUMP_IF_TRUE:
+                if (status == 0) pc = in->a;
+                break;
+            case OP_FOR_START:
+                if (start_loop(p, in->a, in->b) == -1) {
+                    status = 1;
+                    pc = p->length;
+                } else {
+                    status = 0;
+                }
+                break;
+            case OP_FOR_NEXT:
+                if (++frames[depth - 1].index >= frames[depth - 1].count) {
+                    depth--;
+                    pc = in->a;
+                }
+                break;
+            case OP_LOOP_POP:
+                depth--;
+                break;
+            case OP_CASE_WORD:
+                subject = case_subject(p, in->a);
+                if (subject == NULL) {
+                    status = 1;
+                    pc = p->length;
+                }
+                break;
+            case OP_CASE_MATCH:
+                if (pattern_matches(&p->patterns[in->a], subject)) pc = in->b;
+                break;
+            case OP_SET_STATUS:
+                status = in->a;
+                break;
+        }
+
+        last_exit_status = status;
+
+        // Ctrl-C stops the whole block, not just the command it hit
+        if (interrupted) {
+            status = 130;
+            break;
+        }
+    }
+    depth = base;
+    return status;
+}
+
+// Compile text and run it.  Returns the exit status of the last statement
+// run, or 1 after reporting a syntax error.
+int control_execute(const char *text) {
+    program_t program;
+    compiler_t compiler;
+
+    memset(&program, 0, sizeof(program));
+    arena_init(&program.arena);
+    memset(&compiler, 0, sizeof(compiler));
+    compiler.text = text;
+    compiler.program = &program;
+
+    arena_t *previous = parser_set_arena(&program.arena);
+    int deferred = parser_defer_wildcards(1);
+    if (compile_list(&compiler, NULL) != NULL && compiler.error[0] == '\0') {
+        fail(&compiler, "unexpected", text + compiler.pos, word_end(text, compiler.pos) - compiler.pos);
+    }
+    parser_defer_wildcards(deferred);
+    parser_set_arena(previous);
+
+    int status = 1;
+    if (compiler.error[0]) {
+        printf("Syntax error: %s\n", compiler.error);
+    } else {
+        status = run_program(&program);
+    }
+    arena_free(&program.arena);
+    return status;
+}
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include "dirscan.h"
+#include <sys/syscall.h>
+#include <stdint.h>
+
+// Directory reader built directly on getdents64(2).
+//
+// Entries are read in large batches into a stack buffer and handed to the
+// caller with the file type the kernel already knows, so callers only pay
+// for a stat() when the type is unknown or a symlink has to be followed.
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static dirscan_type_t convert_type(unsigned char d_type) {
+    switch (d_type) {
+        case DT_DIR: return DIRSCAN_DIRECTORY;
+        case DT_REG: return DIRSCAN_REGULAR;
+        case DT_LNK: return DIRSCAN_SYMLINK;
+        case DT_UNKNOWN: return DIRSCAN_UNKNOWN;
+        default: return DIRSCAN_OTHER;
+    }
+}
+
+// Call visit for every entry of path.
+// Returns the number of entries visited, or -1 if path cannot be read.
+int dirscan(const char *path, dirscan_fn visit, void *context) {
+    char buffer[DIRSCAN_BUFFER_SIZE] __attribute__((aligned(8)));
+    int visited = 0;
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == -1) visited = -1;
+            break;
+        }
+
+        for (long offset = 0; offset < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buffer + offset);
+            offset += d->d_reclen;
+
+            dirscan_entry_t entry;
+            entry.name = d->d_name;
+            entry.name_length = strlen(d->d_name);
+            entry.type = convert_type(d->d_type);
+            entry.dir_fd = fd;
+
+            visited++;
+            if (!visit(&entry, context)) {
+                close(fd);
+                return visited;
+            }
+        }
+    }
+
+    close(fd);
+    return visited;
+}
+
+// Whether the entry is a directory, following symlinks like stat() does
+int dirscan_is_directory(const dirscan_entry_t *entry) {
+    struct stat st;
+
+    if (entry->type == DIRSCAN_DIRECTORY) return 1;
+    if (entry->type != DIRSCAN_UNKNOWN && entry->type != DIRSCAN_SYMLINK) return 0;
+    return fstatat(entry->dir_fd, entry->name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include "fanout.h"
+#include "pipes.h"
+#include "procsub.h"
+#include "jobs.h"
+
+// Fan-out pipelines: producer |+ (consumer) (consumer)...
+//
+// The pipeline's last stage writes into one pipe.  A splicer process
+// duplicates everything arriving there into one pipe per consumer with
+// tee(2) and moves it on with splice(2), so the data is handed along as
+// page references and never copied through user space.  Each consumer is
+// a forked shell running its command line with its pipe as stdin.
+//
+// tee() always duplicates from the head of the input pipe, so every
+// consumer must take the same bytes before they are consumed.  A round
+// tees one chunk to every consumer but the last and then splices the
+// chunk to the last.  Each call blocks until its consumer has room, so the
+// producer runs at the pace of the slowest consumer.  When a consumer takes
+// only part of a chunk (its pipe was nearly full), that round falls back
+// to one read() and write()s of the missing tails.  A consumer that exits
+// is dropped; once all have, the splicer exits and the producer gets
+// SIGPIPE.
+
+static char buffer[FANOUT_CHUNK];   // splicer side, for the copying fallback
+
+// Read exactly length bytes that are known to be in the pipe
+static void read_all(int fd, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, data, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return;
+        data += n;
+        length -= n;
+    }
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+// Move length bytes from the head of input to fd.  If fd's consumer is
+// gone, the rest is still taken off the input and -1 is returned.
+static int splice_all(int input, int fd, size_t length) {
+    while (length > 0) {
+        ssize_t n = splice(input, NULL, fd, NULL, length, SPLICE_F_MOVE);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            read_all(input, buffer, length);
+            return -1;
+        }
+        length -= n;
+    }
+    return 0;
+}
+
+// Close outputs[i] and drop it, keeping the others in order
+static void drop_output(int outputs[], size_t sent[], int *count, int i) {
+    close(outputs[i]);
+    (*count)--;
+    memmove(outputs + i, outputs + i + 1, (*count - i) * sizeof(int));
+    memmove(sent + i, sent + i + 1, (*count - i) * sizeof(size_t));
+}
+
+// Copy input to every output until end of input or no output is left
+static void fan_out(int input, int outputs[], int count) {
+    size_t sent[MAX_FANOUT_BRANCHES];
+
+    while (count > 0) {
+        ssize_t chunk = -1;   // set by the first consumer that takes data
+        int partial = 0;
+
+        for (int i = 0; i < count - 1;) {
+            ssize_t n = tee(input, outputs[i], chunk > 0 ? (size_t)chunk : FANOUT_CHUNK, 0);
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1) {
+                drop_output(outputs, sent, &count, i);  // EPIPE: consumer gone
+                continue;
+            }
+            if (n == 0) return;  // end of input
+            if (chunk == -1) chunk = n;
+            if (n < chunk) partial = 1;
+            sent[i++] = n;
+        }
+
+        int last = count - 1;
+        if (chunk == -1) {
+            // A single consumer left: move whatever arrives
+            ssize_t n = splice(input, NULL, outputs[last], NULL, FANOUT_CHUNK, SPLICE_F_MOVE);
+            if (n == 0) return;
+            if (n == -1 && errno != EINTR) drop_output(outputs, sent, &count, last);
+        } else if (partial) {
+            read_all(input, buffer, chunk);
+            sent[last] = 0;
+            for (int i = last; i >= 0; i--) {
+                if (write_all(outputs[i], buffer + sent[i], chunk - sent[i]) == -1) {
+                    drop_output(outputs, sent, &count, i);
+                }
+            }
+        } else if (splice_all(input, outputs[last], chunk) == -1) {
+            drop_output(outputs, sent, &count, last);
+        }
+    }
+}
+
+// Create the fan-out pipe, the consumers and the splicer for pipeline's
+// branches.  state->input_fd is where the last stage has to write (-1 if
+// the pipeline has no fan-out).  Returns -1 after reporting an error, with
+// anything already started cleaned up.
+int start_fanout(const pipeline_t *pipeline, int capture_fd, fanout_state_t *state) {
+    int input[2];
+    int branch[MAX_FANOUT_BRANCHES][2];
+    int outputs[MAX_FANOUT_BRANCHES];
+    int opened = 0;
+
+    state->count = 0;
+    state->splicer = -1;
+    state->input_fd = -1;
+    if (pipeline->num_branches == 0) {
+        return 0;
+    }
+
+    if (pipe2(input, O_CLOEXEC) == -1) {
+        perror("Fan-out failed");
+        return -1;
+    }
+    while (opened < pipeline->num_branches && pipe2(branch[opened], O_CLOEXEC) == 0) {
+        opened++;
+    }
+    if (opened < pipeline->num_branches) {
+        perror("Fan-out failed");
+        goto fail;
+    }
+
+    for (int i = 0; i < pipeline->num_branches; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTSTP, SIG_DFL);
+            close_all_process_subs();
+            dup2(branch[i][0], STDIN_FILENO);
+            if (capture_fd != -1) {
+                dup2(capture_fd, STDOUT_FILENO);
+                dup2(capture_fd, STDERR_FILENO);
+                close(capture_fd);
+            }
+            close(input[0]);
+            close(input[1]);
+            for (int j = 0; j < opened; j++) {
+                close(branch[j][0]);
+                close(branch[j][1]);
+            }
+            exit(execute_final_command_line(pipeline->branches[i]));
+        } else if (pid < 0) {
+            perror("fork failed");
+            goto fail;
+        }
+        state->pids[state->count++] = pid;
+    }
+
+    state->splicer = fork();
+    if (state->splicer == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);  // a consumer that is gone shows up as EPIPE
+        close_all_process_subs();
+        close(input[1]);
+        for (int i = 0; i < opened; i++) {
+            close(branch[i][0]);
+            outputs[i] = branch[i][1];
+        }
+        fan_out(input[0], outputs, opened);
+        _exit(0);
+    } else if (state->splicer < 0) {
+        perror("fork failed");
+        goto fail;
+    }
+
+    close(input[0]);
+    for (int i = 0; i < opened; i++) {
+        close(branch[i][0]);
+        close(branch[i][1]);
+    }
+    state->input_fd = input[1];
+    return 0;
+
+fail:
+    // Consumers already started see end of input and exit
+    close(input[0]);
+    close(input[1]);
+    for (int i = 0; i < opened; i++) {
+        close(branch[i][0]);
+        close(branch[i][1]);
+    }
+    state->splicer = -1;
+    finish_fanout(state, 1);
+    return -1;
+}
+
+// Every stage has been started: the shell's copy of the write end goes
+void close_fanout_input(fanout_state_t *state) {
+    if (state->input_fd != -1) {
+        close(state->input_fd);
+        state->input_fd = -1;
+    }
+}
+
+// Wait for the splicer and the consumers now, or leave them to the job
+// system.  Returns the exit status of the last consumer when waiting.
+int finish_fanout(fanout_state_t *state, int wait_now) {
+    int status = 0;
+
+    if (state->splicer > 0) {
+        if (wait_now) waitpid(state->splicer, NULL, 0);
+        else add_job_helper(state->splicer);
+    }
+    for (int i = 0; i < state->count; i++) {
+        if (!wait_now) {
+            add_job_helper(state->pids[i]);
+        } else if (waitpid(state->pids[i], &status, 0) == -1) {
+            status = 1 << 8;
+        }
+    }
+    state->count = 0;
+    state->splicer = -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
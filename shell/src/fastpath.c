@@ -0,0 +1,460 @@
+#define _GNU_SOURCE
+#include "fastpath.h"
+#include "functs.h"
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+// In-process cat, head, tail and wc for pipeline stages.
+//
+// With CSHELL_FASTPATH set to 1, or to a list such as "cat,wc", a
+// foreground pipeline stage running one of these tools in a form the
+// shell reproduces exactly runs on a thread of the shell, like the
+// threaded builtins, instead of being forked and exec'd:
+//
+//   cat [file...]               sendfile() or splice() into the output
+//   head [-n N | -N] [file]     memchr() up to the Nth newline
+//   tail [-n N | -N] [file]     memrchr() backward from the end
+//   wc -l [file], wc -c [file]  newlines counted with vector compares
+//
+// Regular files are mapped instead of read.  Any other form (more
+// options, several files for head, tail or wc, reading the terminal) runs
+// the real program, so the output is always what coreutils would print.
+
+typedef enum {
+    TOOL_CAT,
+    TOOL_HEAD,
+    TOOL_TAIL,
+    TOOL_WC
+} tool_t;
+
+typedef struct {
+    tool_t tool;
+    long long lines;         // head, tail: -n
+    int bytes;               // wc: -c rather than -l
+    int first_file;          // argv index of the first operand
+} invocation_t;
+
+// The unread part of a regular file, mapped
+typedef struct {
+    char *base;
+    size_t mapped;
+    const char *data;
+    size_t size;
+} mapping_t;
+
+// Whether CSHELL_FASTPATH enables the tool name
+static int enabled(const char *name) {
+    const char *setting = getenv(FASTPATH_ENV);
+    size_t length = strlen(name);
+
+    if (setting == NULL || *setting == '\0' || strcmp(setting, "0") == 0) {
+        return 0;
+    }
+    if (strcmp(setting, "1") == 0) {
+        return 1;
+    }
+    for (const char *p = setting; *p;) {
+        size_t item = strcspn(p, ",");
+        if (item == length && strncmp(p, name, length) == 0) return 1;
+        p += item;
+        if (*p == ',') p++;
+    }
+    return 0;
+}
+
+static int parse_count(const char *text, long long *count) {
+    char *end;
+
+    if (!isdigit((unsigned char)*text)) {
+        return -1;
+    }
+    errno = 0;
+    *count = strtoll(text, &end, 10);
+    return (*end != '\0' || errno == ERANGE) ? -1 : 0;
+}
+
+static int is_operand(const char *arg) {
+    return arg[0] != '-' || strcmp(arg, "-") == 0;
+}
+
+// Parse argv as one of the forms run here.  Returns -1 for anything else.
+static int parse_invocation(int argc, char *argv[], invocation_t *invocation) {
+    int i = 1;
+
+    if (argc < 1 || argv[0] == NULL) {
+        return -1;
+    }
+    invocation->lines = FASTPATH_DEFAULT_LINES;
+    invocation->bytes = 0;
+    if (strcmp(argv[0], "cat") == 0) {
+        for (int j = 1; j < argc; j++) {
+            if (!is_operand(argv[j])) return -1;
+        }
+        invocation->tool = TOOL_CAT;
+        invocation->first_file = 1;
+        return 0;
+    }
+
+    if (strcmp(argv[0], "head") == 0 || strcmp(argv[0], "tail") == 0) {
+        invocation->tool = argv[0][0] == 'h' ? TOOL_HEAD : TOOL_TAIL;
+        if (i < argc && strcmp(argv[i], "-n") == 0) {
+            if (i + 1 >= argc || parse_count(argv[i + 1], &invocation->lines) == -1) return -1;
+            i += 2;
+        } else if (i < argc && strncmp(argv[i], "-n", 2) == 0) {
+            if (parse_count(argv[i] + 2, &invocation->lines) == -1) return -1;
+            i++;
+        } else if (i < argc && argv[i][0] == '-' && isdigit((unsigned char)argv[i][1])) {
+            if (parse_count(argv[i] + 1, &invocation->lines) == -1) return -1;
+            i++;
+        }
+    } else if (strcmp(argv[0], "wc") == 0) {
+        if (i >= argc || (strcmp(argv[i], "-l") != 0 && strcmp(argv[i], "-c") != 0)) return -1;
+        invocation->tool = TOOL_WC;
+        invocation->bytes = (argv[i][1] == 'c');
+        i++;
+    } else {
+        return -1;
+    }
+
+    // One operand at most: with more, the tools print headers or totals
+    if (argc - i > 1 || (i < argc && !is_operand(argv[i]))) {
+        return -1;
+    }
+    invocation->first_file = i;
+    return 0;
+}
+
+// Whether cmd, a stage of a foreground pipeline, can run here.  Its stdin
+// must not be the shell's terminal, which a thread cannot be interrupted
+// from reading.
+int fast_path_applies(const command_t *cmd, int stdin_is_pipe) {
+    invocation_t invocation;
+
+    if (cmd->argc == 0 || cmd->num_subs > 0 ||
+        parse_invocation(cmd->argc, cmd->args, &invocation) == -1 || !enabled(cmd->args[0])) {
+        return 0;
+    }
+    if (stdin_is_pipe) {
+        return 1;
+    }
+    for (int r = 0; r < cmd->num_redirections; r++) {
+        if (cmd->redirections[r].fd == STDIN_FILENO) return 1;
+    }
+    for (int i = invocation.first_file; i < cmd->argc; i++) {
+        if (strcmp(cmd->args[i], "-") == 0) return 0;
+    }
+    return invocation.first_file < cmd->argc;
+}
+
+// Map the unread part of fd if it is a non-empty regular file
+static int map_input(int fd, mapping_t *mapping, int advice) {
+    struct stat st;
+    off_t offset;
+
+    mapping->base = NULL;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (offset = lseek(fd, 0, SEEK_CUR)) == -1 || offset > st.st_size) {
+        return -1;
+    }
+    mapping->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping->base == MAP_FAILED) {
+        mapping->base = NULL;
+        return -1;
+    }
+    madvise(mapping->base, st.st_size, advice);
+    mapping->mapped = st.st_size;
+    mapping->data = mapping->base + offset;
+    mapping->size = st.st_size - offset;
+    return 0;
+}
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+// The tools below return 0, -1 when reading failed or -2 when writing
+// failed, with errno set.
+
+// Copy in to out: sendfile() from a file, splice() when either end is a
+// pipe, else read() and write()
+static int cat_fd(int in, int out, char *buffer) {
+    ssize_t n;
+    int started = 0;
+
+    while ((n = sendfile(out, in, NULL, 1 << 30)) != 0) {
+        if (n > 0) started = 1;
+        else if (errno == EINTR) continue;
+        else if (started || (errno != EINVAL && errno != ENOSYS)) return errno == EPIPE ? -2 : -1;
+        else break;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    while ((n = splice(in, NULL, out, NULL, FASTPATH_CHUNK, SPLICE_F_MOVE)) != 0) {
+        if (n > 0) started = 1;
+        else if (errno == EINTR) continue;
+        else if (started || errno != EINVAL) return errno == EPIPE ? -2 : -1;
+        else break;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    while ((n = read(in, buffer, FASTPATH_CHUNK)) != 0) {
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        if (write_all(out, buffer, n) == -1) return -2;
+    }
+    return 0;
+}
+
+// Length of the first lines lines of data (all of it if fewer), counting
+// down lines
+static size_t head_length(const char *data, size_t size, long long *lines) {
+    const char *p = data;
+    const char *end = data + size;
+    const char *newline;
+
+    while (*lines > 0 && (newline = memchr(p, '\n', end - p)) != NULL) {
+        p = newline + 1;
+        (*lines)--;
+    }
+    return *lines > 0 ? size : (size_t)(p - data);
+}
+
+static int head_fd(int in, int out, long long lines, char *buffer) {
+    mapping_t mapping;
+    ssize_t n;
+
+    if (lines == 0) {
+        return 0;
+    }
+    if (map_input(in, &mapping, MADV_SEQUENTIAL) == 0) {
+        int result = write_all(out, mapping.data, head_length(mapping.data, mapping.size, &lines));
+        munmap(mapping.base, mapping.mapped);
+        return result == -1 ? -2 : 0;
+    }
+    while (lines > 0 && (n = read(in, buffer, FASTPATH_CHUNK)) != 0) {
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        if (write_all(out, buffer, head_length(buffer, n, &lines)) == -1) return -2;
+    }
+    return 0;
+}
+
+// Offset where the last lines lines of data start.  A final newline ends
+// the last line rather than starting another.
+static size_t tail_start(const char *data, size_t size, long long lines) {
+    size_t end = size;
+
+    if (lines == 0) {
+        return size;
+    }
+    if (end > 0 && data[end - 1] == '\n') {
+        end--;
+    }
+    while (end > 0) {
+        const char *newline = memrchr(data, '\n', end);
+        if (newline == NULL) return 0;
+        if (--lines == 0) return newline - data + 1;
+        end = newline - data;
+    }
+    return 0;
+}
+
+static int tail_fd(int in, int out, long long lines) {
+    mapping_t mapping;
+    char *kept = NULL;
+    size_t used = 0, capacity = 0;
+    ssize_t n;
+
+    if (map_input(in, &mapping, MADV_NORMAL) == 0) {
+        size_t start = tail_start(mapping.data, mapping.size, lines);
+        int result = write_all(out, mapping.data + start, mapping.size - start);
+        munmap(mapping.base, mapping.mapped);
+        return result == -1 ? -2 : 0;
+    }
+
+    // A stream keeps at least its last lines lines; when the buffer is full
+    // and they fill less than half of it, the rest is dropped
+    for (;;) {
+        if (used == capacity) {
+            size_t start = tail_start(kept, used, lines);
+            if (start > 0 && start >= used / 2) {
+                memmove(kept, kept + start, used - start);
+                used -= start;
+            } else {
+                size_t grown_capacity = capacity ? capacity * 2 : FASTPATH_CHUNK;
+                char *grown = realloc(kept, grown_capacity);
+                if (grown == NULL) {
+                    free(kept);
+                    errno = ENOMEM;
+                    return -1;
+                }
+                kept = grown;
+                capacity = grown_capacity;
+            }
+        }
+        n = read(in, kept + used, capacity - used);
+        if (n == 0) break;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            free(kept);
+            return -1;
+        }
+        used += n;
+    }
+    size_t start = tail_start(kept, used, lines);
+    int result = write_all(out, kept + start, used - start);
+    free(kept);
+    return result == -1 ? -2 : 0;
+}
+
+// Number of newlines in data.  Each of FASTPATH_LANES byte counters
+// takes every FASTPATH_LANES-th byte for up to 255 rounds before they are
+// added up, a loop the compiler turns into vector compares and adds
+// (fastpath.o is built with -O2 for it).
+static size_t count_newlines(const char *data, size_t size) {
+    const size_t block = 255 * FASTPATH_LANES;
+    size_t count = 0;
+
+    while (size > 0) {
+        size_t length = size < block ? size : block;
+        unsigned char lanes[FASTPATH_LANES] = { 0 };
+        size_t i = 0;
+
+        for (; i + FASTPATH_LANES <= length; i += FASTPATH_LANES) {
+            for (int lane = 0; lane < FASTPATH_LANES; lane++) {
+                lanes[lane] += (data[i + lane] == '\n');
+            }
+        }
+        for (int lane = 0; lane < FASTPATH_LANES; lane++) {
+            count += lanes[lane];
+        }
+        for (; i < length; i++) {
+            count += (data[i] == '\n');
+        }
+        data += length;
+        size -= length;
+    }
+    return count;
+}
+
+static int wc_fd(int in, int bytes, char *buffer, size_t *count) {
+    mapping_t mapping;
+    struct stat st;
+    off_t offset;
+    ssize_t n;
+
+    *count = 0;
+    if (bytes && fstat(in, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        (offset = lseek(in, 0, SEEK_CUR)) != -1) {
+        *count = offset < st.st_size ? st.st_size - offset : 0;
+        return 0;
+    }
+    if (!bytes && map_input(in, &mapping, MADV_SEQUENTIAL) == 0) {
+        *count = count_newlines(mapping.data, mapping.size);
+        munmap(mapping.base, mapping.mapped);
+        return 0;
+    }
+    while ((n = read(in, buffer, FASTPATH_CHUNK)) != 0) {
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) return -1;
+        *count += bytes ? (size_t)n : count_newlines(buffer, n);
+    }
+    return 0;
+}
+
+// Report a failure to open or read name as coreutils words it
+static void report(const invocation_t *invocation, const char *tool, const char *name, int opening, int error) {
+    if (invocation->tool == TOOL_HEAD || invocation->tool == TOOL_TAIL) {
+        if (opening) {
+            fprintf(stderr, "%s: cannot open '%s' for reading: %s\n", tool, name, strerror(error));
+        } else {
+            fprintf(stderr, "%s: error reading '%s': %s\n", tool, name, strerror(error));
+        }
+    } else {
+        fprintf(stderr, "%s: %s: %s\n", tool, name, strerror(error));
+    }
+}
+
+// Run a command fast_path_applies() accepted, reading builtin_input() and
+// writing to builtin_output()
+int run_fast_path(int argc, char *argv[]) {
+    invocation_t invocation;
+    FILE *out = builtin_output();
+    int status = 0;
+
+    if (parse_invocation(argc, argv, &invocation) == -1) {
+        return 1;
+    }
+    char *buffer = malloc(FASTPATH_CHUNK);
+    if (buffer == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    fflush(out);
+    int output = fileno(out);
+
+    int first = invocation.first_file;
+    int operands = argc - first;
+    for (int i = 0; i < (operands > 0 ? operands : 1); i++) {
+        const char *name = operands > 0 ? argv[first + i] : "-";
+        int from_stdin = (strcmp(name, "-") == 0);
+        const char *shown = from_stdin ? "standard input" : name;
+        int in = from_stdin ? builtin_input() : open(name, O_RDONLY | O_CLOEXEC);
+        size_t count = 0;
+        int result = 0;
+
+        if (in == -1) {
+            report(&invocation, argv[0], shown, 1, errno);
+            status = 1;
+            continue;
+        }
+        switch (invocation.tool) {
+            case TOOL_CAT:
+                result = cat_fd(in, output, buffer);
+                break;
+            case TOOL_HEAD:
+                result = head_fd(in, output, invocation.lines, buffer);
+                break;
+            case TOOL_TAIL:
+                result = tail_fd(in, output, invocation.lines);
+                break;
+            case TOOL_WC:
+                result = wc_fd(in, invocation.bytes, buffer, &count);
+                break;
+        }
+        int error = errno;
+        if (!from_stdin) {
+            close(in);
+        }
+
+        if (result == -2) {
+            if (error != EPIPE) {  // EPIPE: the reader is gone
+                fprintf(stderr, "%s: write error: %s\n", argv[0], strerror(error));
+            }
+            status = 1;
+            break;
+        }
+        if (result == -1) {
+            report(&invocation, argv[0], shown, 0, error);
+            status = 1;
+        }
+        if (invocation.tool == TOOL_WC) {
+            if (operands > 0) {
+                fprintf(out, "%zu %s\n", count, name);
+            } else {
+                fprintf(out, "%zu\n", count);
+            }
+        }
+    }
+    free(buffer);
+    return status;
+}
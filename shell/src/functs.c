@@ -1,6 +1,17 @@
 #include "functs.h"
+#include "dirscan.h"
+#include "placement.h"
+#include "jobstat.h"
+#include "joblog.h"
+#include "variables.h"
 
 static char home_directory[MAX_PATH_LENGTH];
+
+// Where the running builtin writes and reads.  A builtin running as a
+// pipeline stage on a thread (pipes.c) gets its stage's pipe ends here,
+// leaving the shell's own stdin and stdout alone.
+static __thread FILE *thread_output = NULL;
+static __thread int thread_input = -1;
 static char previous_directory[MAX_PATH_LENGTH];
 static int has_previous_dir = 0;
 
@@ -23,6 +34,17 @@ void init_shell_directories() {
     has_previous_dir = 0;
 }
 
+// Exchange hop's "-" directory with saved (MAX_PATH_LENGTH bytes, "" for
+// none), for the server's per-connection working directories
+void swap_previous_directory(char *saved) {
+    char current[MAX_PATH_LENGTH];
+
+    snprintf(current, sizeof(current), "%s", has_previous_dir ? previous_directory : "");
+    snprintf(previous_directory, sizeof(previous_directory), "%s", saved);
+    has_previous_dir = saved[0] != '\0';
+    memcpy(saved, current, sizeof(current));
+}
+
 // Helper function to check if directory exists
 int directory_exists(const char *path) {
     struct stat st;
@@ -141,11 +163,54 @@ int hop_command(int argc, char *argv[]) {
     return 0;
 }
 
-// Structure for directory entries
+// Read up to max_entries entries of a directory, unsorted.  Hidden entries
+// are skipped unless show_hidden is set; if prefix is non-NULL only names
+// starting with it are returned (and only those are stat()ed).
+// Returns the number of entries read, or -1 if the directory cannot be opened.
 typedef struct {
-    char name[256];
-    int is_directory;
-} dir_entry_t;
+    int show_hidden;
+    const char *prefix;
+    size_t prefix_len;
+    dir_entry_t *entries;
+    int max_entries;
+    int count;
+} directory_listing_t;
+
+static int add_listing_entry(const dirscan_entry_t *entry, void *context) {
+    directory_listing_t *listing = context;
+
+    // Skip hidden files if not requested
+    if (!listing->show_hidden && entry->name[0] == '.') {
+        return 1;
+    }
+    if (listing->prefix_len && strncmp(entry->name, listing->prefix, listing->prefix_len) != 0) {
+        return 1;
+    }
+    if (entry->name_length >= sizeof(listing->entries[0].name)) {
+        return 1;
+    }
+
+    dir_entry_t *out = &listing->entries[listing->count++];
+    memcpy(out->name, entry->name, entry->name_length + 1);
+    // The kernel reports the type; only symlinks and unknown types cost a stat
+    out->is_directory = dirscan_is_directory(entry);
+
+    return listing->count < listing->max_entries;
+}
+
+int read_directory(const char *path, int show_hidden, const char *prefix,
+                   dir_entry_t entries[], int max_entries) {
+    directory_listing_t listing = { show_hidden, prefix, prefix ? strlen(prefix) : 0,
+                                    entries, max_entries, 0 };
+
+    if (max_entries <= 0) {
+        return 0;
+    }
+    if (dirscan(path, add_listing_entry, &listing) == -1) {
+        return -1;
+    }
+    return listing.count;
+}
 
 // Comparison function for qsort (lexicographic order using ASCII values)
 int compare_entries(const void *a, const void *b) {
@@ -156,6 +221,7 @@ int compare_entries(const void *a, const void *b) {
 
 // Implementation of reveal command
 int reveal_command(int argc, char *argv[]) {
+    FILE *out = builtin_output();
     int show_hidden = 0;
     int line_format = 0;
     char target_dir[MAX_PATH_LENGTH];
@@ -174,7 +240,7 @@ int reveal_command(int argc, char *argv[]) {
                     line_format = 1;
                     break;
                 default:
-                    printf("reveal: Invalid flag -%c\n", *flag_ptr);
+                    fprintf(out, "reveal: Invalid flag -%c\n", *flag_ptr);
                     return 1;
             }
             flag_ptr++;
@@ -184,7 +250,7 @@ int reveal_command(int argc, char *argv[]) {
     
     // Check for too many arguments (more than one directory argument)
     if (argc - arg_index > 1) {
-        printf("reveal: Invalid Syntax!\n");
+        fprintf(out, "reveal: Invalid Syntax!\n");
         return 1;
     }
     
@@ -192,12 +258,12 @@ int reveal_command(int argc, char *argv[]) {
     if (arg_index < argc) {
         // Handle special case of "reveal -" with no previous directory
         if (strcmp(argv[arg_index], "-") == 0 && !has_previous_dir) {
-            printf("No such directory!\n");
+            fprintf(out, "No such directory!\n");
             return 1;
         }
         
         if (!resolve_path(argv[arg_index], target_dir)) {
-            printf("No such directory!\n");
+            fprintf(out, "No such directory!\n");
             return 1;
         }
     } else {
@@ -210,48 +276,18 @@ int reveal_command(int argc, char *argv[]) {
     
     // Check if target directory exists
     if (!directory_exists(target_dir)) {
-        printf("No such directory!\n");
-        return 1;
-    }
-    
-    // Open directory
-    DIR *dir = opendir(target_dir);
-    if (dir == NULL) {
-        printf("No such directory!\n");
+        fprintf(out, "No such directory!\n");
         return 1;
     }
     
     // Read directory entries
     dir_entry_t entries[MAX_ENTRIES];
-    int entry_count = 0;
-    struct dirent *entry;
-    
-    while ((entry = readdir(dir)) != NULL && entry_count < MAX_ENTRIES) {
-        // Skip hidden files if not requested
-        if (!show_hidden && entry->d_name[0] == '.') {
-            continue;
-        }
-        
-        strcpy(entries[entry_count].name, entry->d_name);
-        
-        // Check if it's a directory
-        char full_path[MAX_PATH_LENGTH];
-        size_t path_len = snprintf(full_path, sizeof(full_path), "%s/%s", target_dir, entry->d_name);
-        
-        // Check if the path was truncated
-        if (path_len >= sizeof(full_path)) {
-            // Path too long, skip this entry or handle error
-            continue;
-        }
-        
-        struct stat st;
-        entries[entry_count].is_directory = (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode));
-        
-        entry_count++;
+    int entry_count = read_directory(target_dir, show_hidden, NULL, entries, MAX_ENTRIES);
+    if (entry_count == -1) {
+        fprintf(out, "No such directory!\n");
+        return 1;
     }
     
-    closedir(dir);
-    
     // Sort entries lexicographically
     qsort(entries, entry_count, sizeof(dir_entry_t), compare_entries);
     
@@ -259,18 +295,18 @@ int reveal_command(int argc, char *argv[]) {
     if (line_format) {
         // Line by line format
         for (int i = 0; i < entry_count; i++) {
-            printf("%s\n", entries[i].name);
+            fprintf(out, "%s\n", entries[i].name);
         }
     } else {
         // Default format (like ls)
         for (int i = 0; i < entry_count; i++) {
-            printf("%s", entries[i].name);
+            fprintf(out, "%s", entries[i].name);
             if (i < entry_count - 1) {
-                printf("  ");
+                fprintf(out, "  ");
             }
         }
         if (entry_count > 0) {
-            printf("\n");
+            fprintf(out, "\n");
         }
     }
     
@@ -280,9 +316,10 @@ int reveal_command(int argc, char *argv[]) {
 
 //  ping 
 int ping_command(int argc, char *argv[]) {
+    FILE *out = builtin_output();
     // Check argument count
     if (argc != 3) {
-        printf("Usage: ping <pid> <signal_number>\n");
+        fprintf(out, "Usage: ping <pid> <signal_number>\n");
         return 1;
     }
     
@@ -290,14 +327,14 @@ int ping_command(int argc, char *argv[]) {
     char *endptr;
     pid_t pid = (pid_t)strtol(argv[1], &endptr, 10);
     if (*endptr != '\0' || pid <= 0) {
-        printf("Invalid PID: %s\n", argv[1]);
+        fprintf(out, "Invalid PID: %s\n", argv[1]);
         return 1;
     }
     
     // Parse signal number
     int signal_number = (int)strtol(argv[2], &endptr, 10);
     if (*endptr != '\0') {
-        printf("Invalid signal number: %s\n", argv[2]);
+        fprintf(out, "Invalid signal number: %s\n", argv[2]);
         return 1;
     }
     
@@ -307,12 +344,12 @@ int ping_command(int argc, char *argv[]) {
     // Send the signal
     if (kill(pid, actual_signal) == 0) {
         // Success
-        printf("Sent signal %d to process with pid %d\n", signal_number, pid);
+        fprintf(out, "Sent signal %d to process with pid %d\n", signal_number, pid);
         return 0;
     } else {
         // Failed to send signal
         if (errno == ESRCH) {
-            printf("No such process found\n");
+            fprintf(out, "No such process found\n");
         } else {
             perror("Failed to send signal");
         }
@@ -320,23 +357,89 @@ int ping_command(int argc, char *argv[]) {
     }
 }
 
-int execute_builtin_command(int argc, char *argv[]) {
-    if (argc == 0) return 0;
-    
-   if (strcmp(argv[0], "hop") == 0) {
-        return hop_command(argc, argv);
-    } else if (strcmp(argv[0], "reveal") == 0) {
-        return reveal_command(argc, argv);
-    } else if (strcmp(argv[0], "activities") == 0) {
+// activities [-v | -w [seconds]]
+static int activities_builtin(int argc, char *argv[]) {
+    FILE *out = builtin_output();
+    if (argc == 1) {
         return activities_command();
-    } else if (strcmp(argv[0], "ping") == 0) {
-        return ping_command(argc, argv);
-    } else if (strcmp(argv[0], "fg") == 0) {
-        return fg_command(argc, argv);
-    } else if (strcmp(argv[0], "bg") == 0) {
-        return bg_command(argc, argv);
     }
+    if (argc == 2 && strcmp(argv[1], "-v") == 0) {
+        return activities_verbose();
+    }
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "-w") == 0) {
+        double interval = JOBSTAT_DEFAULT_INTERVAL;
+        if (argc == 3) {
+            char *end;
+            interval = strtod(argv[2], &end);
+            if (*end != '\0' || interval < 0.1) {
+                fprintf(out, "Invalid interval: %s\n", argv[2]);
+                return 1;
+            }
+        }
+        return activities_watch(interval);
+    }
+    fprintf(out, "Usage: activities [-v | -w [seconds]]\n");
+    return 1;
+}
+
+// Every builtin the shell knows about.  Dispatch and tab completion both
+// read this table, so a new builtin only needs an entry here.  Builtins
+// that change the shell's state (directory, foreground job) or start
+// commands are not threaded: in a pipeline they run in a forked child.
+const builtin_t builtin_table[] = {
+    { "hop", hop_command, 0 },
+    { "reveal", reveal_command, 1 },
+    { "activities", activities_builtin, 1 },
+    { "ping", ping_command, 1 },
+    { "fg", fg_command, 0 },
+    { "bg", bg_command, 0 },
+    { "history", history_command, 1 },
+    { "parsecache", parsecache_command, 1 },
+    { "place", place_command, 0 },
+    { "joblog", joblog_command, 1 },
+    { "export", export_command, 0 },
+    { NULL, NULL, 0 }
+};
 
-    return -1; // Not a builtin command
+static const builtin_t *find_builtin(const char *name) {
+    for (const builtin_t *b = builtin_table; b->name != NULL; b++) {
+        if (strcmp(b->name, name) == 0) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+int is_builtin_command(const char *name) {
+    return name != NULL && find_builtin(name) != NULL;
+}
+
+int builtin_runs_on_thread(const char *name) {
+    const builtin_t *builtin = name != NULL ? find_builtin(name) : NULL;
+    return builtin != NULL && builtin->threaded;
+}
+
+FILE *builtin_output() {
+    return thread_output != NULL ? thread_output : stdout;
+}
+
+int builtin_input() {
+    return thread_input != -1 ? thread_input : STDIN_FILENO;
+}
+
+// Give the calling thread's builtins their own output and input
+void set_builtin_io(FILE *output, int input_fd) {
+    thread_output = output;
+    thread_input = input_fd;
+}
+
+int execute_builtin_command(int argc, char *argv[]) {
+    if (argc == 0) return 0;
+
+    const builtin_t *builtin = find_builtin(argv[0]);
+    if (builtin == NULL) {
+        return -1; // Not a builtin command
+    }
+    return builtin->handler(argc, argv);
 }
 // LLM CODE ENDS
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "heredoc.h"
+#include "lineedit.h"
+#include <sys/mman.h>
+
+// Here-documents (<<WORD) and here-strings (<<<word).
+//
+// The text is collected into the parse arena while parsing and handed to
+// the command as stdin through a sealed memfd: no temporary file on disk
+// and no helper process feeding a pipe.
+
+// Read lines until one equal to delimiter and return them as one string
+// in the parse arena.  End of input also ends the document.
+char *read_heredoc_body(const char *delimiter, size_t *length) {
+    char line[MAX_INPUT_LENGTH];
+    char *body = NULL;
+    size_t used = 0;
+    size_t capacity = 0;
+
+    for (;;) {
+        if (!read_continuation_line(line, sizeof(line))) {
+            fprintf(parser_errors(), "warning: here-document delimited by end-of-file (wanted `%s')\n", delimiter);
+            break;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        if (strcmp(line, delimiter) == 0) {
+            break;
+        }
+
+        size_t line_length = strlen(line);
+        if (used + line_length + 1 > HEREDOC_MAX_SIZE) {
+            fprintf(parser_errors(), "warning: here-document larger than %d bytes, truncated\n", HEREDOC_MAX_SIZE);
+            continue;
+        }
+        if (used + line_length + 1 > capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 1024;
+            while (new_capacity < used + line_length + 1) new_capacity *= 2;
+            char *grown = realloc(body, new_capacity);
+            if (grown == NULL) {
+                break;
+            }
+            body = grown;
+            capacity = new_capacity;
+        }
+        memcpy(body + used, line, line_length);
+        used += line_length;
+        body[used++] = '\n';
+    }
+
+    char *text = parser_alloc(used + 1);
+    if (used) memcpy(text, body, used);
+    text[used] = '\0';
+    free(body);
+
+    *length = used;
+    return text;
+}
+
+// The stdin text of a here-string: the word plus a newline
+char *herestring_body(const char *word, size_t *length) {
+    size_t word_length = strlen(word);
+    char *text = parser_alloc(word_length + 2);
+
+    memcpy(text, word, word_length);
+    text[word_length] = '\n';
+    text[word_length + 1] = '\0';
+    *length = word_length + 1;
+    return text;
+}
+
+// Return a read-only fd positioned at the start of text, or -1.
+// The memfd is sealed so the reader sees exactly this content.
+int heredoc_open(const char *text, size_t length) {
+    int fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, text + written, length - written);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1 ||
+        lseek(fd, 0, SEEK_SET) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
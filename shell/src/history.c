@@ -0,0 +1,378 @@
+#include "history.h"
+#include "functs.h"
+#include <sys/mman.h>
+
+// Persistent command history.
+//
+// The history file is append-only and shared between shells.  Records are
+// read through a read-only shared mapping that is re-established whenever
+// the file has grown, so entries written by other shells show up on the
+// next lookup.  Substring and prefix search go through a trigram index
+// that is built lazily on the first search and extended incrementally.
+
+#define HISTORY_MAX_LINE 4096
+#define HISTORY_TRIGRAM_BITS 17
+#define HISTORY_PREFIX_MARK '\001'  // virtual first character, lets the index answer prefix queries
+
+static int history_fd = -1;
+static char *history_map = NULL;
+static size_t history_map_size = 0;
+static size_t history_scanned = 0;     // bytes of the file already split into records
+
+static size_t *record_offsets = NULL;  // offset of each record header in the file
+static int record_count = 0;
+static int record_capacity = 0;
+
+typedef struct {
+    unsigned int *ids;
+    unsigned int count;
+    unsigned int capacity;
+} posting_list_t;
+
+static posting_list_t *trigram_index = NULL;
+static int indexed_count = 0;          // records already added to trigram_index
+
+static unsigned int fnv1a(const char *s, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static size_t record_size(unsigned int length) {
+    return sizeof(history_record_t) + ((length + 1 + 3) & ~(size_t)3);
+}
+
+static const history_record_t *record_at(int index) {
+    return (const history_record_t *)(history_map + record_offsets[index]);
+}
+
+static const char *record_text(const history_record_t *rec) {
+    return (const char *)(rec + 1);
+}
+
+void init_history() {
+    char path[PATH_MAX];
+    const char *file = getenv("HISTFILE");
+
+    if (file != NULL && *file) {
+        snprintf(path, sizeof(path), "%s", file);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL) {
+            struct passwd *pw = getpwuid(getuid());
+            home = pw ? pw->pw_dir : "/";
+        }
+        snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE_NAME);
+    }
+
+    history_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history_fd == -1) {
+        perror("history: open failed");
+    }
+}
+
+// Map any newly appended bytes and split them into records
+static void history_sync() {
+    struct stat st;
+
+    if (history_fd == -1 || fstat(history_fd, &st) == -1) {
+        return;
+    }
+
+    size_t size = (size_t)st.st_size;
+    if (size > history_map_size) {
+        if (history_map != NULL) {
+            munmap(history_map, history_map_size);
+        }
+        history_map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+        if (history_map == MAP_FAILED) {
+            history_map = NULL;
+            history_map_size = 0;
+            return;
+        }
+        history_map_size = size;
+    }
+
+    while (history_scanned + sizeof(history_record_t) <= history_map_size) {
+        const history_record_t *rec = (const history_record_t *)(history_map + history_scanned);
+
+        // Damaged bytes: step to the next aligned slot and look for a header
+        if (rec->magic != HISTORY_RECORD_MAGIC || rec->length > HISTORY_MAX_LINE) {
+            history_scanned += 4;
+            continue;
+        }
+
+        size_t total = record_size(rec->length);
+        if (history_scanned + total > history_map_size) {
+            break; // Still being written, pick it up next time
+        }
+
+        const char *text = record_text(rec);
+        if (text[rec->length] != '\0' || fnv1a(text, rec->length) != rec->checksum) {
+            history_scanned += 4;
+            continue;
+        }
+
+        if (record_count == record_capacity) {
+            int new_capacity = record_capacity ? record_capacity * 2 : 1024;
+            size_t *grown = realloc(record_offsets, new_capacity * sizeof(size_t));
+            if (grown == NULL) {
+                return;
+            }
+            record_offsets = grown;
+            record_capacity = new_capacity;
+        }
+        record_offsets[record_count++] = history_scanned;
+        history_scanned += total;
+    }
+}
+
+void history_add(const char *line) {
+    char buffer[sizeof(history_record_t) + HISTORY_MAX_LINE + 4];
+    size_t length = strlen(line);
+
+    if (history_fd == -1 || length == 0 || length > HISTORY_MAX_LINE) {
+        return;
+    }
+
+    history_record_t *rec = (history_record_t *)buffer;
+    size_t total = record_size((unsigned int)length);
+
+    rec->magic = HISTORY_RECORD_MAGIC;
+    rec->length = (unsigned int)length;
+    rec->checksum = fnv1a(line, length);
+    memcpy(buffer + sizeof(history_record_t), line, length);
+    memset(buffer + sizeof(history_record_t) + length, 0, total - sizeof(history_record_t) - length);
+
+    // One write per record: O_APPEND keeps concurrent shells from interleaving
+    if (write(history_fd, buffer, total) != (ssize_t)total) {
+        perror("history: write failed");
+    }
+}
+
+int history_count() {
+    history_sync();
+    return history_map ? record_count : 0;
+}
+
+const char *history_get(int index) {
+    if (history_map == NULL || index < 0 || index >= record_count) {
+        return NULL;
+    }
+    return record_text(record_at(index));
+}
+
+// ---- trigram index -------------------------------------------------------
+
+static unsigned int trigram_bucket(unsigned char a, unsigned char b, unsigned char c) {
+    unsigned int trigram = ((unsigned int)a << 16) | ((unsigned int)b << 8) | c;
+    return (trigram * 2654435761u) >> (32 - HISTORY_TRIGRAM_BITS);
+}
+
+// Character i of the text with the prefix mark in front of it
+static unsigned char marked_char(const char *text, size_t i) {
+    return i == 0 ? HISTORY_PREFIX_MARK : (unsigned char)text[i - 1];
+}
+
+static int index_record(int id) {
+    const history_record_t *rec = record_at(id);
+    const char *text = record_text(rec);
+    size_t marked_length = rec->length + 1;
+
+    for (size_t i = 0; i + 2 < marked_length; i++) {
+        posting_list_t *list = &trigram_index[trigram_bucket(marked_char(text, i),
+                                                             marked_char(text, i + 1),
+                                                             marked_char(text, i + 2))];
+        // Ids arrive in order, so a repeat within this record is always last
+        if (list->count > 0 && list->ids[list->count - 1] == (unsigned int)id) {
+            continue;
+        }
+        if (list->count == list->capacity) {
+            unsigned int new_capacity = list->capacity ? list->capacity * 2 : 4;
+            unsigned int *grown = realloc(list->ids, new_capacity * sizeof(unsigned int));
+            if (grown == NULL) {
+                return 0;
+            }
+            list->ids = grown;
+            list->capacity = new_capacity;
+        }
+        list->ids[list->count++] = (unsigned int)id;
+    }
+    return 1;
+}
+
+static int history_update_index() {
+    if (trigram_index == NULL) {
+        trigram_index = calloc((size_t)1 << HISTORY_TRIGRAM_BITS, sizeof(posting_list_t));
+        if (trigram_index == NULL) {
+            return 0;
+        }
+    }
+    while (indexed_count < record_count) {
+        if (!index_record(indexed_count)) {
+            return 0;
+        }
+        indexed_count++;
+    }
+    return 1;
+}
+
+// Smallest posting list covering every trigram of the (marked) query.
+// Returns NULL when the query is too short for the index to help.
+static const posting_list_t *best_posting_list(const char *query, int prefix) {
+    size_t length = strlen(query);
+    size_t start = prefix ? 0 : 1;
+    size_t end = length + 1;
+    const posting_list_t *best = NULL;
+
+    for (size_t i = start; i + 2 < end; i++) {
+        const posting_list_t *list = &trigram_index[trigram_bucket(marked_char(query, i),
+                                                                   marked_char(query, i + 1),
+                                                                   marked_char(query, i + 2))];
+        if (best == NULL || list->count < best->count) {
+            best = list;
+        }
+    }
+    return best;
+}
+
+// ---- history builtin -----------------------------------------------------
+
+typedef struct {
+    int *ids;
+    int count;
+    int capacity;
+} id_set_t;
+
+static unsigned int id_set_hash(int id) {
+    return record_at(id)->checksum;
+}
+
+static int same_text(int a, int b) {
+    const history_record_t *ra = record_at(a);
+    const history_record_t *rb = record_at(b);
+    return ra->length == rb->length && memcmp(record_text(ra), record_text(rb), ra->length) == 0;
+}
+
+// Insert id unless a record with the same text is already present.
+// Returns 1 if inserted, 0 if it was a duplicate, -1 on allocation failure.
+static int id_set_insert(id_set_t *set, int id) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        int new_capacity = set->capacity ? set->capacity * 2 : 64;
+        int *slots = malloc(new_capacity * sizeof(int));
+        if (slots == NULL) {
+            return -1;
+        }
+        for (int i = 0; i < new_capacity; i++) {
+            slots[i] = -1;
+        }
+        for (int i = 0; i < set->capacity; i++) {
+            if (set->ids[i] >= 0) {
+                unsigned int slot = id_set_hash(set->ids[i]) & (new_capacity - 1);
+                while (slots[slot] >= 0) slot = (slot + 1) & (new_capacity - 1);
+                slots[slot] = set->ids[i];
+            }
+        }
+        free(set->ids);
+        set->ids = slots;
+        set->capacity = new_capacity;
+    }
+
+    unsigned int slot = id_set_hash(id) & (set->capacity - 1);
+    while (set->ids[slot] >= 0) {
+        if (same_text(set->ids[slot], id)) {
+            return 0;
+        }
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    set->ids[slot] = id;
+    set->count++;
+    return 1;
+}
+
+static int matches(int id, const char *query, int prefix) {
+    const char *text = record_text(record_at(id));
+    if (query == NULL) return 1;
+    return prefix ? strncmp(text, query, strlen(query)) == 0 : strstr(text, query) != NULL;
+}
+
+int history_command(int argc, char *argv[]) {
+    FILE *out = builtin_output();
+    int unique = 0;
+    int limit = -1;
+    const char *query = NULL;
+    int prefix = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-u") == 0) {
+            unique = 1;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            char *endptr;
+            limit = (int)strtol(argv[++i], &endptr, 10);
+            if (*endptr != '\0' || limit <= 0) {
+                fprintf(out, "history: Invalid count: %s\n", argv[i]);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "-s") == 0) &&
+                   i + 1 < argc && query == NULL) {
+            prefix = (argv[i][1] == 'p');
+            query = argv[++i];
+        } else {
+            fprintf(out, "Usage: history [-u] [-n count] [-p prefix | -s text]\n");
+            return 1;
+        }
+    }
+
+    // Plain listing shows the most recent entries, searches show every match
+    if (limit == -1) {
+        limit = query ? 0 : HISTORY_DEFAULT_COUNT;
+    }
+
+    int total = history_count();
+    if (total == 0) {
+        return 0;
+    }
+
+    const posting_list_t *candidates = NULL;
+    if (query != NULL && history_update_index()) {
+        candidates = best_posting_list(query, prefix);
+    }
+
+    // Collect newest first, then print oldest first like a normal listing
+    int *results = NULL;
+    int result_count = 0;
+    int result_capacity = 0;
+    id_set_t seen = { NULL, 0, 0 };
+    int remaining = candidates ? (int)candidates->count : total;
+
+    while (remaining > 0 && (limit == 0 || result_count < limit)) {
+        int id = candidates ? (int)candidates->ids[--remaining] : --remaining;
+
+        if (!matches(id, query, prefix)) continue;
+        if (unique) {
+            int inserted = id_set_insert(&seen, id);
+            if (inserted == 0) continue;
+            if (inserted < 0) break;
+        }
+
+        if (result_count == result_capacity) {
+            int new_capacity = result_capacity ? result_capacity * 2 : 64;
+            int *grown = realloc(results, new_capacity * sizeof(int));
+            if (grown == NULL) break;
+            results = grown;
+            result_capacity = new_capacity;
+        }
+        results[result_count++] = id;
+    }
+
+    for (int i = result_count - 1; i >= 0; i--) {
+        fprintf(out, "%6d  %s\n", results[i] + 1, record_text(record_at(results[i])));
+    }
+
+    free(results);
+    free(seen.ids);
+    return 0;
+}
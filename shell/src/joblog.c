@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include "joblog.h"
+#include "jobs.h"
+#include "functs.h"
+#include <poll.h>
+#include <sys/mman.h>
+
+// Output capture for background jobs.
+//
+// With CSHELL_JOBLOG set to a size (e.g. 256K or 4M), the stdout and
+// stderr of each background job go into a pipe instead of the terminal.
+// A small drainer process forked from the shell reads the pipe straight
+// into a ring buffer of that size in a memfd; the shell maps the same
+// memfd and joblog reads it from there.  When the ring is full the oldest
+// output is overwritten, so a chatty job costs a fixed amount of memory
+// and never blocks on the terminal or on the shell.
+//
+// The data pages are mapped twice, back to back, so any stretch of up to
+// the ring size is contiguous in memory: the drainer read()s into the
+// ring without splitting at the wrap and readers copy out in one piece.
+
+typedef struct {
+    unsigned long long written;  // bytes ever received; the end is written % size
+    int done;                    // the job closed its end and all of it is in
+} joblog_header_t;
+
+typedef struct {
+    int job_id;                  // 0 when the slot is free
+    char command_name[MAX_COMMAND_NAME];
+    joblog_header_t *header;     // shared with the drainer
+    char *data;                  // size bytes, mapped twice
+    size_t size;
+} joblog_t;
+
+static joblog_t logs[JOBLOG_MAX_LOGS];
+static joblog_t pending;         // set up by joblog_begin(), not yet attached
+static int pending_fd = -1;      // the job's end of the capture pipe
+static char chunk[JOBLOG_CHUNK_SIZE];
+
+// Ring size from CSHELL_JOBLOG ("65536", "256K", "4M"), rounded up to
+// whole pages.  0 when capture is off.
+static size_t ring_size() {
+    const char *value = getenv(JOBLOG_ENV);
+    long page = sysconf(_SC_PAGESIZE);
+    char *end;
+
+    if (value == NULL || *value == '\0') {
+        return 0;
+    }
+    unsigned long long size = strtoull(value, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; end++; break;
+        case 'm': case 'M': size <<= 20; end++; break;
+        case 'g': case 'G': size <<= 30; end++; break;
+    }
+    if (*end != '\0' || size == 0) {
+        fprintf(stderr, "%s: invalid size '%s', output not captured\n", JOBLOG_ENV, value);
+        return 0;
+    }
+    return (size + page - 1) / page * page;
+}
+
+static void unmap_log(joblog_t *log) {
+    if (log->header != NULL) {
+        munmap(log->header, sysconf(_SC_PAGESIZE));
+        munmap(log->data, 2 * log->size);
+    }
+    log->header = NULL;
+    log->data = NULL;
+    log->job_id = 0;
+}
+
+// Map a memfd of one header page plus size data bytes, the data twice
+static int map_log(joblog_t *log, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    int fd = memfd_create("joblog", MFD_CLOEXEC);
+
+    if (fd == -1 || ftruncate(fd, page + size) == -1) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    char *base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *header = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED || header == MAP_FAILED ||
+        mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, page) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, page) == MAP_FAILED) {
+        if (base != MAP_FAILED) munmap(base, 2 * size);
+        if (header != MAP_FAILED) munmap(header, page);
+        close(fd);
+        return -1;
+    }
+    close(fd);  // the mappings keep it alive
+
+    log->header = header;
+    log->data = base;
+    log->size = size;
+    return 0;
+}
+
+// Drainer process: copy the pipe into the ring until the job is done
+static void drain(int fd, joblog_t *log) {
+    unsigned long long written = 0;
+
+    for (;;) {
+        ssize_t n = read(fd, log->data + written % log->size, log->size);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += (unsigned long long)n;
+        __atomic_store_n(&log->header->written, written, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&log->header->done, 1, __ATOMIC_RELEASE);
+    _exit(0);
+}
+
+// Prepare capture for a background job about to be started.  Returns the
+// fd to make its stdout and stderr, or -1 when output is not captured.
+// Follow with joblog_attach() once the job has a number, or
+// joblog_cancel() if it could not be started.
+int joblog_begin() {
+    size_t size = ring_size();
+    int fds[2];
+
+    if (size == 0) {
+        return -1;
+    }
+    if (map_log(&pending, size) == -1) {
+        perror("joblog");
+        return -1;
+    }
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("joblog");
+        unmap_log(&pending);
+        return -1;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTSTP, SIG_IGN);
+        close(fds[1]);
+        drain(fds[0], &pending);
+    } else if (pid < 0) {
+        perror("fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        unmap_log(&pending);
+        return -1;
+    }
+    close(fds[0]);
+    add_job_helper(pid);
+    pending_fd = fds[1];
+    return pending_fd;
+}
+
+// Slot for a new log: a free one, else the one of the oldest finished job
+static joblog_t *free_slot() {
+    joblog_t *oldest = NULL;
+
+    for (int i = 0; i < JOBLOG_MAX_LOGS; i++) {
+        if (logs[i].job_id == 0) {
+            return &logs[i];
+        }
+        if (__atomic_load_n(&logs[i].header->done, __ATOMIC_ACQUIRE) &&
+            (oldest == NULL || logs[i].job_id < oldest->job_id)) {
+            oldest = &logs[i];
+        }
+    }
+    return oldest;
+}
+
+// The job started by the last joblog_begin() got job_id
+void joblog_attach(int job_id, const char *command_name) {
+    if (pending_fd == -1) {
+        return;
+    }
+    close(pending_fd);  // the drainer sees EOF once the job's copies close
+    pending_fd = -1;
+
+    joblog_t *slot = NULL;
+    for (int i = 0; i < JOBLOG_MAX_LOGS; i++) {
+        if (logs[i].job_id == job_id) slot = &logs[i];
+    }
+    if (slot == NULL) slot = free_slot();
+    if (job_id <= 0 || slot == NULL) {
+        // Nowhere to keep it; the drainer still runs, so the job never blocks
+        unmap_log(&pending);
+        return;
+    }
+    unmap_log(slot);
+    *slot = pending;
+    slot->job_id = job_id;
+    snprintf(slot->command_name, sizeof(slot->command_name), "%s", command_name);
+    pending.header = NULL;
+}
+
+void joblog_cancel() {
+    if (pending_fd == -1) {
+        return;
+    }
+    close(pending_fd);
+    pending_fd = -1;
+    unmap_log(&pending);
+}
+
+static joblog_t *find_log(int job_id) {
+    for (int i = 0; i < JOBLOG_MAX_LOGS; i++) {
+        if (logs[i].job_id == job_id) return &logs[i];
+    }
+    return NULL;
+}
+
+// Print what arrived in log since *shown and advance *shown.  Output
+// overwritten before it could be printed is reported as dropped.
+static void print_new_output(joblog_t *log, unsigned long long *shown) {
+    FILE *out = builtin_output();
+    for (;;) {
+        unsigned long long written = __atomic_load_n(&log->header->written, __ATOMIC_ACQUIRE);
+        unsigned long long oldest = written > log->size ? written - log->size : 0;
+
+        if (*shown < oldest) {
+            fflush(out);
+            fprintf(stderr, "[joblog: %llu bytes dropped]\n", oldest - *shown);
+            *shown = oldest;
+        }
+        if (*shown == written) {
+            break;
+        }
+
+        size_t length = written - *shown < sizeof(chunk) ? (size_t)(written - *shown) : sizeof(chunk);
+        memcpy(chunk, log->data + *shown % log->size, length);
+
+        // The drainer may have lapped us while we copied; keep only what
+        // was still intact afterwards
+        written = __atomic_load_n(&log->header->written, __ATOMIC_ACQUIRE);
+        oldest = written > log->size ? written - log->size : 0;
+        if (oldest > *shown) {
+            continue;
+        }
+        fwrite(chunk, 1, length, out);
+        *shown += length;
+    }
+    fflush(out);
+}
+
+// joblog -f: print output as it arrives until the job is done, a line is
+// entered, input ends, Ctrl-C interrupts the wait or the output goes away
+static int follow_log(joblog_t *log) {
+    FILE *out = builtin_output();
+    unsigned long long shown = 0;
+
+    interrupted = 0;
+    for (;;) {
+        int done = __atomic_load_n(&log->header->done, __ATOMIC_ACQUIRE);
+        print_new_output(log, &shown);
+        if (done || ferror(out)) {
+            break;
+        }
+
+        // Ctrl-C on a pipeline thread only sets the flag (see activities_watch)
+        struct pollfd input = { builtin_input(), POLLIN, 0 };
+        int ready = poll(&input, 1, JOBLOG_FOLLOW_MS);
+        if (ready != 0 || interrupted) {
+            char discard[256];
+            if (ready > 0 && read(input.fd, discard, sizeof(discard)) < 0) {
+                perror("joblog");
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static void list_logs() {
+    FILE *out = builtin_output();
+    for (int i = 0; i < JOBLOG_MAX_LOGS; i++) {
+        joblog_t *log = &logs[i];
+        if (log->job_id == 0) continue;
+
+        unsigned long long written = __atomic_load_n(&log->header->written, __ATOMIC_ACQUIRE);
+        fprintf(out, "[%d] %s - %llu bytes%s%s\n", log->job_id, log->command_name, written,
+                written > log->size ? " (wrapped)" : "",
+                __atomic_load_n(&log->header->done, __ATOMIC_ACQUIRE) ? "" : " (running)");
+    }
+}
+
+// joblog [-f] [job_id]: list the captured logs, or print or follow one
+int joblog_command(int argc, char *argv[]) {
+    FILE *out = builtin_output();
+    int follow = argc > 1 && strcmp(argv[1], "-f") == 0;
+    int first = follow ? 2 : 1;
+
+    if (argc == 1) {
+        list_logs();
+        return 0;
+    }
+    if (argc != first + 1) {
+        fprintf(out, "Usage: joblog [-f] [job_id]\n");
+        return 1;
+    }
+
+    const char *id = argv[first][0] == '%' ? argv[first] + 1 : argv[first];
+    char *end;
+    int job_id = (int)strtol(id, &end, 10);
+    if (*end != '\0' || job_id <= 0) {
+        fprintf(out, "Invalid job number: %s\n", argv[first]);
+        return 1;
+    }
+    joblog_t *log = find_log(job_id);
+    if (log == NULL) {
+        fprintf(out, "No output captured for job %d\n", job_id);
+        return 1;
+    }
+
+    if (follow) {
+        return follow_log(log);
+    }
+    unsigned long long shown = 0;
+    print_new_output(log, &shown);
+    return 0;
+}
@@ -1,4 +1,8 @@
 #include "jobs.h"
+#include "zygote.h"
+#include "functs.h"
+#include "admission.h"
+#include "placement.h"
 
 // Global job tracking
 job_t jobs[MAX_JOBS];
@@ -7,6 +11,11 @@ int next_job_id = 1;
 pid_t current_foreground_pid;  // Track current foreground process
 pid_t current_foreground_pgid;
 char current_foreground_command[MAX_COMMAND_NAME] = "";
+
+// Process substitution producers of jobs that were not waited for.
+// They are not jobs of their own; they are reaped along with the jobs.
+static pid_t job_helpers[MAX_JOB_HELPERS];
+static int job_helper_count = 0;
 // LLM CODE BEGINS
 void init_job_system() {
     for (int i = 0; i < MAX_JOBS; i++) {
@@ -20,7 +29,10 @@ void init_job_system() {
     // Setup signal handlers
     setup_signal_handlers();
 }
+volatile sig_atomic_t interrupted = 0;
+
 void sigint_handler(int sig) {
+    interrupted = 1; // Lets a running block stop (control.c)
     if (current_foreground_pgid > 0) {
         // Send SIGINT to the foreground process group
         kill(-current_foreground_pgid, SIGINT);
@@ -32,22 +44,11 @@ void sigint_handler(int sig) {
 // Signal handler for SIGTSTP (Ctrl-Z)
 void sigtstp_handler(int sig) {
     if (current_foreground_pid > 0) {
-        // Send SIGTSTP to the foreground process group
+        // Send SIGTSTP to the foreground process group.  The code waiting
+        // for it sees the stop and records the job.
         kill(-current_foreground_pgid, SIGTSTP);
-        
-        // Add the stopped process to job list
-        int job_id = add_stopped_job(current_foreground_pid, current_foreground_command);
-        if (job_id > 0) {
-            printf("\n[%d] Stopped %s\n", job_id, current_foreground_command);
-        }
-        
-        // Clear foreground process
-        current_foreground_pid = 0;
-        current_foreground_pgid = 0;
-        current_foreground_command[0] = '\0';
-    } else {
-        printf("\n");
     }
+    printf("\n");
     fflush(stdout);
 }
 void setup_signal_handlers() {
@@ -66,7 +67,24 @@ void setup_signal_handlers() {
     sigaction(SIGTSTP, &sa_tstp, NULL);
 }
 
+// Job slot the next add_background_job() fills in, set while a queued
+// job is being started so that it keeps its job number
+static job_t *claimed_job = NULL;
+
+void claim_background_job(job_t *job) {
+    claimed_job = job;
+}
+
 int add_background_job(pid_t pid, const char *command_name) {
+    if (claimed_job != NULL) {
+        claimed_job->pid = pid;
+        claimed_job->state = JOB_RUNNING;
+        printf("[%d] %d\n", claimed_job->job_id, pid);
+        int job_id = claimed_job->job_id;
+        claimed_job = NULL;
+        return job_id;
+    }
+
     // Find an empty slot
     for (int i = 0; i < MAX_JOBS; i++) {
         if (!jobs[i].active) {
@@ -103,14 +121,39 @@ int add_stopped_job(pid_t pid, const char *command_name) {
     return -1; // No slots available
 }
 
+// A background job waiting for admission: it has a job number but no
+// process yet
+job_t *add_queued_job(const char *command_name) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (!jobs[i].active) {
+            jobs[i].job_id = next_job_id++;
+            jobs[i].pid = 0;
+            strncpy(jobs[i].command_name, command_name, MAX_COMMAND_NAME - 1);
+            jobs[i].command_name[MAX_COMMAND_NAME - 1] = '\0';
+            jobs[i].state = JOB_QUEUED;
+            jobs[i].active = 1;
+
+            printf("[%d] queued\n", jobs[i].job_id);
+            return &jobs[i];
+        }
+    }
+    return NULL;
+}
+
 void kill_all_children() {
     // Kill all active background jobs
     for (int i = 0; i < MAX_JOBS; i++) {
         if (jobs[i].active) {
-            kill(jobs[i].pid, SIGKILL);
+            if (jobs[i].state != JOB_QUEUED) {
+                kill(jobs[i].pid, SIGKILL);
+            }
             jobs[i].active = 0;
         }
     }
+    for (int i = 0; i < job_helper_count; i++) {
+        kill(job_helpers[i], SIGKILL);
+    }
+    job_helper_count = 0;
     
     // Also kill current foreground process if any
     if (current_foreground_pid > 0) {
@@ -120,9 +163,9 @@ void kill_all_children() {
 
 void update_job_states() {
     for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].active) {
+        if (jobs[i].active && jobs[i].state != JOB_QUEUED) {
             int status;
-            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG | WUNTRACED);
+            pid_t result = wait_process(jobs[i].pid, &status, WNOHANG | WUNTRACED);
             
             if (result == jobs[i].pid) {
                 if (WIFEXITED(status) || WIFSIGNALED(status)) {
@@ -143,11 +186,33 @@ void update_job_states() {
     }
 }
 
+// Track a helper process to be reaped by check_background_jobs()
+void add_job_helper(pid_t pid) {
+    if (job_helper_count == MAX_JOB_HELPERS) {
+        // Table full: block on the oldest rather than leak a zombie
+        waitpid(job_helpers[0], NULL, 0);
+        job_helpers[0] = job_helpers[--job_helper_count];
+    }
+    job_helpers[job_helper_count++] = pid;
+}
+
+static void reap_job_helpers() {
+    for (int i = 0; i < job_helper_count;) {
+        pid_t result = waitpid(job_helpers[i], NULL, WNOHANG);
+        if (result == job_helpers[i] || result == -1) {
+            job_helpers[i] = job_helpers[--job_helper_count];
+        } else {
+            i++;
+        }
+    }
+}
+
 void check_background_jobs() {
+    reap_job_helpers();
     for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].active) {
+        if (jobs[i].active && jobs[i].state != JOB_QUEUED) {
             int status;
-            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG | WUNTRACED);
+            pid_t result = wait_process(jobs[i].pid, &status, WNOHANG | WUNTRACED);
             
             if (result == jobs[i].pid) {
                 if (WIFEXITED(status) || WIFSIGNALED(status)) {
@@ -190,6 +255,7 @@ int compare_jobs(const void *a, const void *b) {
 }
 
 int activities_command() {
+    FILE *out = builtin_output();
     // Update job states first
     update_job_states();
     
@@ -223,15 +289,30 @@ int activities_command() {
             case JOB_STOPPED:
                 state_str = "Stopped";
                 break;
+            case JOB_QUEUED:
+                state_str = "Queued";
+                break;
             default:
                 state_str = "Unknown";
                 break;
         }
         
-        printf("[%d] : %s - %s\n", 
-               sorted_jobs[i].pid, 
-               sorted_jobs[i].command_name, 
-               state_str);
+        if (sorted_jobs[i].state == JOB_QUEUED) {
+            fprintf(out, "[-] : %s - %s\n", sorted_jobs[i].command_name, state_str);
+            continue;
+        }
+        char placement[256];
+        if (describe_placement(sorted_jobs[i].pid, placement, sizeof(placement)) > 0) {
+            fprintf(out, "[%d] : %s - %s (%s)\n",
+                    sorted_jobs[i].pid,
+                    sorted_jobs[i].command_name,
+                    state_str, placement);
+            continue;
+        }
+        fprintf(out, "[%d] : %s - %s\n", 
+                sorted_jobs[i].pid, 
+                sorted_jobs[i].command_name, 
+                state_str);
     }
     
     return 0;
@@ -292,6 +373,11 @@ int fg_command(int argc, char *argv[]) {
     
     // Print the command being brought to foreground
     printf("%s\n", target_job->command_name);
+
+    // A job still waiting for admission starts right away, in front
+    if (target_job->state == JOB_QUEUED) {
+        return start_queued_job(target_job, 1);
+    }
     
     // Set as current foreground process
     current_foreground_pid = target_job->pid;
@@ -313,12 +399,16 @@ int fg_command(int argc, char *argv[]) {
     // Wait for the job to complete or stop
     int status;
     do {
-        waitpid(target_job->pid, &status, WUNTRACED);
+        if (wait_process(target_job->pid, &status, WUNTRACED) == -1) {
+            target_job->active = 0;
+            target_job->state = JOB_TERMINATED;
+            break;
+        }
         
         if (WIFSTOPPED(status)) {
             // Process was stopped again
             target_job->state = JOB_STOPPED;
-            printf("\n[%d] Stopped %s\n", target_job->job_id, target_job->command_name);
+            printf("[%d] Stopped %s\n", target_job->job_id, target_job->command_name);
             break;
         } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
             // Process completed
@@ -374,6 +464,11 @@ int bg_command(int argc, char *argv[]) {
         return 1;
     }
     
+    // A job waiting for admission is started without waiting any longer
+    if (target_job->state == JOB_QUEUED) {
+        return start_queued_job(target_job, 0);
+    }
+    
     // Check if job is stopped (only stopped jobs can be resumed with bg)
     if (target_job->state != JOB_STOPPED) {
         printf("Job is not stopped\n");
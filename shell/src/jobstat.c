@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+#include "jobstat.h"
+#include "jobs.h"
+#include "functs.h"
+#include <poll.h>
+#include <time.h>
+
+// Resource figures for activities -v and -w.
+//
+// Each job slot keeps /proc/<pid>/stat, /statm and /io open from its first
+// sample on and re-reads them with pread(), so a refresh costs three reads
+// per job: no opens, no allocation.  The descriptors refer to the process
+// itself, so a recycled pid can never be mistaken for the job.  CPU% is
+// the CPU time used since the previous sample over the time since then.
+
+typedef struct {
+    pid_t pid;               // process the descriptors belong to, 0 if none
+    int stat_fd;
+    int statm_fd;
+    int io_fd;               // -1 when /proc/<pid>/io is not readable
+    unsigned long long last_ticks;
+    long long last_ns;
+} job_monitor_t;
+
+typedef struct {
+    double cpu_percent;
+    unsigned long long rss_bytes;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    int has_io;
+    long threads;
+    double elapsed;
+} job_sample_t;
+
+static job_monitor_t monitors[MAX_JOBS];
+static char buffer[JOBSTAT_BUFFER_SIZE];
+
+static long long boottime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int open_proc_file(pid_t pid, const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void close_monitor(job_monitor_t *monitor) {
+    if (monitor->pid == 0) {
+        return;
+    }
+    if (monitor->stat_fd != -1) close(monitor->stat_fd);
+    if (monitor->statm_fd != -1) close(monitor->statm_fd);
+    if (monitor->io_fd != -1) close(monitor->io_fd);
+    monitor->pid = 0;
+}
+
+static void open_monitor(job_monitor_t *monitor, pid_t pid) {
+    close_monitor(monitor);
+    monitor->pid = pid;
+    monitor->stat_fd = open_proc_file(pid, "stat");
+    monitor->statm_fd = open_proc_file(pid, "statm");
+    monitor->io_fd = open_proc_file(pid, "io");
+    monitor->last_ticks = 0;
+    monitor->last_ns = 0;
+}
+
+// Read fd from the start into buffer, NUL-terminated
+static ssize_t read_proc(int fd) {
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    buffer[n > 0 ? n : 0] = '\0';
+    return n;
+}
+
+// Returns 0 when the process is gone
+static int sample_job(job_monitor_t *monitor, job_sample_t *sample) {
+    static long ticks_per_second = 0;
+    static long page_size = 0;
+    unsigned long long utime, stime, start_ticks, size_pages, resident_pages;
+
+    if (ticks_per_second == 0) {
+        ticks_per_second = sysconf(_SC_CLK_TCK);
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+
+    // pid (comm) state ...; comm may contain spaces or parens.  Fields 14
+    // and 15 are utime and stime, 20 the thread count, 22 the start time.
+    if (read_proc(monitor->stat_fd) <= 0) {
+        return 0;
+    }
+    char *rest = strrchr(buffer, ')');
+    if (rest == NULL ||
+        sscanf(rest + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %ld %*d %llu",
+               &utime, &stime, &sample->threads, &start_ticks) != 4) {
+        return 0;
+    }
+
+    long long now = boottime_ns();
+    unsigned long long ticks = utime + stime;
+    sample->elapsed = now / 1e9 - (double)start_ticks / ticks_per_second;
+    if (monitor->last_ns != 0 && now > monitor->last_ns) {
+        sample->cpu_percent = (double)(ticks - monitor->last_ticks) / ticks_per_second * 1e11 /
+                              (double)(now - monitor->last_ns);
+    } else {
+        sample->cpu_percent = sample->elapsed > 0
+                                  ? (double)ticks / ticks_per_second * 100.0 / sample->elapsed
+                                  : 0.0;
+    }
+    monitor->last_ticks = ticks;
+    monitor->last_ns = now;
+
+    sample->rss_bytes = 0;
+    if (read_proc(monitor->statm_fd) > 0 &&
+        sscanf(buffer, "%llu %llu", &size_pages, &resident_pages) == 2) {
+        sample->rss_bytes = resident_pages * (unsigned long long)page_size;
+    }
+
+    sample->has_io = read_proc(monitor->io_fd) > 0 &&
+                     sscanf(buffer, "rchar: %llu wchar: %llu",
+                            &sample->read_bytes, &sample->write_bytes) == 2;
+    return 1;
+}
+
+static void format_bytes(unsigned long long bytes, char *out, size_t size) {
+    static const char units[] = "BKMGTP";
+    double value = (double)bytes;
+    int unit = 0;
+
+    while (value >= 1024 && unit < 5) {
+        value /= 1024;
+        unit++;
+    }
+    if (unit == 0) {
+        snprintf(out, size, "%lluB", bytes);
+    } else {
+        snprintf(out, size, value < 10 ? "%.1f%c" : "%.0f%c", value, units[unit]);
+    }
+}
+
+// [[d-]hh:]mm:ss, like ps
+static void format_elapsed(double seconds, char *out, size_t size) {
+    long total = seconds > 0 ? (long)seconds : 0;
+    long days = total / 86400, hours = total / 3600 % 24, minutes = total / 60 % 60;
+
+    if (days > 0) {
+        snprintf(out, size, "%ld-%02ld:%02ld:%02ld", days, hours, minutes, total % 60);
+    } else if (hours > 0) {
+        snprintf(out, size, "%02ld:%02ld:%02ld", hours, minutes, total % 60);
+    } else {
+        snprintf(out, size, "%02ld:%02ld", minutes, total % 60);
+    }
+}
+
+static int compare_slots(const void *a, const void *b) {
+    return strcmp(jobs[*(const int *)a].command_name, jobs[*(const int *)b].command_name);
+}
+
+static const char *state_name(job_state_t state) {
+    switch (state) {
+        case JOB_RUNNING:
+            return "Running";
+        case JOB_STOPPED:
+            return "Stopped";
+        default:
+            return "Unknown";
+    }
+}
+
+// One table of every job, sorted by command name like activities
+static void print_job_table() {
+    FILE *out = builtin_output();
+    static int order[MAX_JOBS];
+    int count = 0;
+
+    update_job_states();
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (!jobs[i].active) {
+            close_monitor(&monitors[i]);
+            continue;
+        }
+        if (jobs[i].state == JOB_QUEUED) {
+            close_monitor(&monitors[i]);
+        } else if (monitors[i].pid != jobs[i].pid) {
+            open_monitor(&monitors[i], jobs[i].pid);
+        }
+        order[count++] = i;
+    }
+    qsort(order, count, sizeof(int), compare_slots);
+
+    fprintf(out, "%7s %4s %-8s %6s %7s %7s %7s %4s %11s  %s\n",
+            "PID", "JOB", "STATE", "CPU%", "RSS", "READ", "WRITE", "THR", "ELAPSED", "COMMAND");
+    for (int k = 0; k < count; k++) {
+        const job_t *job = &jobs[order[k]];
+        job_sample_t sample;
+        char rss[16], read_bytes[16], write_bytes[16], elapsed[32];
+
+        if (job->state == JOB_QUEUED || !sample_job(&monitors[order[k]], &sample)) {
+            fprintf(out, "%7s %4d %-8s %6s %7s %7s %7s %4s %11s  %s\n", "-", job->job_id,
+                    job->state == JOB_QUEUED ? "Queued" : "Gone",
+                    "-", "-", "-", "-", "-", "-", job->command_name);
+            continue;
+        }
+        format_bytes(sample.rss_bytes, rss, sizeof(rss));
+        format_bytes(sample.read_bytes, read_bytes, sizeof(read_bytes));
+        format_bytes(sample.write_bytes, write_bytes, sizeof(write_bytes));
+        format_elapsed(sample.elapsed, elapsed, sizeof(elapsed));
+        fprintf(out, "%7d %4d %-8s %6.1f %7s %7s %7s %4ld %11s  %s\n", job->pid, job->job_id,
+                state_name(job->state), sample.cpu_percent, rss,
+                sample.has_io ? read_bytes : "-", sample.has_io ? write_bytes : "-",
+                sample.threads, elapsed, job->command_name);
+    }
+}
+
+// activities -v
+int activities_verbose() {
+    print_job_table();
+    return 0;
+}
+
+// activities -w: redraw the table every interval seconds until a line is
+// entered, input ends, Ctrl-C interrupts the wait or the output goes away
+int activities_watch(double interval) {
+    FILE *out = builtin_output();
+    int tty = isatty(fileno(out));
+
+    interrupted = 0;
+
+    for (;;) {
+        if (tty) {
+            fprintf(out, "\033[H\033[2J");
+        }
+        print_job_table();
+        if (tty) {
+            fprintf(out, "\nEvery %.1fs; press Enter or Ctrl-C to stop\n", interval);
+        }
+        fflush(out);
+        if (ferror(out)) {
+            break;
+        }
+
+        // On a pipeline thread (see pipes.c) the signal does not interrupt
+        // poll(), so Ctrl-C is also noticed through the flag
+        struct pollfd input = { builtin_input(), POLLIN, 0 };
+        int ready = poll(&input, 1, (int)(interval * 1000));
+        if (ready != 0 || interrupted) {
+            char discard[256];
+            if (ready > 0 && read(input.fd, discard, sizeof(discard)) < 0) {
+                perror("activities");
+            }
+            break;
+        }
+        if (!tty) {
+            fprintf(out, "\n");
+        }
+    }
+    return 0;
+}
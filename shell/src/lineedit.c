@@ -0,0 +1,746 @@
+#include "lineedit.h"
+#include <poll.h>
+
+// Raw-mode line editor with history browsing and tab completion.
+//
+// The editor remembers what it last drew after the prompt and, on every
+// keystroke, rewrites only the part of the line that changed.  Command
+// completion is served from a sorted in-memory index of the executables on
+// PATH; the index is built on the first Tab and rebuilt only when PATH or
+// the mtime of one of its directories changes.  File completion goes
+// through read_directory(), the same reader reveal uses.
+
+#define LINE_EDIT_MAX 4096
+#define OUTPUT_BUFFER_SIZE (LINE_EDIT_MAX * 2 + 64)
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+#define KEY_IDLE 0x200           // no key within the idle interval
+
+// ---- executable index ----------------------------------------------------
+
+typedef struct {
+    char path[MAX_PATH_LENGTH];
+    time_t mtime_sec;
+    long mtime_nsec;
+} path_dir_t;
+
+static char *indexed_path = NULL;      // PATH value the index was built from
+static path_dir_t path_dirs[MAX_PATH_DIRS];
+static int num_path_dirs = 0;
+
+static char *exec_names = NULL;        // NUL-separated executable names
+static size_t exec_names_used = 0;
+static size_t exec_names_capacity = 0;
+static size_t *exec_offsets = NULL;    // sorted, unique
+static int exec_count = 0;
+static int exec_capacity = 0;
+
+static int compare_exec_names(const void *a, const void *b) {
+    return strcmp(exec_names + *(const size_t *)a, exec_names + *(const size_t *)b);
+}
+
+static const char *exec_name(int i) {
+    return exec_names + exec_offsets[i];
+}
+
+static void stat_path_dir(path_dir_t *dir) {
+    struct stat st;
+    if (stat(dir->path, &st) == 0) {
+        dir->mtime_sec = st.st_mtim.tv_sec;
+        dir->mtime_nsec = st.st_mtim.tv_nsec;
+    } else {
+        dir->mtime_sec = -1;
+        dir->mtime_nsec = 0;
+    }
+}
+
+static int exec_index_is_stale(const char *path_env) {
+    if (indexed_path == NULL || strcmp(indexed_path, path_env) != 0) {
+        return 1;
+    }
+    for (int i = 0; i < num_path_dirs; i++) {
+        path_dir_t now = path_dirs[i];
+        stat_path_dir(&now);
+        if (now.mtime_sec != path_dirs[i].mtime_sec || now.mtime_nsec != path_dirs[i].mtime_nsec) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int add_exec_name(const char *name) {
+    size_t length = strlen(name) + 1;
+
+    if (exec_names_used + length > exec_names_capacity) {
+        size_t new_capacity = exec_names_capacity ? exec_names_capacity * 2 : 64 * 1024;
+        while (new_capacity < exec_names_used + length) new_capacity *= 2;
+        char *grown = realloc(exec_names, new_capacity);
+        if (grown == NULL) return 0;
+        exec_names = grown;
+        exec_names_capacity = new_capacity;
+    }
+    if (exec_count == exec_capacity) {
+        int new_capacity = exec_capacity ? exec_capacity * 2 : 1024;
+        size_t *grown = realloc(exec_offsets, new_capacity * sizeof(size_t));
+        if (grown == NULL) return 0;
+        exec_offsets = grown;
+        exec_capacity = new_capacity;
+    }
+
+    memcpy(exec_names + exec_names_used, name, length);
+    exec_offsets[exec_count++] = exec_names_used;
+    exec_names_used += length;
+    return 1;
+}
+
+static void index_path_dir(path_dir_t *dir) {
+    stat_path_dir(dir);
+
+    DIR *d = opendir(dir->path);
+    if (d == NULL) {
+        return;
+    }
+
+    int fd = dirfd(d);
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        struct stat st;
+        if (entry->d_name[0] == '.' &&
+            (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+            continue;
+        }
+        if (fstatat(fd, entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+            (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
+            if (!add_exec_name(entry->d_name)) break;
+        }
+    }
+    closedir(d);
+}
+
+static void rebuild_exec_index(const char *path_env) {
+    free(indexed_path);
+    indexed_path = strdup(path_env);
+    exec_names_used = 0;
+    exec_count = 0;
+    num_path_dirs = 0;
+
+    const char *start = path_env;
+    while (num_path_dirs < MAX_PATH_DIRS) {
+        const char *end = strchr(start, ':');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        path_dir_t *dir = &path_dirs[num_path_dirs++];
+
+        // An empty PATH element means the current directory
+        if (length == 0) {
+            strcpy(dir->path, ".");
+        } else {
+            snprintf(dir->path, sizeof(dir->path), "%.*s", (int)length, start);
+        }
+        index_path_dir(dir);
+
+        if (end == NULL) break;
+        start = end + 1;
+    }
+
+    qsort(exec_offsets, exec_count, sizeof(size_t), compare_exec_names);
+
+    // The same name in several PATH directories only completes once
+    int unique = 0;
+    for (int i = 0; i < exec_count; i++) {
+        if (unique == 0 || strcmp(exec_name(i), exec_name(unique - 1)) != 0) {
+            exec_offsets[unique++] = exec_offsets[i];
+        }
+    }
+    exec_count = unique;
+}
+
+static int add_candidate(completion_t *out, const char *name, int is_directory) {
+    if (out->count >= MAX_COMPLETIONS) return 0;
+    out->names[out->count] = name;
+    out->is_directory[out->count] = is_directory;
+    out->count++;
+    return 1;
+}
+
+// Builtins and PATH executables starting with prefix
+int complete_command_name(const char *prefix, completion_t *out) {
+    const char *path_env = getenv("PATH");
+    size_t prefix_len = strlen(prefix);
+    int builtin_count;
+
+    out->count = 0;
+    for (const builtin_t *b = builtin_table; b->name != NULL; b++) {
+        if (strncmp(b->name, prefix, prefix_len) == 0) {
+            add_candidate(out, b->name, 0);
+        }
+    }
+    builtin_count = out->count;
+
+    if (path_env == NULL) path_env = "";
+    if (exec_index_is_stale(path_env)) {
+        rebuild_exec_index(path_env);
+    }
+
+    // Lower bound of prefix in the sorted index
+    int lo = 0, hi = exec_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(exec_name(mid), prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (int i = lo; i < exec_count && strncmp(exec_name(i), prefix, prefix_len) == 0; i++) {
+        int duplicate = 0;
+        for (int j = 0; j < builtin_count; j++) {
+            if (strcmp(out->names[j], exec_name(i)) == 0) duplicate = 1;
+        }
+        if (!duplicate && !add_candidate(out, exec_name(i), 0)) break;
+    }
+    return out->count;
+}
+
+// Entries of the word's directory starting with the word's last component
+int complete_file_name(const char *word, completion_t *out) {
+    char dir_path[MAX_PATH_LENGTH];
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+
+    out->count = 0;
+    if (slash == NULL) {
+        strcpy(dir_path, ".");
+    } else if (slash == word) {
+        strcpy(dir_path, "/");
+    } else if (word[0] == '~' && (word[1] == '/' || word + 1 == slash)) {
+        char home[MAX_PATH_LENGTH];
+        resolve_path("~", home);
+        if (snprintf(dir_path, sizeof(dir_path), "%s%.*s", home,
+                     (int)(slash - word - 1), word + 1) >= (int)sizeof(dir_path)) {
+            return 0;
+        }
+    } else {
+        snprintf(dir_path, sizeof(dir_path), "%.*s", (int)(slash - word), word);
+    }
+
+    int count = read_directory(dir_path, base[0] == '.', base, out->entries, MAX_ENTRIES);
+    if (count <= 0) {
+        return 0;
+    }
+    qsort(out->entries, count, sizeof(dir_entry_t), compare_entries);
+
+    for (int i = 0; i < count; i++) {
+        // "." and ".." only when asked for explicitly
+        if (strcmp(out->entries[i].name, ".") == 0 || strcmp(out->entries[i].name, "..") == 0) {
+            if (strcmp(base, out->entries[i].name) != 0) continue;
+        }
+        if (!add_candidate(out, out->entries[i].name, out->entries[i].is_directory)) break;
+    }
+    return out->count;
+}
+
+// ---- terminal output -----------------------------------------------------
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static int output_used = 0;
+
+static void output_flush() {
+    int written = 0;
+    while (written < output_used) {
+        ssize_t n = write(STDOUT_FILENO, output_buffer + written, output_used - written);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    output_used = 0;
+}
+
+static void output_bytes(const char *s, int length) {
+    while (length > 0) {
+        if (output_used == OUTPUT_BUFFER_SIZE) output_flush();
+        int chunk = OUTPUT_BUFFER_SIZE - output_used;
+        if (chunk > length) chunk = length;
+        memcpy(output_buffer + output_used, s, chunk);
+        output_used += chunk;
+        s += chunk;
+        length -= chunk;
+    }
+}
+
+static void output_string(const char *s) {
+    output_bytes(s, strlen(s));
+}
+
+// Continuation prompt while reading here-document lines, NULL for the
+// normal shell prompt
+static const char *continuation_prompt = NULL;
+
+static void show_prompt() {
+    if (continuation_prompt != NULL) {
+        output_string(continuation_prompt);
+        output_flush();
+    } else {
+        print_prompt();
+    }
+}
+
+static void output_cursor_move(int from, int to) {
+    char seq[32];
+    if (to < from) {
+        snprintf(seq, sizeof(seq), "\x1b[%dD", from - to);
+        output_string(seq);
+    } else if (to > from) {
+        snprintf(seq, sizeof(seq), "\x1b[%dC", to - from);
+        output_string(seq);
+    }
+}
+
+// ---- editor --------------------------------------------------------------
+
+typedef struct {
+    char buf[LINE_EDIT_MAX];
+    int len;
+    int pos;
+    int max_len;
+    char rendered[LINE_EDIT_MAX];  // what is on screen after the prompt
+    int rendered_len;
+    int screen_pos;                // terminal cursor, as an offset into the line
+    int history_index;
+    char saved[LINE_EDIT_MAX];     // line being edited before browsing history
+} line_state_t;
+
+static line_state_t state;
+static completion_t completions;
+
+// Bring the screen in line with the buffer, touching only what changed
+static void refresh_line(line_state_t *ls) {
+    int first_diff = 0;
+    while (first_diff < ls->rendered_len && first_diff < ls->len &&
+           ls->rendered[first_diff] == ls->buf[first_diff]) {
+        first_diff++;
+    }
+
+    if (first_diff < ls->rendered_len || first_diff < ls->len) {
+        output_cursor_move(ls->screen_pos, first_diff);
+        output_bytes(ls->buf + first_diff, ls->len - first_diff);
+        ls->screen_pos = ls->len;
+        if (ls->len < ls->rendered_len) {
+            output_string("\x1b[K");
+        }
+        memcpy(ls->rendered + first_diff, ls->buf + first_diff, ls->len - first_diff);
+        ls->rendered_len = ls->len;
+    }
+
+    output_cursor_move(ls->screen_pos, ls->pos);
+    ls->screen_pos = ls->pos;
+    output_flush();
+}
+
+// The prompt has just been printed again: nothing of the line is on screen
+static void forget_rendered(line_state_t *ls) {
+    ls->rendered_len = 0;
+    ls->screen_pos = 0;
+}
+
+static void insert_text(line_state_t *ls, const char *text, int length) {
+    if (ls->len + length > ls->max_len) {
+        length = ls->max_len - ls->len;
+    }
+    if (length <= 0) return;
+    memmove(ls->buf + ls->pos + length, ls->buf + ls->pos, ls->len - ls->pos);
+    memcpy(ls->buf + ls->pos, text, length);
+    ls->len += length;
+    ls->pos += length;
+}
+
+static void delete_range(line_state_t *ls, int from, int to) {
+    if (from >= to) return;
+    memmove(ls->buf + from, ls->buf + to, ls->len - to);
+    ls->len -= to - from;
+    if (ls->pos > to) ls->pos -= to - from;
+    else if (ls->pos > from) ls->pos = from;
+}
+
+static void set_line(line_state_t *ls, const char *text) {
+    int length = strlen(text);
+    if (length > ls->max_len) length = ls->max_len;
+    memcpy(ls->buf, text, length);
+    ls->len = length;
+    ls->pos = length;
+}
+
+static void history_step(line_state_t *ls, int direction) {
+    int count = history_count();
+    int target = ls->history_index + direction;
+
+    if (ls->history_index > count) ls->history_index = count;
+    if (target < 0 || target > count) return;
+
+    if (ls->history_index == count) {
+        memcpy(ls->saved, ls->buf, ls->len);
+        ls->saved[ls->len] = '\0';
+    }
+    ls->history_index = target;
+    set_line(ls, target == count ? ls->saved : history_get(target));
+}
+
+static int is_word_break(char c) {
+    return isspace((unsigned char)c) || c == '|' || c == ';' || c == '&' || c == '<' || c == '>';
+}
+
+static void list_completions(line_state_t *ls, const completion_t *c) {
+    output_string("\n");
+    for (int i = 0; i < c->count; i++) {
+        output_string(c->names[i]);
+        if (c->is_directory[i]) output_string("/");
+        output_string(i < c->count - 1 ? "  " : "\n");
+    }
+    output_flush();
+    show_prompt();
+    forget_rendered(ls);
+}
+
+static void complete_word(line_state_t *ls) {
+    char word[LINE_EDIT_MAX];
+    int start = ls->pos;
+
+    while (start > 0 && !is_word_break(ls->buf[start - 1])) start--;
+    memcpy(word, ls->buf + start, ls->pos - start);
+    word[ls->pos - start] = '\0';
+
+    // First word of a command, unless it is a path
+    int before = start;
+    while (before > 0 && isspace((unsigned char)ls->buf[before - 1])) before--;
+    int command_position = (before == 0 || ls->buf[before - 1] == '|' ||
+                            ls->buf[before - 1] == ';' || ls->buf[before - 1] == '&');
+
+    const char *stem = word;
+    if (command_position && strchr(word, '/') == NULL) {
+        complete_command_name(word, &completions);
+    } else {
+        complete_file_name(word, &completions);
+        const char *slash = strrchr(word, '/');
+        if (slash) stem = slash + 1;
+    }
+
+    if (completions.count == 0) {
+        output_string("\a");
+        output_flush();
+        return;
+    }
+
+    // Longest common prefix of all candidates
+    int stem_len = strlen(stem);
+    int common = strlen(completions.names[0]);
+    for (int i = 1; i < completions.count; i++) {
+        int j = 0;
+        while (j < common && completions.names[i][j] == completions.names[0][j]) j++;
+        common = j;
+    }
+
+    if (common > stem_len) {
+        insert_text(ls, completions.names[0] + stem_len, common - stem_len);
+    }
+    if (completions.count == 1) {
+        insert_text(ls, completions.is_directory[0] ? "/" : " ", 1);
+    } else if (common <= stem_len) {
+        list_completions(ls, &completions);
+    }
+}
+
+// Work to do while waiting for a key (see set_idle_handler())
+static int idle_interval_ms = -1;
+static int (*idle_due)() = NULL;
+static void (*idle_run)() = NULL;
+static struct termios original_termios, raw_termios;
+
+// Have run() called between keystrokes, whenever due() says so, checking
+// every interval_ms.  The line being edited is cleared first and drawn
+// again after run() returns.
+void set_idle_handler(int interval_ms, int (*due)(), void (*run)()) {
+    idle_interval_ms = interval_ms;
+    idle_due = due;
+    idle_run = run;
+}
+
+// Read one key, folding escape sequences into the control key they mean
+static int read_key() {
+    unsigned char c;
+    ssize_t n;
+
+    if (idle_run != NULL) {
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+        int ready;
+        while ((ready = poll(&input, 1, idle_interval_ms)) == -1 && errno == EINTR) {
+        }
+        if (ready == 0) return KEY_IDLE;
+    }
+    while ((n = read(STDIN_FILENO, &c, 1)) == -1 && errno == EINTR) {
+    }
+    if (n <= 0) return -1;
+    if (c != KEY_ESC) return c;
+
+    unsigned char seq[3];
+    if (read(STDIN_FILENO, &seq[0], 1) != 1 || read(STDIN_FILENO, &seq[1], 1) != 1) {
+        return 0;
+    }
+    if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+        if (read(STDIN_FILENO, &seq[2], 1) != 1) return 0;
+        if (seq[2] == '~') {
+            switch (seq[1]) {
+                case '1': case '7': return KEY_CTRL('A');
+                case '4': case '8': return KEY_CTRL('E');
+                case '3': return KEY_CTRL('D') | 0x100;  // delete, never EOF
+            }
+        }
+        return 0;
+    }
+    if (seq[0] == '[' || seq[0] == 'O') {
+        switch (seq[1]) {
+            case 'A': return KEY_CTRL('P');
+            case 'B': return KEY_CTRL('N');
+            case 'C': return KEY_CTRL('F');
+            case 'D': return KEY_CTRL('B');
+            case 'H': return KEY_CTRL('A');
+            case 'F': return KEY_CTRL('E');
+        }
+    }
+    return 0;
+}
+
+// Returns 1 when a line was read, 0 on EOF
+static int edit_line(line_state_t *ls) {
+    for (;;) {
+        int key = read_key();
+
+        switch (key) {
+            case -1:
+                return ls->len > 0 ? 1 : 0;
+            case '\r':
+            case '\n':
+                ls->pos = ls->len;
+                refresh_line(ls);
+                output_string("\n");
+                output_flush();
+                return 1;
+            case KEY_CTRL('C'):
+                output_string("^C\n");
+                output_flush();
+                ls->len = ls->pos = 0;
+                ls->history_index = history_count();
+                show_prompt();
+                forget_rendered(ls);
+                break;
+            case KEY_CTRL('D'):
+                if (ls->len == 0) {
+                    output_string("\n");
+                    output_flush();
+                    return 0;
+                }
+                delete_range(ls, ls->pos, ls->pos < ls->len ? ls->pos + 1 : ls->pos);
+                break;
+            case KEY_CTRL('D') | 0x100:
+                delete_range(ls, ls->pos, ls->pos < ls->len ? ls->pos + 1 : ls->pos);
+                break;
+            case KEY_BACKSPACE:
+            case KEY_CTRL('H'):
+                if (ls->pos > 0) delete_range(ls, ls->pos - 1, ls->pos);
+                break;
+            case KEY_CTRL('A'):
+                ls->pos = 0;
+                break;
+            case KEY_CTRL('E'):
+                ls->pos = ls->len;
+                break;
+            case KEY_CTRL('B'):
+                if (ls->pos > 0) ls->pos--;
+                break;
+            case KEY_CTRL('F'):
+                if (ls->pos < ls->len) ls->pos++;
+                break;
+            case KEY_CTRL('K'):
+                delete_range(ls, ls->pos, ls->len);
+                break;
+            case KEY_CTRL('U'):
+                delete_range(ls, 0, ls->pos);
+                break;
+            case KEY_CTRL('W'): {
+                int start = ls->pos;
+                while (start > 0 && isspace((unsigned char)ls->buf[start - 1])) start--;
+                while (start > 0 && !isspace((unsigned char)ls->buf[start - 1])) start--;
+                delete_range(ls, start, ls->pos);
+                break;
+            }
+            case KEY_IDLE:
+                if (!idle_due()) {
+                    continue;
+                }
+                output_string("\r\x1b[K");
+                output_flush();
+                tcsetattr(STDIN_FILENO, TCSADRAIN, &original_termios);
+                idle_run();
+                fflush(stdout);
+                tcsetattr(STDIN_FILENO, TCSADRAIN, &raw_termios);
+                show_prompt();
+                forget_rendered(ls);
+                break;
+            case KEY_CTRL('L'):
+                output_string("\x1b[H\x1b[2J");
+                output_flush();
+                show_prompt();
+                forget_rendered(ls);
+                break;
+            case KEY_CTRL('P'):
+                history_step(ls, -1);
+                break;
+            case KEY_CTRL('N'):
+                history_step(ls, 1);
+                break;
+            case '\t':
+                complete_word(ls);
+                break;
+            default:
+                if (key >= 32 && key < KEY_BACKSPACE) {
+                    char c = (char)key;
+                    insert_text(ls, &c, 1);
+                }
+                break;
+        }
+        refresh_line(ls);
+    }
+}
+
+// A script lines are read from instead of stdin (see set_line_input()),
+// and what has been read from it but not returned yet.  The script is read
+// with read() rather than stdio, as exit() in a forked child would seek a
+// stdio stream's shared descriptor back to where the stream stood.
+static int line_input = -1;
+static char input_buffer[LINE_INPUT_BUFFER];
+static size_t input_start = 0;
+static size_t input_end = 0;
+
+// Read lines, including here-document and block continuation lines, from
+// descriptor fd instead of stdin (-1 for stdin again)
+void set_line_input(int fd) {
+    line_input = fd;
+    input_start = input_end = 0;
+}
+
+// fgets() on line_input: up to size - 1 bytes, through the newline
+static int read_input_line(char *buffer, int size) {
+    int used = 0;
+
+    while (used < size - 1) {
+        if (input_start == input_end) {
+            ssize_t n = read(line_input, input_buffer, sizeof(input_buffer));
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) break;
+            input_start = 0;
+            input_end = n;
+        }
+        size_t length = input_end - input_start;
+        if (length > (size_t)(size - 1 - used)) {
+            length = size - 1 - used;
+        }
+        char *newline = memchr(input_buffer + input_start, '\n', length);
+        if (newline != NULL) {
+            length = newline - (input_buffer + input_start) + 1;
+        }
+        memcpy(buffer + used, input_buffer + input_start, length);
+        used += length;
+        input_start += length;
+        if (newline != NULL) break;
+    }
+    buffer[used] = '\0';
+    return used > 0;
+}
+
+// fgets() on the script or on stdin
+static int read_chunk(char *buffer, int size) {
+    return line_input != -1 ? read_input_line(buffer, size) : fgets(buffer, size, stdin) != NULL;
+}
+
+// A line that does not fit in buffer is skipped through its newline, with
+// a message, rather than returned in pieces that would each run as a
+// command of their own
+static int read_plain_line(char *buffer, int size) {
+    char rest[256];
+
+    for (;;) {
+        if (!read_chunk(buffer, size)) {
+            return 0;
+        }
+        size_t length = strcspn(buffer, "\n");
+        if (buffer[length] == '\n' || length < (size_t)size - 1) {
+            buffer[length] = '\0';
+            return 1;
+        }
+        if (!read_chunk(rest, sizeof(rest)) || rest[0] == '\n') {
+            buffer[length] = '\0';
+            return 1;  // It just fits
+        }
+        fprintf(parser_errors(), "Line longer than %d bytes skipped\n", size - 1);
+        while (rest[strcspn(rest, "\n")] != '\n' && read_chunk(rest, sizeof(rest))) {
+        }
+    }
+}
+
+// Read a line of input into buffer (without the newline).  Uses the line
+// editor on a terminal and plain fgets() otherwise.
+// Returns 1 when a line was read, 0 on EOF.
+int read_line(char *buffer, int size) {
+    struct termios original, raw;
+
+    if (line_input != -1) {
+        return read_plain_line(buffer, size);
+    }
+    const char *term = getenv("TERM");
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) ||
+        (term != NULL && strcmp(term, "dumb") == 0) ||
+        tcgetattr(STDIN_FILENO, &original) == -1) {
+        return read_plain_line(buffer, size);
+    }
+
+    raw = original;
+    raw.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) {
+        return read_plain_line(buffer, size);
+    }
+    original_termios = original;
+    raw_termios = raw;
+
+    state.len = 0;
+    state.pos = 0;
+    state.max_len = (size - 1 < LINE_EDIT_MAX - 1) ? size - 1 : LINE_EDIT_MAX - 1;
+    state.history_index = history_count();
+    forget_rendered(&state);
+
+    int result = edit_line(&state);
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &original);
+
+    if (result <= 0) {
+        return 0;
+    }
+    memcpy(buffer, state.buf, state.len);
+    buffer[state.len] = '\0';
+    return 1;
+}
+
+// Read one more line of a multi-line construct behind a "> " prompt
+int read_continuation_line(char *buffer, int size) {
+    int interactive = line_input == -1 && isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+
+    if (interactive) {
+        continuation_prompt = "> ";
+        show_prompt();
+    }
+    int result = read_line(buffer, size);
+    continuation_prompt = NULL;
+    return result;
+}
@@ -3,20 +3,78 @@
 #include "functs.h"
 #include "pipes.h"
 #include "jobs.h"
+#include "history.h"
+#include "lineedit.h"
+#include "zygote.h"
+#include "admission.h"
+#include "control.h"
+#include "server.h"
+#include "script.h"
+#include <poll.h>
 
-int main()
+// shell.out -c "command line": run the line and exit with its status.
+// Only the setup a single line can use is done (no history, zygote or
+// prompt), and a final external command is exec'd in place of the shell.
+static int run_command_string(char *line)
 {
+    init_home();
+    init_shell_directories();
+    init_job_system();
+
+    int status = execute_final_command_line(line);
+
+    // Queued background jobs are still started before the shell goes away
+    while (admission_waiting()) {
+        poll(NULL, 0, ADMISSION_CHECK_MS);
+        run_admission();
+    }
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            printf("Usage: %s -c command\n", argv[0]);
+            return 1;
+        }
+        return run_command_string(argv[2]);
+    }
+    if (argc > 1 && strcmp(argv[1], "--server") == 0) {
+        if (argc < 3) {
+            printf("Usage: %s --server socket_path\n", argv[0]);
+            return 1;
+        }
+        start_zygote(); // Before anything large is allocated
+        init_home();
+        init_shell_directories();
+        init_job_system();
+        return run_server(argv[2]);
+    }
+    if (argc > 1 && argv[1][0] != '-') {
+        // shell.out FILE: run a script
+        start_zygote(); // Before anything large is allocated
+        init_home();
+        init_shell_directories();
+        init_job_system();
+        return run_script(argv[1]);
+    }
+
+    start_zygote(); // Before anything large is allocated
     init_home();
     init_shell_directories(); // Add this - it's required for hop and reveal commands
     init_job_system(); // Initialize job management system
+    init_history(); // Open the shared history file
+    set_idle_handler(ADMISSION_CHECK_MS, admission_due, run_admission); // Queued jobs start at the prompt
 
     while(1)
     {
         check_background_jobs(); // Check and update background jobs
+        run_admission(); // Start a queued background job if there is room
         print_prompt();
         // printf("hello, welcome\n");
-        char input[1024];
-        if(!fgets(input, sizeof(input), stdin)) {
+        char input[MAX_INPUT_LENGTH];
+        if(!read_line(input, sizeof(input))) {
             // EOF detected (Ctrl-D)
             printf("logout\n");
             kill_all_children();
@@ -28,11 +86,17 @@ int main()
         if (strlen(input) == 0) {
             continue;
         }
-        
-        // checking for valid input
-        if (!parse_input(input)) {
-            printf("INVALID SYNTAX\n");
-            continue;
+        char *line = input;
+        if (control_block_open(input)) {
+            // if/while/until/for/case: read on to the fi, done or esac
+            line = control_read_block(input);
+            if (line == NULL) {
+                history_add(input);
+                continue;
+            }
+            history_add(control_history_line(line));
+        } else {
+            history_add(input);
         }
         
     //     // if valid, we are proceeding with rest of the code 
@@ -72,7 +136,7 @@ int main()
              kill_all_children();
             break; // Exit the shell
         }
-        execute_command_line(input);
+        execute_command_line(line);
     }
 
     return 0;
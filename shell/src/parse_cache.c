@@ -0,0 +1,276 @@
+#include "parse_cache.h"
+#include "functs.h"
+#include <pthread.h>
+
+// Cache of parsed command lines, keyed by a hash of the line text.
+//
+// A hit skips parse_input(), tokenize() and the parse itself.  Lines whose
+// parse had side effects or depended on changing state (parse_cacheable
+// cleared) are parsed every time.  Entries are evicted least recently used
+// first, skipping any that are still pinned by a running execution.
+//
+// A script's lines are parsed ahead on a thread of their own (script.c),
+// so the cache is shared under cache_lock.  Parsing itself happens outside
+// the lock; the fork handlers keep a child from inheriting it held.
+
+static parse_cache_entry_t *buckets[PARSE_CACHE_BUCKETS];
+static parse_cache_entry_t *lru_head = NULL;   // most recently used
+static parse_cache_entry_t *lru_tail = NULL;
+static parse_cache_entry_t *spare = NULL;      // evicted entry kept for reuse
+static int entry_count = 0;
+
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+static unsigned long cache_evictions = 0;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t fork_handlers = PTHREAD_ONCE_INIT;
+
+static unsigned long long hash_line(const char *s, size_t *length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    const char *p = s;
+    while (*p) {
+        hash ^= (unsigned char)*p++;
+        hash *= 1099511628211ULL;
+    }
+    *length = p - s;
+    return hash;
+}
+
+static void lru_unlink(parse_cache_entry_t *entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(parse_cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (lru_tail == NULL) lru_tail = entry;
+}
+
+static void destroy_entry(parse_cache_entry_t *entry) {
+    if (spare == NULL) {
+        spare = entry;  // keep one around so a full cache recycles its arena
+        return;
+    }
+    arena_free(&entry->arena);
+    free(entry);
+}
+
+// Take entry out of the cache; it is destroyed once nobody holds it
+static void remove_entry(parse_cache_entry_t *entry) {
+    parse_cache_entry_t **link = &buckets[entry->hash & (PARSE_CACHE_BUCKETS - 1)];
+    while (*link != entry) link = &(*link)->bucket_next;
+    *link = entry->bucket_next;
+    lru_unlink(entry);
+    entry->cached = 0;
+    entry_count--;
+    if (entry->pins == 0) {
+        destroy_entry(entry);
+    }
+}
+
+static parse_cache_entry_t *find_entry(const char *line, unsigned long long hash, size_t length) {
+    parse_cache_entry_t *entry = buckets[hash & (PARSE_CACHE_BUCKETS - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, line, length) == 0) {
+            return entry;
+        }
+        entry = entry->bucket_next;
+    }
+    return NULL;
+}
+
+static int insert_entry(parse_cache_entry_t *entry) {
+    if (entry_count >= PARSE_CACHE_CAPACITY) {
+        parse_cache_entry_t *victim = lru_tail;
+        while (victim != NULL && victim->pins > 0) victim = victim->lru_prev;
+        if (victim == NULL) {
+            return 0;
+        }
+        remove_entry(victim);
+        cache_evictions++;
+    }
+
+    parse_cache_entry_t **bucket = &buckets[entry->hash & (PARSE_CACHE_BUCKETS - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    lru_push_front(entry);
+    entry->cached = 1;
+    entry_count++;
+    return 1;
+}
+
+static parse_cache_entry_t *new_entry() {
+    parse_cache_entry_t *entry = spare;
+    if (entry != NULL) {
+        spare = NULL;
+        arena_reset(&entry->arena);
+    } else {
+        entry = malloc(sizeof(parse_cache_entry_t));
+        if (entry == NULL) {
+            return NULL;
+        }
+        arena_init(&entry->arena);
+    }
+    entry->pins = 0;
+    entry->cached = 0;
+    entry->bucket_next = entry->lru_prev = entry->lru_next = NULL;
+    init_command_sequence(&entry->sequence);
+    return entry;
+}
+
+// Validate, tokenize and parse line into entry's arena
+static int parse_into_entry(parse_cache_entry_t *entry, const char *line, size_t length) {
+    token_t tokens[MAX_TOKENS];
+    int ok;
+
+    if (!parse_input(line)) {
+        fprintf(parser_output(), "INVALID SYNTAX\n");
+        return 0;
+    }
+
+    // The token values go into the entry's arena with the parse
+    arena_t *previous = parser_set_arena(&entry->arena);
+    int token_count = tokenize(line, tokens);
+    if (token_count < 0) {
+        parser_set_arena(previous);
+        return 0;
+    }
+    entry->is_sequence = 0;
+    for (int i = 0; i < token_count; i++) {
+        if (tokens[i].type == TOKEN_SEMICOLON ||
+            (tokens[i].type == TOKEN_BACKGROUND && tokens[i + 1].type != TOKEN_EOF)) {
+            entry->is_sequence = 1;
+            break;
+        }
+    }
+
+    parse_cacheable = 1;
+    entry->text = parser_alloc(length + 1);
+    memcpy(entry->text, line, length + 1);
+
+    if (entry->is_sequence) {
+        ok = parse_command_sequence(tokens, &entry->sequence);
+        if (!ok) fprintf(parser_output(), "Parse error in command sequence\n");
+    } else {
+        entry->sequence.pipelines = parser_alloc(sizeof(pipeline_t));
+        entry->sequence.num_pipelines = 1;
+        ok = parse_pipeline(tokens, &entry->sequence.pipelines[0]);
+        if (!ok) fprintf(parser_output(), "Parse error\n");
+    }
+    parser_set_arena(previous);
+    return ok;
+}
+
+static void lock_cache() {
+    pthread_mutex_lock(&cache_lock);
+}
+
+static void unlock_cache() {
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void register_fork_handlers() {
+    pthread_atfork(lock_cache, unlock_cache, unlock_cache);
+}
+
+// Parsed form of line, from the cache when possible.  The entry is pinned
+// until parse_cache_release().  Returns NULL if the line does not parse;
+// the reason has already been printed (see parser_output()).
+parse_cache_entry_t *parse_cache_acquire(const char *line) {
+    size_t length;
+    unsigned long long hash = hash_line(line, &length);
+
+    pthread_once(&fork_handlers, register_fork_handlers);
+    lock_cache();
+    parse_cache_entry_t *entry = find_entry(line, hash, length);
+    if (entry != NULL) {
+        cache_hits++;
+        lru_unlink(entry);
+        lru_push_front(entry);
+        entry->pins++;
+        unlock_cache();
+        return entry;
+    }
+
+    cache_misses++;
+    entry = new_entry();
+    if (entry == NULL) {
+        unlock_cache();
+        perror("parse cache");
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->length = length;
+    unlock_cache();
+
+    int ok = parse_into_entry(entry, line, length);
+
+    lock_cache();
+    if (!ok) {
+        destroy_entry(entry);
+        unlock_cache();
+        return NULL;
+    }
+    // Unless another thread has just added the same line
+    if (parse_cacheable && find_entry(line, hash, length) == NULL) {
+        insert_entry(entry);
+    }
+    entry->pins++;
+    unlock_cache();
+    return entry;
+}
+
+void parse_cache_release(parse_cache_entry_t *entry) {
+    if (entry == NULL) return;
+    lock_cache();
+    entry->pins--;
+    if (entry->pins == 0 && !entry->cached) {
+        destroy_entry(entry);
+    }
+    unlock_cache();
+}
+
+void parse_cache_clear() {
+    lock_cache();
+    for (int i = 0; i < PARSE_CACHE_BUCKETS; i++) {
+        while (buckets[i] != NULL) {
+            remove_entry(buckets[i]);
+        }
+    }
+    unlock_cache();
+}
+
+int parsecache_command(int argc, char *argv[]) {
+    FILE *out = builtin_output();
+    if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+        parse_cache_clear();
+        lock_cache();
+        cache_hits = cache_misses = cache_evictions = 0;
+        unlock_cache();
+        return 0;
+    }
+    if (argc != 1) {
+        fprintf(out, "Usage: parsecache [-c]\n");
+        return 1;
+    }
+
+    lock_cache();
+    unsigned long hits = cache_hits, misses = cache_misses, evictions = cache_evictions;
+    int entries = entry_count;
+    unlock_cache();
+
+    unsigned long lookups = hits + misses;
+    fprintf(out, "hits: %lu\n", hits);
+    fprintf(out, "misses: %lu\n", misses);
+    fprintf(out, "hit rate: %.1f%%\n", lookups ? 100.0 * hits / lookups : 0.0);
+    fprintf(out, "entries: %d/%d\n", entries, PARSE_CACHE_CAPACITY);
+    fprintf(out, "evictions: %lu\n", evictions);
+    return 0;
+}
@@ -1,18 +1,108 @@
 #include "parser.h"
+#include "wildcard.h"
+#include "heredoc.h"
+#include "cmdsubst.h"
+#include "scan.h"
+
+// Parse results are carved out of the current parse arena.  Unless a caller
+// installs its own (the parse cache does, to keep results around), the
+// scratch arena is used and recycled once per command line.  This state is
+// per thread, so a script's lines can be parsed ahead (script.c) while the
+// shell runs the current one.
+static __thread arena_t scratch_arena;
+static __thread arena_t *parse_arena = NULL;   // NULL: the scratch arena
+__thread int parse_cacheable = 1;
+static __thread int defer_wildcards = 0;
+
+// Where messages about the line being parsed go, when the thread collects
+// them instead of printing them (see parser_collect_messages())
+static __thread FILE *collected_output = NULL;
+static __thread FILE *collected_errors = NULL;
+
+// Install arena for subsequent parses (NULL selects the scratch arena).
+// Returns the previously installed arena.
+arena_t *parser_set_arena(arena_t *arena) {
+    arena_t *previous = parse_arena;
+    parse_arena = arena;
+    return previous;
+}
+
+void *parser_alloc(size_t size) {
+    void *p = arena_alloc(parse_arena ? parse_arena : &scratch_arena, size);
+    if (p == NULL) {
+        fprintf(stderr, "parser: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+char *parser_strdup(const char *s) {
+    size_t length = strlen(s);
+    char *copy = parser_alloc(length + 1);
+    memcpy(copy, s, length + 1);
+    return copy;
+}
+
+// With on set, unquoted wildcards are kept as typed and expanded when the
+// command runs, like substitutions (for parse results that are run more
+// than once, such as block bodies).  Returns the previous setting.
+int parser_defer_wildcards(int on) {
+    int previous = defer_wildcards;
+    defer_wildcards = on;
+    return previous;
+}
+
+// Send what reading and parsing lines on this thread would print to stdout
+// and stderr into output and errors instead (NULL, NULL to print again), so
+// it can be printed when the line runs
+void parser_collect_messages(FILE *output, FILE *errors) {
+    collected_output = output;
+    collected_errors = errors;
+}
+
+// Streams for messages about the line being read or parsed
+FILE *parser_output() {
+    return collected_output ? collected_output : stdout;
+}
+
+FILE *parser_errors() {
+    return collected_errors ? collected_errors : stderr;
+}
+
+// Drop everything parsed into the scratch arena
+void parser_reset_scratch() {
+    arena_reset(&scratch_arena);
+}
+
 // LLM CODE BEGINS
 void init_pipeline(pipeline_t *pipeline) {
+    pipeline->commands = NULL;
     pipeline->num_commands = 0;
+    pipeline->branches = NULL;
+    pipeline->num_branches = 0;
     pipeline->background = 0;
-    for (int i = 0; i < MAX_PIPELINE_COMMANDS; i++) {
-        init_command(&pipeline->commands[i]);
-    }
 }
 
 // Initialize a command sequence structure
 void init_command_sequence(command_sequence_t *sequence) {
+    sequence->pipelines = NULL;
     sequence->num_pipelines = 0;
-    for (int i = 0; i < MAX_SEQUENCE_PIPELINES; i++) {
-        init_pipeline(&sequence->pipelines[i]);
+}
+
+// Number of commands the pipeline starting at token_index will hold
+static int count_pipeline_commands(token_t tokens[], int token_index) {
+    int count = 1;
+    while (tokens[token_index].type != TOKEN_EOF && tokens[token_index].type != TOKEN_SEMICOLON) {
+        if (tokens[token_index].type == TOKEN_PIPE) count++;
+        token_index++;
+    }
+    return count < MAX_PIPELINE_COMMANDS ? count : MAX_PIPELINE_COMMANDS;
+}
+
+static void alloc_pipeline_commands(pipeline_t *pipeline, int count) {
+    pipeline->commands = parser_alloc(count * sizeof(command_t));
+    for (int i = 0; i < count; i++) {
+        init_command(&pipeline->commands[i]);
     }
 }
 
@@ -23,21 +113,85 @@ static const char* skip_ws(const char *s) {
     return s;
 }
 
+// Skip a <(...) or >(...) starting at the '(' and return what follows
+// the matching ')', or NULL if it is not closed
+static const char *skip_process_sub(const char *s) {
+    int depth = 0;
+    do {
+        if (*s == '(') depth++;
+        else if (*s == ')') depth--;
+        else if (*s == '\0') return NULL;
+        s++;
+    } while (depth > 0);
+    return s;
+}
+
 // check if a word is NAME
 static int is_name_char(char c) {
     return (c && !isspace((unsigned char)c) && c!='|' && c!='&' && c!=';' && c!='<' && c!='>');
 }
 
+// Skip a NAME ending at or before end, including any $(...) or `...` in
+// it, which may contain spaces and operators.  Returns NULL if a
+// substitution is not closed.
+static const char *skip_name(const char *s, const char *end) {
+    while (is_name_char(*s)) {
+        s += scan_word(s, end - s);
+        if (!is_name_char(*s)) {
+            break;
+        } else if (*s == '$' && s[1] == '(') {
+            s = skip_process_sub(s + 1);
+            if (s == NULL) return NULL;
+        } else if (*s == '`') {
+            s = strchr(s + 1, '`');
+            if (s == NULL) return NULL;
+            s++;
+        } else {
+            s++;
+        }
+    }
+    return s;
+}
+
+// Skip the target of a redirection operator: a NAME or, where allowed, a
+// <(...) or >(...).  Returns NULL if there is none or it is not closed.
+static const char *skip_target(const char *s, const char *end, int process_sub) {
+    s = skip_ws(s);
+    if (process_sub && (*s == '<' || *s == '>') && s[1] == '(') {
+        return skip_process_sub(s + 1);
+    }
+    if (!is_name_char(*s)) return NULL;
+    return skip_name(s, end);
+}
+
 // --- main parser
 int parse_input(const char *input) {
     const char *s = input;
+    const char *end = input + strlen(input);
     int expect_name = 1;   // after pipe/semicolon/input/output we need a NAME
     int last_was_op = 0;
 
     s = skip_ws(s);
 
     while (*s) {
-        if (*s == '|') {
+        if (*s == '|' && s[1] == '+') {
+            // |+ takes one or more (command) consumers and ends the pipeline
+            int branches = 0;
+            if (expect_name) return 0;
+            s = skip_ws(s + 2);
+            while (*s == '(') {
+                if (*skip_ws(s + 1) == ')') return 0;  // empty consumer
+                s = skip_process_sub(s);
+                if (s == NULL) return 0;
+                s = skip_ws(s);
+                branches++;
+            }
+            if (branches == 0 || (*s && *s != ';' && *s != '&')) return 0;
+            expect_name = 0;
+            last_was_op = 0;
+            continue;
+        }
+        else if (*s == '|') {
             if (expect_name) return 0;  // invalid: operator without name before
             expect_name = 1;
             last_was_op = 1;
@@ -49,6 +203,15 @@ int parse_input(const char *input) {
             last_was_op = 1;
             s++;
         }
+        else if (*s == '&' && s[1] == '>') {
+            // &> and &>> redirect stdout and stderr
+            s += 2;
+            if (*s == '>') s++;
+            s = skip_target(s, end, 1);
+            if (s == NULL) return 0;
+            expect_name = 0;
+            last_was_op = 0;
+        }
         else if (*s == '&') {
             // & can be end OR separator
             if (expect_name) return 0;
@@ -56,25 +219,43 @@ int parse_input(const char *input) {
             last_was_op = 1;
             s++;
         }
+        else if ((*s == '<' || *s == '>') && s[1] == '(') {
+            s = skip_process_sub(s + 1);
+            if (s == NULL) return 0;
+            expect_name = 0;
+            last_was_op = 0;
+        }
         else if (*s == '<') {
+            int file = 1;    // < and <> may take a process substitution
             s++;
-            s = skip_ws(s);
-            if (!is_name_char(*s)) return 0;
-            while (is_name_char(*s)) s++;
+            if (*s == '>' || *s == '&') {
+                file = *s == '>';
+                s++;             // handle <> and <&
+            } else if (*s == '<') {
+                file = 0;
+                s++;             // handle << and <<<
+                if (*s == '<') s++;
+            }
+            s = skip_target(s, end, file);
+            if (s == NULL) return 0;
             expect_name = 0;
             last_was_op = 0;
         }
         else if (*s == '>') {
+            int file = 1;    // > and >> may take a process substitution
             s++;
-            if (*s == '>') s++;  // handle >>
-            s = skip_ws(s);
-            if (!is_name_char(*s)) return 0;
-            while (is_name_char(*s)) s++;
+            if (*s == '>' || *s == '&') {
+                file = *s == '>';
+                s++;             // handle >> and >&
+            }
+            s = skip_target(s, end, file);
+            if (s == NULL) return 0;
             expect_name = 0;
             last_was_op = 0;
         }
         else if (is_name_char(*s)) {
-            while (is_name_char(*s)) s++;
+            s = skip_name(s, end);
+            if (s == NULL) return 0;
             expect_name = 0;
             last_was_op = 0;
         }
@@ -95,42 +276,179 @@ int parse_input(const char *input) {
 }
 
 
-// Tokenizer function
+// Copy what is between the '(' at input[i] and its matching ')' into
+// token and return the index just past the closing paren
+static int read_parenthesized(const char *input, int len, int i, token_t *token) {
+    int depth = 1;
+    int value_index = 0;
+
+    for (i++; i < len; i++) {
+        if (input[i] == '(') depth++;
+        else if (input[i] == ')' && --depth == 0) break;
+        token->value[value_index++] = input[i];
+    }
+    token->value[value_index] = '\0';
+    return i < len ? i + 1 : i;
+}
+
+// Copy the $(...) or `...` at input[i] verbatim onto token's value and
+// return the index just past it; it is expanded when the command runs
+static int read_substitution(const char *input, int len, int i, token_t *token, int *value_index) {
+    int depth = 0;
+    int backtick = (input[i] == '`');
+
+    if (!backtick) {
+        token->value[(*value_index)++] = input[i++]; // the '$'
+    }
+    do {
+        if (backtick) {
+            if (input[i] == '`') depth = !depth;
+        } else if (input[i] == '(') {
+            depth++;
+        } else if (input[i] == ')') {
+            depth--;
+        }
+        token->value[(*value_index)++] = input[i++];
+    } while (i < len && depth > 0);
+    return i;
+}
+
+static int starts_substitution(const char *input, int len, int i) {
+    return input[i] == '`' || (input[i] == '$' && i + 1 < len && input[i + 1] == '(');
+}
+
+// Copy the '...' or "..." string at input[i] onto token's value and return
+// the index just past the closing quote
+static int read_quoted(const char *input, int len, int i, token_t *token, int *value_index) {
+    char quote = input[i++];
+
+    token->quoted = quote;
+    while (i < len && input[i] != quote) {
+        int run = quote == '"' ? (int)scan_double_quoted(input + i, len - i)
+                               : (int)strcspn(input + i, "'");
+        memcpy(token->value + *value_index, input + i, run);
+        *value_index += run;
+        i += run;
+        if (i >= len || input[i] == quote) {
+            break;
+        } else if (quote == '"' && starts_substitution(input, len, i)) {
+            i = read_substitution(input, len, i, token, value_index);
+        } else if (quote == '"' && input[i] == '\\' && i + 1 < len) {
+            i++; // Skip backslash
+            token->value[(*value_index)++] = input[i++];
+        } else {
+            token->value[(*value_index)++] = input[i++];
+        }
+    }
+    if (i < len && input[i] == quote) i++; // Skip closing quote
+    return i;
+}
+
+// Whether word starts with NAME=
+static int is_assignment(const char *word) {
+    if (!isalpha((unsigned char)word[0]) && word[0] != '_') {
+        return 0;
+    }
+    int i = 1;
+    while (isalnum((unsigned char)word[i]) || word[i] == '_') i++;
+    return word[i] == '=';
+}
+
+// Split input into at most MAX_TOKENS - 1 tokens and a TOKEN_EOF.  The
+// values are written one after another into a buffer from the parse
+// arena: a value is never longer than the input it was read from, so the
+// line's length plus a terminator per token is enough.  Returns the
+// number of tokens, or -1 (after a message) if the line has too many.
 int tokenize(const char *input, token_t tokens[]) {
     int token_count = 0;
     int i = 0;
     int len = strlen(input);
+    char *text = parser_alloc(2 * (size_t)len + 2);
+    size_t text_used = 0;
     
-    while (i < len && token_count < MAX_TOKENS - 1) {
+    while (i < len) {
         // Skip whitespace
         while (i < len && isspace(input[i])) {
             i++;
         }
         
         if (i >= len) break;
+        if (token_count == MAX_TOKENS - 1) {
+            fprintf(parser_errors(), "Too many words in one line (max %d)\n", MAX_TOKENS - 1);
+            return -1;
+        }
         
         token_t *current_token = &tokens[token_count];
         int value_index = 0;
+        current_token->value = text + text_used;
+        current_token->quoted = 0;
+        current_token->assignment = 0;
+        current_token->io_number = -1;
+        
+        // A number right before < or > is the descriptor it redirects
+        if (isdigit((unsigned char)input[i])) {
+            int j = i;
+            while (j < len && isdigit((unsigned char)input[j])) j++;
+            if (j < len && j - i < 4 && (input[j] == '<' || input[j] == '>') &&
+                !(j + 1 < len && input[j + 1] == '(')) {
+                current_token->io_number = atoi(input + i);
+                i = j;
+            }
+        }
         
         // Check for special characters
         switch (input[i]) {
             case '|':
-                current_token->type = TOKEN_PIPE;
-                strcpy(current_token->value, "|");
-                i++;
+                if (i + 1 < len && input[i + 1] == '+') {
+                    current_token->type = TOKEN_FANOUT;
+                    strcpy(current_token->value, "|+");
+                    i += 2;
+                } else {
+                    current_token->type = TOKEN_PIPE;
+                    strcpy(current_token->value, "|");
+                    i++;
+                }
                 break;
                 
             case '<':
-                current_token->type = TOKEN_REDIRECT_IN;
-                strcpy(current_token->value, "<");
-                i++;
+                if (i + 1 < len && input[i + 1] == '(') {
+                    current_token->type = TOKEN_PROCSUB_IN;
+                    i = read_parenthesized(input, len, i + 1, current_token);
+                } else if (i + 2 < len && input[i + 1] == '<' && input[i + 2] == '<') {
+                    current_token->type = TOKEN_HERESTRING;
+                    strcpy(current_token->value, "<<<");
+                    i += 3;
+                } else if (i + 1 < len && input[i + 1] == '<') {
+                    current_token->type = TOKEN_HEREDOC;
+                    strcpy(current_token->value, "<<");
+                    i += 2;
+                } else if (i + 1 < len && input[i + 1] == '>') {
+                    current_token->type = TOKEN_REDIRECT_READ_WRITE;
+                    strcpy(current_token->value, "<>");
+                    i += 2;
+                } else if (i + 1 < len && input[i + 1] == '&') {
+                    current_token->type = TOKEN_DUP_IN;
+                    strcpy(current_token->value, "<&");
+                    i += 2;
+                } else {
+                    current_token->type = TOKEN_REDIRECT_IN;
+                    strcpy(current_token->value, "<");
+                    i++;
+                }
                 break;
                 
             case '>':
-                if (i + 1 < len && input[i + 1] == '>') {
+                if (i + 1 < len && input[i + 1] == '(') {
+                    current_token->type = TOKEN_PROCSUB_OUT;
+                    i = read_parenthesized(input, len, i + 1, current_token);
+                } else if (i + 1 < len && input[i + 1] == '>') {
                     current_token->type = TOKEN_REDIRECT_APPEND;
                     strcpy(current_token->value, ">>");
                     i += 2;
+                } else if (i + 1 < len && input[i + 1] == '&') {
+                    current_token->type = TOKEN_DUP_OUT;
+                    strcpy(current_token->value, ">&");
+                    i += 2;
                 } else {
                     current_token->type = TOKEN_REDIRECT_OUT;
                     strcpy(current_token->value, ">");
@@ -143,6 +461,14 @@ int tokenize(const char *input, token_t tokens[]) {
                     current_token->type = TOKEN_AND;
                     strcpy(current_token->value, "&&");
                     i += 2;
+                } else if (i + 2 < len && input[i + 1] == '>' && input[i + 2] == '>') {
+                    current_token->type = TOKEN_APPEND_ALL;
+                    strcpy(current_token->value, "&>>");
+                    i += 3;
+                } else if (i + 1 < len && input[i + 1] == '>') {
+                    current_token->type = TOKEN_REDIRECT_ALL;
+                    strcpy(current_token->value, "&>");
+                    i += 2;
                 } else {
                     current_token->type = TOKEN_BACKGROUND;
                     strcpy(current_token->value, "&");
@@ -157,64 +483,315 @@ int tokenize(const char *input, token_t tokens[]) {
                 break;
                 
             case '"':
-                // Handle quoted strings
-                current_token->type = TOKEN_WORD;
-                i++; // Skip opening quote
-                while (i < len && input[i] != '"' && value_index < MAX_TOKEN_LENGTH - 1) {
-                    if (input[i] == '\\' && i + 1 < len) {
-                        i++; // Skip backslash
-                        current_token->value[value_index++] = input[i++];
-                    } else {
-                        current_token->value[value_index++] = input[i++];
-                    }
-                }
-                if (i < len && input[i] == '"') i++; // Skip closing quote
-                current_token->value[value_index] = '\0';
-                break;
-                
             case '\'':
-                // Handle single quoted strings
+                // Handle quoted strings
                 current_token->type = TOKEN_WORD;
-                i++; // Skip opening quote
-                while (i < len && input[i] != '\'' && value_index < MAX_TOKEN_LENGTH - 1) {
-                    current_token->value[value_index++] = input[i++];
-                }
-                if (i < len && input[i] == '\'') i++; // Skip closing quote
+                i = read_quoted(input, len, i, current_token, &value_index);
                 current_token->value[value_index] = '\0';
                 break;
                 
             default:
+                // A (command) right after |+ or another one is a fan-out consumer
+                if (input[i] == '(' && token_count > 0 &&
+                    (tokens[token_count - 1].type == TOKEN_FANOUT ||
+                     tokens[token_count - 1].type == TOKEN_BRANCH)) {
+                    current_token->type = TOKEN_BRANCH;
+                    i = read_parenthesized(input, len, i, current_token);
+                    break;
+                }
                 // Handle regular words
                 current_token->type = TOKEN_WORD;
-                while (i < len && !isspace(input[i]) && 
-                       input[i] != '|' && input[i] != '<' && input[i] != '>' && 
-                       input[i] != '&' && input[i] != ';' && input[i] != '"' && 
-                       input[i] != '\'' && value_index < MAX_TOKEN_LENGTH - 1) {
-                    current_token->value[value_index++] = input[i++];
+                while (i < len) {
+                    int run = scan_word(input + i, len - i);
+                    memcpy(current_token->value + value_index, input + i, run);
+                    value_index += run;
+                    i += run;
+                    if (i >= len) {
+                        break;
+                    } else if (starts_substitution(input, len, i)) {
+                        i = read_substitution(input, len, i, current_token, &value_index);
+                    } else if (input[i] == '$') {
+                        current_token->value[value_index++] = input[i++];
+                    } else {
+                        break;  // whitespace, an operator or a quote
+                    }
                 }
                 current_token->value[value_index] = '\0';
+                current_token->assignment = is_assignment(current_token->value);
+                // NAME="value" and NAME='value' are one word
+                if (current_token->assignment && current_token->value[value_index - 1] == '=' &&
+                    i < len && (input[i] == '"' || input[i] == '\'')) {
+                    i = read_quoted(input, len, i, current_token, &value_index);
+                    current_token->value[value_index] = '\0';
+                }
                 break;
         }
         
+        text_used += strlen(current_token->value) + 1;
         token_count++;
     }
     
     // Add EOF token
     tokens[token_count].type = TOKEN_EOF;
-    strcpy(tokens[token_count].value, "");
+    tokens[token_count].quoted = 0;
+    tokens[token_count].assignment = 0;
+    tokens[token_count].io_number = -1;
+    tokens[token_count].value = text + text_used;
+    tokens[token_count].value[0] = '\0';
     
     return token_count;
 }
 
+// Shared terminator for commands that have no arguments yet
+static char *no_args[1] = { NULL };
+
 // Initialize a command structure
 void init_command(command_t *cmd) {
+    cmd->args = no_args;
     cmd->argc = 0;
-    cmd->input_file = NULL;
-    cmd->output_file = NULL;
-    cmd->append_output = 0;
+    cmd->args_capacity = 0;
+    cmd->redirections = NULL;
+    cmd->num_redirections = 0;
+    cmd->subs = NULL;
+    cmd->num_subs = 0;
+    cmd->substitutions = NULL;
+    cmd->num_substitutions = 0;
+    cmd->assignments = NULL;
+    cmd->num_assignments = 0;
+    cmd->placement = NULL;
+    cmd->environment = NULL;
     cmd->background = 0;
-    for (int i = 0; i < MAX_TOKENS; i++) {
-        cmd->args[i] = NULL;
+}
+
+// Append arg (already in the parse arena) and keep args NULL-terminated
+void command_add_argument(command_t *cmd, char *arg) {
+    if (cmd->argc + 1 >= cmd->args_capacity) {
+        int new_capacity = cmd->args_capacity ? cmd->args_capacity * 2 : 8;
+        char **grown = parser_alloc(new_capacity * sizeof(char *));
+        memcpy(grown, cmd->args, cmd->argc * sizeof(char *));
+        cmd->args = grown;
+        cmd->args_capacity = new_capacity;
+    }
+    cmd->args[cmd->argc++] = arg;
+    cmd->args[cmd->argc] = NULL;
+}
+
+// array (count elements of size bytes, from the parse arena) with room
+// for one more: it is replaced by one twice the size when count reaches 8,
+// 16, 32 and so on
+static void *grow_array(void *array, int count, size_t size) {
+    if (count < 8 ? count > 0 : (count & (count - 1)) != 0) {
+        return array;
+    }
+    void *grown = parser_alloc((count < 8 ? 8 : 2 * (size_t)count) * size);
+    if (count > 0) {
+        memcpy(grown, array, count * size);
+    }
+    return grown;
+}
+
+// Add a word token, expanding unquoted wildcards against the file system.
+// Words with substitutions or variables (and, when deferring, wildcards)
+// are kept as typed and expanded when the command runs.  NAME=value words
+// before the command name are assignments.
+void command_add_word(command_t *cmd, const token_t *token) {
+    if (token->assignment && cmd->argc == 0) {
+        command_add_assignment(cmd, token);
+        return;
+    }
+    if ((token->quoted != '\'' && has_substitution(token->value)) ||
+        (defer_wildcards && !token->quoted && has_wildcard(token->value))) {
+        cmd->substitutions = grow_array(cmd->substitutions, cmd->num_substitutions,
+                                        sizeof(substitution_t));
+        substitution_t *substitution = &cmd->substitutions[cmd->num_substitutions++];
+        substitution->arg_index = cmd->argc;
+        substitution->quoted = (token->quoted != 0);
+        command_add_argument(cmd, parser_strdup(token->value));
+        return;
+    }
+    if (!token->quoted && has_wildcard(token->value)) {
+        parse_cacheable = 0; // Result depends on the directory contents
+        if (expand_wildcard(token->value, cmd) > 0) {
+            return;
+        }
+    }
+    command_add_argument(cmd, parser_strdup(token->value));
+}
+
+// Add a NAME=value prefix.  Its value is expanded when the command runs.
+void command_add_assignment(command_t *cmd, const token_t *token) {
+    cmd->assignments = grow_array(cmd->assignments, cmd->num_assignments, sizeof(assignment_t));
+    assignment_t *assignment = &cmd->assignments[cmd->num_assignments++];
+    assignment->text = parser_strdup(token->value);
+    assignment->expand = token->quoted != '\'' && has_substitution(token->value);
+}
+
+static int is_number(const char *word) {
+    int i = 0;
+    while (isdigit((unsigned char)word[i])) i++;
+    return i > 0 && word[i] == '\0';
+}
+
+static redirection_t *next_redirection(command_t *cmd, redirect_type_t type, int fd) {
+    if (cmd->redirections == NULL) {
+        cmd->redirections = parser_alloc(MAX_REDIRECTIONS * sizeof(redirection_t));
+    }
+    redirection_t *redirection = &cmd->redirections[cmd->num_redirections++];
+    redirection->type = type;
+    redirection->fd = fd;
+    redirection->source_fd = -1;
+    redirection->target = NULL;
+    redirection->length = 0;
+    redirection->expand = 0;
+    return redirection;
+}
+
+static process_sub_t *new_process_sub(command_t *cmd, const token_t *token);
+
+// Add the redirection operator op applies to target, a word or a process
+// substitution.  Nothing is opened here: the redirections are carried out
+// in order when the command starts.  &>file and >&file stand for
+// >file 2>&1.  Returns -1, after a message, when the redirection can't be
+// used; the line is then not run.
+int command_add_redirection(command_t *cmd, const token_t *op, const token_t *target) {
+    const char *word = target->value;
+    int input = (op->type == TOKEN_REDIRECT_IN || op->type == TOKEN_REDIRECT_READ_WRITE ||
+                 op->type == TOKEN_DUP_IN || op->type == TOKEN_HEREDOC || op->type == TOKEN_HERESTRING);
+    int fd = op->io_number != -1 ? op->io_number : input ? STDIN_FILENO : STDOUT_FILENO;
+    int both = (op->type == TOKEN_REDIRECT_ALL || op->type == TOKEN_APPEND_ALL ||
+                (op->type == TOKEN_DUP_OUT && op->io_number == -1 &&
+                 strcmp(word, "-") != 0 && !is_number(word)));
+    redirection_t *redirection;
+
+    if (cmd->num_redirections + both >= MAX_REDIRECTIONS) {
+        fprintf(parser_errors(), "Too many redirections (max %d)\n", MAX_REDIRECTIONS);
+        return -1;
+    }
+    if (target->type == TOKEN_PROCSUB_IN || target->type == TOKEN_PROCSUB_OUT) {
+        // fd becomes a copy of the pipe once it exists (attach_process_subs())
+        process_sub_t *sub = new_process_sub(cmd, target);
+        if (sub == NULL) {
+            return -1;
+        }
+        sub->redirection = cmd->num_redirections;
+        next_redirection(cmd, REDIRECT_DUP, fd);
+        if (both) {
+            next_redirection(cmd, REDIRECT_DUP, STDERR_FILENO)->source_fd = STDOUT_FILENO;
+        }
+        return 0;
+    }
+    switch (op->type) {
+        case TOKEN_REDIRECT_IN:
+            redirection = next_redirection(cmd, REDIRECT_READ, fd);
+            break;
+        case TOKEN_REDIRECT_READ_WRITE:
+            redirection = next_redirection(cmd, REDIRECT_READ_WRITE, fd);
+            break;
+        case TOKEN_REDIRECT_APPEND:
+        case TOKEN_APPEND_ALL:
+            redirection = next_redirection(cmd, REDIRECT_APPEND, fd);
+            break;
+        case TOKEN_HEREDOC:
+        case TOKEN_HERESTRING: {
+            size_t length = 0;
+            char *text = op->type == TOKEN_HEREDOC ? read_heredoc_body(word, &length)
+                                                   : herestring_body(word, &length);
+            if (op->type == TOKEN_HEREDOC) {
+                parse_cacheable = 0; // The body was read from input, not from the line
+            }
+            if (text != NULL) {
+                redirection = next_redirection(cmd, REDIRECT_TEXT, fd);
+                redirection->target = text;
+                redirection->length = length;
+            }
+            return 0;
+        }
+        case TOKEN_DUP_IN:
+        case TOKEN_DUP_OUT:
+            if (strcmp(word, "-") == 0) {
+                next_redirection(cmd, REDIRECT_CLOSE, fd);
+                return 0;
+            }
+            if (is_number(word)) {
+                next_redirection(cmd, REDIRECT_DUP, fd)->source_fd = atoi(word);
+                return 0;
+            }
+            if (!both) {
+                fprintf(parser_errors(), "%s: ambiguous redirect\n", word);
+                return -1;
+            }
+            redirection = next_redirection(cmd, REDIRECT_WRITE, fd);
+            break;
+        default:
+            redirection = next_redirection(cmd, REDIRECT_WRITE, fd);
+            break;
+    }
+    redirection->target = parser_strdup(word);
+    redirection->expand = target->quoted != '\'' && has_substitution(word);
+    if (both) {
+        next_redirection(cmd, REDIRECT_DUP, STDERR_FILENO)->source_fd = STDOUT_FILENO;
+    }
+    return 0;
+}
+
+// A new <(...) or >(...) of cmd, used neither as an argument nor as a
+// redirection yet.  NULL (after a message) when cmd has too many.
+static process_sub_t *new_process_sub(command_t *cmd, const token_t *token) {
+    if (cmd->num_subs == MAX_PROCESS_SUBS) {
+        fprintf(parser_errors(), "Too many process substitutions (max %d)\n", MAX_PROCESS_SUBS);
+        return NULL;
+    }
+    if (cmd->subs == NULL) {
+        cmd->subs = parser_alloc(MAX_PROCESS_SUBS * sizeof(process_sub_t));
+    }
+
+    process_sub_t *sub = &cmd->subs[cmd->num_subs++];
+    sub->arg_index = -1;
+    sub->redirection = -1;
+    sub->output = (token->type == TOKEN_PROCSUB_OUT);
+    sub->command = parser_strdup(token->value);
+    return sub;
+}
+
+// Add a <(...) or >(...) argument.  Its final text (/dev/fd/N) is only
+// known once the pipe exists, so the command text stands in until then.
+void command_add_process_sub(command_t *cmd, const token_t *token) {
+    process_sub_t *sub = new_process_sub(cmd, token);
+    if (sub != NULL) {
+        sub->arg_index = cmd->argc;
+        command_add_argument(cmd, sub->command);
+    }
+}
+
+// Turn a "place [options] command" prefix into cmd->placement and drop
+// it from the arguments.  Anything else starting with place (a %job, bad
+// or substituted options) is left for the place builtin.
+void command_take_placement(command_t *cmd) {
+    placement_t placement;
+
+    if (cmd->argc < 2 || strcmp(cmd->args[0], "place") != 0) {
+        return;
+    }
+    int first = parse_placement(cmd->argc, cmd->args, &placement, 0);
+    if (first <= 0 || first >= cmd->argc || cmd->args[first][0] == '%') {
+        return;
+    }
+    for (int i = 0; i < cmd->num_subs; i++) {
+        if (cmd->subs[i].arg_index >= 0 && cmd->subs[i].arg_index < first) return;
+    }
+    for (int i = 0; i < cmd->num_substitutions; i++) {
+        if (cmd->substitutions[i].arg_index < first) return;
+    }
+
+    cmd->placement = parser_alloc(sizeof(placement_t));
+    *cmd->placement = placement;
+    memmove(cmd->args, cmd->args + first, (cmd->argc - first + 1) * sizeof(char *));
+    cmd->argc -= first;
+    for (int i = 0; i < cmd->num_subs; i++) {
+        if (cmd->subs[i].arg_index >= 0) cmd->subs[i].arg_index -= first;
+    }
+    for (int i = 0; i < cmd->num_substitutions; i++) {
+        cmd->substitutions[i].arg_index -= first;
     }
 }
 
@@ -224,51 +801,43 @@ int parse_command(token_t tokens[], int *token_index, command_t *cmd) {
     
     while (tokens[*token_index].type != TOKEN_EOF &&
            tokens[*token_index].type != TOKEN_PIPE &&
+           tokens[*token_index].type != TOKEN_FANOUT &&
            tokens[*token_index].type != TOKEN_SEMICOLON &&
            tokens[*token_index].type != TOKEN_AND &&
-           tokens[*token_index].type != TOKEN_OR) {
+           tokens[*token_index].type != TOKEN_OR &&
+           tokens[*token_index].type != TOKEN_BACKGROUND) {
         
         token_t *current = &tokens[*token_index];
         
         switch (current->type) {
             case TOKEN_WORD:
-                if (cmd->argc < MAX_TOKENS - 1) {
-                    cmd->args[cmd->argc] = malloc(strlen(current->value) + 1);
-                    strcpy(cmd->args[cmd->argc], current->value);
-                    cmd->argc++;
-                }
+                command_add_word(cmd, current);
                 break;
                 
-            case TOKEN_REDIRECT_IN:
-                (*token_index)++;
-                if (tokens[*token_index].type == TOKEN_WORD) {
-                    cmd->input_file = malloc(strlen(tokens[*token_index].value) + 1);
-                    strcpy(cmd->input_file, tokens[*token_index].value);
-                }
+            case TOKEN_PROCSUB_IN:
+            case TOKEN_PROCSUB_OUT:
+                command_add_process_sub(cmd, current);
                 break;
-                
+
+            case TOKEN_REDIRECT_IN:
             case TOKEN_REDIRECT_OUT:
-                (*token_index)++;
-                if (tokens[*token_index].type == TOKEN_WORD) {
-                    cmd->output_file = malloc(strlen(tokens[*token_index].value) + 1);
-                    strcpy(cmd->output_file, tokens[*token_index].value);
-                    cmd->append_output = 0;
-                }
-                break;
-                
             case TOKEN_REDIRECT_APPEND:
+            case TOKEN_REDIRECT_READ_WRITE:
+            case TOKEN_DUP_IN:
+            case TOKEN_DUP_OUT:
+            case TOKEN_REDIRECT_ALL:
+            case TOKEN_APPEND_ALL:
+            case TOKEN_HEREDOC:
+            case TOKEN_HERESTRING:
                 (*token_index)++;
-                if (tokens[*token_index].type == TOKEN_WORD) {
-                    cmd->output_file = malloc(strlen(tokens[*token_index].value) + 1);
-                    strcpy(cmd->output_file, tokens[*token_index].value);
-                    cmd->append_output = 1;
+                if ((tokens[*token_index].type == TOKEN_WORD ||
+                     tokens[*token_index].type == TOKEN_PROCSUB_IN ||
+                     tokens[*token_index].type == TOKEN_PROCSUB_OUT) &&
+                    command_add_redirection(cmd, current, &tokens[*token_index]) == -1) {
+                    return 0;
                 }
                 break;
                 
-            case TOKEN_BACKGROUND:
-                cmd->background = 1;
-                break;
-                
             default:
                 break;
         }
@@ -276,51 +845,33 @@ int parse_command(token_t tokens[], int *token_index, command_t *cmd) {
         (*token_index)++;
     }
     
-    // Null-terminate the args array
-    cmd->args[cmd->argc] = NULL;
-    
-    return (cmd->argc > 0) ? 1 : 0;
+    command_take_placement(cmd);
+    return (cmd->argc > 0 || cmd->num_assignments > 0) ? 1 : 0;
 }
 
-// Parse a complete pipeline
-int parse_pipeline(token_t tokens[], pipeline_t *pipeline) {
-    init_pipeline(pipeline);
-    
-    int token_index = 0;
-    int command_count = 0;
-    
-    while (tokens[token_index].type != TOKEN_EOF && 
-           tokens[token_index].type != TOKEN_SEMICOLON &&
-           command_count < MAX_PIPELINE_COMMANDS) {
-        
-        command_t *cmd = &pipeline->commands[command_count];
-        
-        // Use the new parsing function instead of the old one
-        if (!parse_command_with_multiple_redirections(tokens, &token_index, cmd)) {
-            return 0; // Parse error
-        }
-        
-        command_count++;
-        
-        // Check if we hit a pipe
-        if (tokens[token_index].type == TOKEN_PIPE) {
-            token_index++; // Skip the pipe token
+// Collect the (command) consumers following a |+
+static void parse_fanout_branches(token_t tokens[], int *token_index, pipeline_t *pipeline) {
+    while (tokens[*token_index].type == TOKEN_BRANCH) {
+        if (pipeline->num_branches == MAX_FANOUT_BRANCHES) {
+            fprintf(parser_errors(), "Too many fan-out consumers (max %d)\n", MAX_FANOUT_BRANCHES);
         } else {
-            break; // No more commands in this pipeline
+            if (pipeline->branches == NULL) {
+                pipeline->branches = parser_alloc(MAX_FANOUT_BRANCHES * sizeof(char *));
+            }
+            pipeline->branches[pipeline->num_branches++] = parser_strdup(tokens[*token_index].value);
         }
+        (*token_index)++;
     }
-    
-    // Check for background operator at the end of pipeline
-    if (tokens[token_index].type == TOKEN_BACKGROUND) {
-        pipeline->background = 1;
-        token_index++;
-    }
-    
-    pipeline->num_commands = command_count;
-    return (command_count > 0);
+}
+
+// Parse a complete pipeline
+int parse_pipeline(token_t tokens[], pipeline_t *pipeline) {
+    int token_index = 0;
+    return parse_single_pipeline_from_tokens(tokens, &token_index, pipeline);
 }
 int parse_single_pipeline_from_tokens(token_t tokens[], int *token_index, pipeline_t *pipeline) {
     init_pipeline(pipeline);
+    alloc_pipeline_commands(pipeline, count_pipeline_commands(tokens, *token_index));
     
     int command_count = 0;
     
@@ -345,9 +896,18 @@ int parse_single_pipeline_from_tokens(token_t tokens[], int *token_index, pipeli
         }
     }
     
+    // A |+ fan-out ends the pipeline with its consumers
+    if (tokens[*token_index].type == TOKEN_FANOUT) {
+        (*token_index)++;
+        parse_fanout_branches(tokens, token_index, pipeline);
+    }
+    
     // Check for background operator at the end of pipeline
     if (tokens[*token_index].type == TOKEN_BACKGROUND) {
         pipeline->background = 1;
+        for (int i = 0; i < command_count; i++) {
+            pipeline->commands[i].background = 1;
+        }
         (*token_index)++;
     }
     
@@ -355,45 +915,123 @@ int parse_single_pipeline_from_tokens(token_t tokens[], int *token_index, pipeli
     return (command_count > 0);
 }
 
-// Free memory allocated for a command
+// Release a command.  Its strings belong to the parse arena, so this only
+// drops the references; the memory goes back when the arena is reset.
 void free_command(command_t *cmd) {
-    for (int i = 0; i < cmd->argc; i++) {
-        if (cmd->args[i]) {
-            free(cmd->args[i]);
-            cmd->args[i] = NULL;
-        }
-    }
-    if (cmd->input_file) {
-        free(cmd->input_file);
-        cmd->input_file = NULL;
-    }
-    if (cmd->output_file) {
-        free(cmd->output_file);
-        cmd->output_file = NULL;
-    }
+    cmd->args = no_args;
+    cmd->argc = 0;
+    cmd->args_capacity = 0;
+    cmd->redirections = NULL;
+    cmd->num_redirections = 0;
+    cmd->subs = NULL;
+    cmd->num_subs = 0;
+    cmd->substitutions = NULL;
+    cmd->num_substitutions = 0;
+    cmd->assignments = NULL;
+    cmd->num_assignments = 0;
+    cmd->placement = NULL;
 }
 
-// Free memory allocated for a pipeline
+// Release a pipeline (see free_command())
 void free_pipeline(pipeline_t *pipeline) {
     for (int i = 0; i < pipeline->num_commands; i++) {
         free_command(&pipeline->commands[i]);
     }
+    pipeline->commands = NULL;
+    pipeline->num_commands = 0;
+    pipeline->branches = NULL;
+    pipeline->num_branches = 0;
+}
+
+static char *copy_string(const char *s) {
+    return s ? parser_strdup(s) : NULL;
+}
+
+// Deep-copy src into the current parse arena, so the copy outlives the
+// arena src was parsed into
+void copy_pipeline(pipeline_t *dst, const pipeline_t *src) {
+    *dst = *src;
+    dst->commands = parser_alloc(src->num_commands * sizeof(command_t));
+    for (int i = 0; i < src->num_commands; i++) {
+        const command_t *from = &src->commands[i];
+        command_t *to = &dst->commands[i];
+
+        *to = *from;
+        to->args = parser_alloc((from->argc + 1) * sizeof(char *));
+        to->args_capacity = from->argc + 1;
+        for (int j = 0; j < from->argc; j++) {
+            to->args[j] = parser_strdup(from->args[j]);
+        }
+        to->args[from->argc] = NULL;
+        if (from->num_redirections > 0) {
+            to->redirections = parser_alloc(from->num_redirections * sizeof(redirection_t));
+            for (int j = 0; j < from->num_redirections; j++) {
+                const redirection_t *redirection = &from->redirections[j];
+                to->redirections[j] = *redirection;
+                if (redirection->type == REDIRECT_TEXT) {
+                    to->redirections[j].target = parser_alloc(redirection->length + 1);
+                    memcpy(to->redirections[j].target, redirection->target, redirection->length + 1);
+                } else {
+                    to->redirections[j].target = copy_string(redirection->target);
+                }
+            }
+        }
+        if (from->num_subs > 0) {
+            to->subs = parser_alloc(from->num_subs * sizeof(process_sub_t));
+            for (int j = 0; j < from->num_subs; j++) {
+                to->subs[j] = from->subs[j];
+                to->subs[j].command = parser_strdup(from->subs[j].command);
+            }
+        }
+        if (from->num_substitutions > 0) {
+            to->substitutions = parser_alloc(from->num_substitutions * sizeof(substitution_t));
+            memcpy(to->substitutions, from->substitutions,
+                   from->num_substitutions * sizeof(substitution_t));
+        }
+        if (from->num_assignments > 0) {
+            to->assignments = parser_alloc(from->num_assignments * sizeof(assignment_t));
+            for (int j = 0; j < from->num_assignments; j++) {
+                to->assignments[j] = from->assignments[j];
+                to->assignments[j].text = parser_strdup(from->assignments[j].text);
+            }
+        }
+        if (from->placement) {
+            to->placement = parser_alloc(sizeof(placement_t));
+            *to->placement = *from->placement;
+        }
+    }
+    if (src->num_branches > 0) {
+        dst->branches = parser_alloc(src->num_branches * sizeof(char *));
+        for (int i = 0; i < src->num_branches; i++) {
+            dst->branches[i] = parser_strdup(src->branches[i]);
+        }
+    }
 }
 
 // Print a command (for debugging)
 void print_command(const command_t *cmd) {
     printf("Command: ");
+    for (int i = 0; i < cmd->num_assignments; i++) {
+        printf("%s ", cmd->assignments[i].text);
+    }
     for (int i = 0; i < cmd->argc; i++) {
         printf("%s ", cmd->args[i]);
     }
     printf("\n");
     
-    if (cmd->input_file) {
-        printf("  Input: %s\n", cmd->input_file);
-    }
-    if (cmd->output_file) {
-        printf("  Output: %s %s\n", cmd->output_file, 
-               cmd->append_output ? "(append)" : "(overwrite)");
+    for (int i = 0; i < cmd->num_redirections; i++) {
+        const redirection_t *redirection = &cmd->redirections[i];
+        static const char *const operators[] = { "<", ">", ">>", "<>", "<<<", ">&", ">&-" };
+        printf("  Redirect: %d%s", redirection->fd, operators[redirection->type]);
+        if (redirection->type == REDIRECT_TEXT) {
+            printf(" (%zu bytes)\n", redirection->length);
+        } else if (redirection->type == REDIRECT_DUP) {
+            printf("%d\n", redirection->source_fd);
+        } else if (redirection->type == REDIRECT_CLOSE) {
+            printf("\n");
+        } else {
+            printf(" %s\n", redirection->target);
+        }
     }
     if (cmd->background) {
         printf("  Background: yes\n");
@@ -407,6 +1045,9 @@ void print_pipeline(const pipeline_t *pipeline) {
         printf("Command %d:\n", i + 1);
         print_command(&pipeline->commands[i]);
     }
+    for (int i = 0; i < pipeline->num_branches; i++) {
+        printf("Fan-out to: %s\n", pipeline->branches[i]);
+    }
     if (pipeline->background) {
         printf("Pipeline runs in background\n");
     }
@@ -415,12 +1056,13 @@ void print_pipeline(const pipeline_t *pipeline) {
 // for sequentials
 // Helper function to parse a single pipeline from tokens starting at token_index
 int parse_pipeline_from_tokens(token_t tokens[], int *token_index, pipeline_t *pipeline) {
-    pipeline->num_commands = 0;
-    pipeline->background = 0;
+    init_pipeline(pipeline);
+    int max_commands = count_pipeline_commands(tokens, *token_index);
+    alloc_pipeline_commands(pipeline, max_commands);
     
     while (tokens[*token_index].type != TOKEN_EOF && 
            tokens[*token_index].type != TOKEN_SEMICOLON &&
-           pipeline->num_commands < MAX_TOKENS) {
+           pipeline->num_commands < max_commands) {
         
         // Parse one command
         if (!parse_command(tokens, token_index, &pipeline->commands[pipeline->num_commands])) {
@@ -447,6 +1089,15 @@ int parse_pipeline_from_tokens(token_t tokens[], int *token_index, pipeline_t *p
 // Parse a sequence of commands separated by semicolons
 int parse_command_sequence(token_t tokens[], command_sequence_t *sequence) {
     init_command_sequence(sequence);
+
+    int max_pipelines = 1;
+    for (int i = 0; tokens[i].type != TOKEN_EOF; i++) {
+        if (tokens[i].type == TOKEN_SEMICOLON || tokens[i].type == TOKEN_BACKGROUND) max_pipelines++;
+    }
+    if (max_pipelines > MAX_SEQUENCE_PIPELINES) {
+        max_pipelines = MAX_SEQUENCE_PIPELINES;
+    }
+    sequence->pipelines = parser_alloc(max_pipelines * sizeof(pipeline_t));
     
     int token_index = 0;
     int pipeline_count = 0;
@@ -463,10 +1114,10 @@ int parse_command_sequence(token_t tokens[], command_sequence_t *sequence) {
         
         pipeline_count++;
         
-        // Check if we hit a semicolon
+        // Check if we hit a semicolon; "a & b" separates like "a; b"
         if (tokens[token_index].type == TOKEN_SEMICOLON) {
             token_index++; // Skip the semicolon
-        } else {
+        } else if (!pipeline->background || tokens[token_index].type == TOKEN_EOF) {
             break; // No more pipelines
         }
     }
@@ -481,6 +1132,7 @@ void free_command_sequence(command_sequence_t *sequence) {
     for (int i = 0; i < sequence->num_pipelines; i++) {
         free_pipeline(&sequence->pipelines[i]);
     }
+    sequence->pipelines = NULL;
     sequence->num_pipelines = 0;
 }
 // LLM CODE ENDS
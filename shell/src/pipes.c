@@ -1,7 +1,20 @@
+#define _GNU_SOURCE
 #include "pipes.h"
 #include "jobs.h"
+#include "procsub.h"
+#include "zygote.h"
+#include "cmdsubst.h"
+#include "admission.h"
+#include "joblog.h"
+#include "control.h"
+#include "fanout.h"
+#include "variables.h"
+#include "redirect.h"
+#include "fastpath.h"
+#include <pthread.h>
 
 extern char current_foreground_command[MAX_COMMAND_NAME];
+int last_exit_status = 0; // $?
 // Forward declarations for builtin functions (from previous implementation)
 // int execute_builtin_command(int argc, char *argv[]);
 // void init_shell_directories();
@@ -9,19 +22,205 @@ const char* get_command_name(char *args[]) {
     if (args[0] == NULL) return "unknown";
     return args[0];
 }
+// Close every descriptor above stderr except the command's process
+// substitutions, one close_range() per gap (child side, just before exec)
+static void close_inherited_fds(const procsub_state_t *subs) {
+    int keep[MAX_PROCESS_SUBS];
+    unsigned int from = STDERR_FILENO + 1;
+
+    for (int i = 0; i < subs->count; i++) {
+        int j = i;
+        while (j > 0 && keep[j - 1] > subs->fds[i]) {
+            keep[j] = keep[j - 1];
+            j--;
+        }
+        keep[j] = subs->fds[i];
+    }
+    for (int i = 0; i < subs->count; i++) {
+        if ((unsigned int)keep[i] > from) {
+            close_range(from, keep[i] - 1, 0);
+        }
+        from = keep[i] + 1;
+    }
+    close_range(from, ~0U, 0);
+}
+
+// Point stdout and stderr at a background job's output capture (child
+// side); the command's own redirections are applied after this
+static void redirect_to_capture(int capture_fd) {
+    if (capture_fd == -1) {
+        return;
+    }
+    dup2(capture_fd, STDOUT_FILENO);
+    dup2(capture_fd, STDERR_FILENO);
+    close(capture_fd);
+}
+
+// A builtin running as a pipeline stage on a thread of the shell.  It
+// writes to its stage's pipe through its own FILE (see builtin_output()),
+// so neither the shell's stdio nor its fds 0 and 1 change.
+typedef struct {
+    command_t *cmd;
+    int input_fd;            // STDIN_FILENO or owned by the stage
+    int output_fd;           // STDOUT_FILENO or owned by the stage
+    int status;
+    int started;
+    pthread_t thread;
+} builtin_stage_t;
+
+static void *run_builtin_stage(void *arg) {
+    builtin_stage_t *stage = arg;
+    sigset_t blocked;
+
+    // Signals are handled by the main thread, and a write to a pipe whose
+    // reader is gone fails with EPIPE here instead of killing the shell
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGPIPE);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTSTP);
+    sigaddset(&blocked, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+
+    FILE *output = stage->output_fd == STDOUT_FILENO ? stdout : fdopen(stage->output_fd, "w");
+    if (output == NULL) {
+        perror("fdopen failed");
+        close(stage->output_fd);
+        stage->status = 1;
+    } else {
+        set_builtin_io(output, stage->input_fd);
+        if (is_builtin_command(stage->cmd->args[0])) {
+            stage->status = execute_builtin_command(stage->cmd->argc, stage->cmd->args);
+        } else {
+            stage->status = run_fast_path(stage->cmd->argc, stage->cmd->args);
+        }
+        if (output == stdout) {
+            fflush(stdout);
+        } else {
+            fclose(output); // The next stage sees end of input
+        }
+    }
+    if (stage->input_fd != STDIN_FILENO) {
+        close(stage->input_fd);
+    }
+    return NULL;
+}
+
+// Start cmd on a thread with the given ends (either -1 after an error)
+static void start_builtin_stage(builtin_stage_t *stage, command_t *cmd, int input_fd, int output_fd) {
+    stage->cmd = cmd;
+    stage->input_fd = input_fd;
+    stage->output_fd = output_fd;
+    stage->status = 1;
+    stage->started = 0;
+
+    if (input_fd != -1 && output_fd != -1) {
+        int error = pthread_create(&stage->thread, NULL, run_builtin_stage, stage);
+        if (error == 0) {
+            stage->started = 1;
+            return;
+        }
+        fprintf(stderr, "%s: %s\n", cmd->args[0], strerror(error));
+    }
+    if (input_fd > STDIN_FILENO) close(input_fd);
+    if (output_fd > STDOUT_FILENO) close(output_fd);
+}
+
+static int finish_builtin_stage(builtin_stage_t *stage) {
+    if (stage->started) {
+        pthread_join(stage->thread, NULL);
+    }
+    return stage->status;
+}
+
+// The ends a builtin stage on a thread reads and writes: its pipe ends (or
+// the shell's stdin and stdout, or the fan-out pipe) with its redirections
+// opened in their place.  Pipe ends a redirection replaces are closed, and
+// the fan-out pipe is copied for the stage to own.  Both ends are -1 after
+// an error.
+static void open_stage_ends(const command_t *cmd, int ends[2], int fanout_fd) {
+    int fds[3] = { ends[0], ends[1], STDERR_FILENO };
+
+    if (redirect_standard_fds(cmd, fds) == -1) {
+        fds[0] = fds[1] = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] != ends[i] && ends[i] > STDERR_FILENO && ends[i] != fanout_fd) {
+            close(ends[i]);
+        }
+    }
+    if (fds[1] != -1 && fds[1] == fanout_fd) {
+        fds[1] = fcntl(fanout_fd, F_DUPFD_CLOEXEC, 0);
+    }
+    if (fds[0] == -1 || fds[1] == -1) {
+        if (fds[0] > STDERR_FILENO) close(fds[0]);
+        if (fds[1] > STDERR_FILENO) close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+    ends[0] = fds[0];
+    ends[1] = fds[1];
+}
+
+// Start cmd in the zygote with its redirections opened by the shell.
+// Returns the pid, -1 if the zygote could not take the command (or its
+// redirections need more than stdin, stdout and stderr), or -2 if a
+// redirection failed (already reported).
+static pid_t spawn_in_zygote(command_t *cmd, int background, int capture_fd) {
+    int base[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    pid_t pid = -1;
+
+    if (capture_fd != -1) {
+        base[1] = base[2] = capture_fd;
+    }
+    // Background processes should not have access to terminal input
+    if (background) {
+        base[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (base[0] == -1) {
+            perror("/dev/null");
+            return -2;
+        }
+    }
+
+    int fds[3] = { base[0], base[1], base[2] };
+    int status = redirect_standard_fds(cmd, fds);
+    if (status == 0) {
+        pid = zygote_spawn(cmd->args, command_environment(cmd), fds, cmd->placement);
+        close_standard_fds(fds, base);
+    } else if (status == -1) {
+        pid = -2;
+    }
+    if (background) close(base[0]);
+    return pid;
+}
+
 // LLM CODE BEGINS
 // Execute a single external command
-int execute_external_command(char *args[], char *input_file, char *output_file, 
-                            int append_output, int background) {
-    pid_t pid;
+int execute_external_command(command_t *cmd, int background) {
+    char **args = cmd->args;
+    procsub_state_t subs;
+    pid_t pid = -1;
     int status;
     
     if (args[0] == NULL) {
         return 0; // Empty command
     }
+    if (start_process_subs(cmd, &subs) == -1) {
+        return 1;
+    }
+    int capture_fd = background ? joblog_begin() : -1;
+    
+    // Let the zygote fork from its small image when it is running
+    if (zygote_running() && cmd->num_subs == 0) {
+        pid = spawn_in_zygote(cmd, background, capture_fd);
+        if (pid == -2) {
+            joblog_cancel();
+            return 1;
+        }
+    }
     
     // Fork a child process
-    pid = fork();
+    if (pid == -1) {
+        pid = fork();
+    }
     
     if (pid == 0) {
         // Child process
@@ -29,58 +228,49 @@ int execute_external_command(char *args[], char *input_file, char *output_file,
         if (setpgid(0, 0) == -1) {
             perror("setpgid failed");
         }
+        if (cmd->placement && apply_placement(0, cmd->placement) == -1) {
+            _exit(EXIT_FAILURE);
+        }
         // Background processes should not have access to terminal input
         if (background) {
             // Redirect stdin to /dev/null for background processes
             freopen("/dev/null", "r", stdin);
         }
         
-        // Handle input redirection
-        if (input_file != NULL) {
-            int input_fd = open(input_file, O_RDONLY);
-            if (input_fd == -1) {
-                perror("Input redirection failed");
-                exit(EXIT_FAILURE);
-            }
-            dup2(input_fd, STDIN_FILENO);
-            close(input_fd);
-        }
-        
-        // Handle output redirection
-        if (output_file != NULL) {
-            int output_fd;
-            if (append_output) {
-                output_fd = open(output_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-            } else {
-                output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            }
-            if (output_fd == -1) {
-                perror("Output redirection failed");
-                exit(EXIT_FAILURE);
-            }
-            dup2(output_fd, STDOUT_FILENO);
-            close(output_fd);
+        // Handle input and output redirection
+        // Process substitutions first: a redirection may copy one
+        redirect_to_capture(capture_fd);
+        attach_process_subs(cmd, &subs);
+        if (apply_redirections(cmd) == -1) {
+            exit(EXIT_FAILURE);
         }
+        environ = command_environment(cmd);
         
         // Execute the command
         if (execvp(args[0], args) == -1) {
-            fprintf(stderr, "%s: command not found\n", args[0]);
+            fprintf(stderr, "%s: %s\n", args[0], errno == ENOENT ? "command not found" : strerror(errno));
             exit(EXIT_FAILURE);
         }
         
     } else if (pid < 0) {
         // Fork failed
         perror("fork failed");
+        joblog_cancel();
+        close_process_subs(&subs);
+        reap_process_subs(&subs, 1);
         return 1;
         
     } else {
         // Parent process
+        close_process_subs(&subs);
 
          // Set process group for the child
         setpgid(pid, pid);
         if (background) {
             // Add to background job list and don't wait
-            add_background_job(pid, get_command_name(args));
+            int job_id = add_background_job(pid, get_command_name(args));
+            joblog_attach(job_id, get_command_name(args));
+            reap_process_subs(&subs, 0);
             return 0;
         } else {
 
@@ -90,7 +280,12 @@ int execute_external_command(char *args[], char *input_file, char *output_file,
             snprintf(current_foreground_command, MAX_COMMAND_NAME, "%s", get_command_name(args));
             // Wait for foreground process to complete
             do {
-                waitpid(pid, &status, WUNTRACED);
+                if (wait_process(pid, &status, WUNTRACED) == -1) {
+                    // Lost track of it (the zygote went away)
+                    current_foreground_pid = 0;
+                    current_foreground_pgid = 0;
+                    return 1;
+                }
                  // Check if process was stopped
                 if (WIFSTOPPED(status)) {
                     // Process was stopped, add to job list
@@ -98,12 +293,14 @@ int execute_external_command(char *args[], char *input_file, char *output_file,
                     printf("[%d] Stopped %s\n", next_job_id - 1, get_command_name(args));
                     current_foreground_pid = 0;
                     current_foreground_pgid = 0;
+                    reap_process_subs(&subs, 0);
                     return 0;
                 }
             } while (!WIFEXITED(status) && !WIFSIGNALED(status));
              // Clear foreground process
             current_foreground_pid = 0;
             current_foreground_pgid = 0;
+            reap_process_subs(&subs, 1);
             
             return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
         }
@@ -114,16 +311,20 @@ int execute_external_command(char *args[], char *input_file, char *output_file,
 // Execute a single command (checks for builtins first, then external)
 int execute_single_command(command_t *cmd)
 {
-    if (cmd == NULL || cmd->argc == 0)
+    if (cmd == NULL)
     {
         return 0;
     }
+    if (cmd->argc == 0)
+    {
+        return assign_variables(cmd); // Only NAME=value words
+    }
 
     // Check if it's a builtin command first
-    if (strcmp(cmd->args[0], "hop") == 0 || strcmp(cmd->args[0], "reveal") == 0 || strcmp(cmd->args[0], "activities") == 0|| strcmp(cmd->args[0], "ping") == 0|| strcmp(cmd->args[0], "bg") == 0|| strcmp(cmd->args[0], "fg") == 0)
+    if (is_builtin_command(cmd->args[0]))
     {
         // It's a builtin command - handle redirections
-        if (cmd->input_file || cmd->output_file)
+        if (cmd->num_redirections > 0)
         {
             // Fork a process to handle redirections for built-in commands
             pid_t pid = fork();
@@ -131,39 +332,11 @@ int execute_single_command(command_t *cmd)
             if (pid == 0)
             {
                 // Child process - set up redirections
-                
-                // Handle input redirection
-                if (cmd->input_file)
-                {
-                    int input_fd = open(cmd->input_file, O_RDONLY);
-                    if (input_fd == -1)
-                    {
-                        perror("Input redirection failed");
-                        exit(EXIT_FAILURE);
-                    }
-                    dup2(input_fd, STDIN_FILENO);
-                    close(input_fd);
+                if (apply_redirections(cmd) == -1) {
+                    exit(EXIT_FAILURE);
                 }
-                
-                // Handle output redirection
-                if (cmd->output_file)
-                {
-                    int output_fd;
-                    if (cmd->append_output)
-                    {
-                        output_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    }
-                    else
-                    {
-                        output_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    }
-                    if (output_fd == -1)
-                    {
-                        perror("Output redirection failed");
-                        exit(EXIT_FAILURE);
-                    }
-                    dup2(output_fd, STDOUT_FILENO);
-                    close(output_fd);
+                if (cmd->placement && apply_placement(0, cmd->placement) == -1) {
+                    _exit(EXIT_FAILURE);
                 }
                 
                 // Execute the builtin command
@@ -199,51 +372,125 @@ int execute_single_command(command_t *cmd)
     }
 
     // Not a builtin, execute as external command
-    return execute_external_command(cmd->args, cmd->input_file, cmd->output_file,
-                                    cmd->append_output, cmd->background);
+    return execute_external_command(cmd, cmd->background);
 }
 
 int execute_pipeline(pipeline_t *pipeline) {
+    pipeline_t expanded;
+
     if (pipeline == NULL || pipeline->num_commands == 0) {
         return 0;
     }
+    // A background job may have to wait until the system has room for it
+    if (pipeline->background) {
+        int queued = queue_background_pipeline(pipeline);
+        if (queued != 0) {
+            return queued == -1 ? 1 : 0;
+        }
+    }
+    // Run command substitutions into a per-line copy of the pipeline
+    if (pipeline_needs_expansion(pipeline)) {
+        if (expand_pipeline(pipeline, &expanded) == -1) {
+            return 1;
+        }
+        pipeline = &expanded;
+    }
 
     // If only one command, execute it directly
-    if (pipeline->num_commands == 1) {
+    if (pipeline->num_commands == 1 && pipeline->num_branches == 0) {
         command_t *cmd = &pipeline->commands[0];
         
+        // NAME=value alone sets shell variables
+        if (cmd->args[0] == NULL) {
+            return assign_variables(cmd);
+        }
+        
         // Check if it's a builtin command
-        if ((strcmp(cmd->args[0], "hop") == 0) || (strcmp(cmd->args[0], "reveal") == 0) || (strcmp(cmd->args[0], "activities") == 0)|| (strcmp(cmd->args[0], "ping") == 0) || (strcmp(cmd->args[0], "bg") == 0) || (strcmp(cmd->args[0], "fg") == 0)) {
+        if (is_builtin_command(cmd->args[0])) {
             // Built-in commands cannot run in background meaningfully
             if (pipeline->background) {
                 printf("Warning: Built-in command '%s' cannot run in background\n", cmd->args[0]);
             }
+            if (cmd->placement && cmd->num_redirections == 0) {
+                printf("Warning: Built-in command '%s' runs in the shell, placement ignored\n", cmd->args[0]);
+            }
             return execute_single_command(cmd);
         }
         
         // External command - pass background flag
-        return execute_external_command(cmd->args, cmd->input_file, cmd->output_file,
-                                       cmd->append_output, pipeline->background);
+        return execute_external_command(cmd, pipeline->background);
     }
 
-    // Multiple commands - create pipes (existing pipeline logic)
+    // Multiple commands.  Each pipe is made with O_CLOEXEC just before the
+    // stage that writes into it, and the shell only keeps its read end for
+    // the next stage, so a child closes at most three pipe ends whatever
+    // the length of the pipeline.
     // For background pipelines, the entire pipeline runs in background
-    int num_pipes = pipeline->num_commands - 1;
-    int pipes[num_pipes][2];
+    int last = pipeline->num_commands - 1;
     pid_t pids[pipeline->num_commands];
+    procsub_state_t subs[pipeline->num_commands];
+    builtin_stage_t stages[pipeline->num_commands];
+    int stage_fds[pipeline->num_commands][2];
+    int threaded[pipeline->num_commands];
     
-    // Create all pipes
-    for (int i = 0; i < num_pipes; i++) {
-        if (pipe(pipes[i]) == -1) {
-            perror("pipe failed");
+    // Builtins that only look at shell state, and cat/head/tail/wc when
+    // CSHELL_FASTPATH enables them, run on threads in the foreground; a
+    // background job has to be made of processes, and so does a stage
+    // redirecting more than stdin and stdout to files
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        command_t *cmd = &pipeline->commands[i];
+        threaded[i] = !pipeline->background && redirects_stdio_to_files(cmd) &&
+                      (builtin_runs_on_thread(cmd->args[0]) || fast_path_applies(cmd, i > 0));
+    }
+    
+    // Start process substitutions before the pipeline's own pipes exist,
+    // so their producers do not hold pipeline ends open
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        if (start_process_subs(&pipeline->commands[i], &subs[i]) == -1) {
+            for (int j = 0; j < i; j++) {
+                close_process_subs(&subs[j]);
+                reap_process_subs(&subs[j], 1);
+            }
             return 1;
         }
     }
     
+    int capture_fd = pipeline->background ? joblog_begin() : -1;
+
+    // A |+ fan-out: the last stage writes to fanout.input_fd
+    fanout_state_t fanout;
+    if (start_fanout(pipeline, capture_fd, &fanout) == -1) {
+        joblog_cancel();
+        for (int i = 0; i < pipeline->num_commands; i++) {
+            close_process_subs(&subs[i]);
+            reap_process_subs(&subs[i], 1);
+        }
+        return 1;
+    }
+    
     // Execute each command in the pipeline
+    int previous_read = -1;  // read end of the pipe into stage i
     for (int i = 0; i < pipeline->num_commands; i++) {
         command_t *cmd = &pipeline->commands[i];
+        int next[2] = { -1, -1 };
         
+        if (i < last && pipe2(next, O_CLOEXEC) == -1) {
+            perror("pipe failed");
+            if (previous_read != -1) close(previous_read);
+            joblog_cancel();
+            return 1;
+        }
+        
+        if (threaded[i]) {
+            // Started below, once every process is forked.  The ends are
+            // close-on-exec, so no exec'd stage keeps them.
+            pids[i] = 0;
+            stage_fds[i][0] = i == 0 ? STDIN_FILENO : previous_read;
+            stage_fds[i][1] = i < last ? next[1] : fanout.input_fd != -1 ? fanout.input_fd : STDOUT_FILENO;
+            open_stage_ends(cmd, stage_fds[i], fanout.input_fd);
+            previous_read = next[0];
+            continue;
+        }
         pids[i] = fork();
         
         if (pids[i] == 0) {
@@ -254,83 +501,117 @@ int execute_pipeline(pipeline_t *pipeline) {
                 freopen("/dev/null", "r", stdin);
             }
             
-            // Set up input redirection
-            if (i == 0) {
-                if (cmd->input_file) {
-                    int input_fd = open(cmd->input_file, O_RDONLY);
-                    if (input_fd == -1) {
-                        perror("Input redirection failed");
-                        exit(EXIT_FAILURE);
-                    }
-                    dup2(input_fd, STDIN_FILENO);
-                    close(input_fd);
-                }
-            } else {
-                dup2(pipes[i-1][0], STDIN_FILENO);
+            // Connect the pipes; the command's own redirections override
+            // them below
+            if (i > 0) {
+                dup2(previous_read, STDIN_FILENO);
+                close(previous_read);
             }
-            
-            // Set up output redirection
-            if (i == pipeline->num_commands - 1) {
-                if (cmd->output_file) {
-                    int output_fd;
-                    if (cmd->append_output) {
-                        output_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    } else {
-                        output_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    }
-                    if (output_fd == -1) {
-                        perror("Output redirection failed");
-                        exit(EXIT_FAILURE);
-                    }
-                    dup2(output_fd, STDOUT_FILENO);
-                    close(output_fd);
+            if (i == last) {
+                redirect_to_capture(capture_fd);
+                if (fanout.input_fd != -1) {
+                    dup2(fanout.input_fd, STDOUT_FILENO);
                 }
             } else {
-                dup2(pipes[i][1], STDOUT_FILENO);
+                dup2(next[1], STDOUT_FILENO);
+                close(next[0]);
+                close(next[1]);
+                if (capture_fd != -1) {
+                    dup2(capture_fd, STDERR_FILENO);
+                    close(capture_fd);
+                }
             }
-            
-            // Close all pipe file descriptors in child
-            for (int j = 0; j < num_pipes; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
+            close_fanout_input(&fanout);
+            attach_process_subs(cmd, &subs[i]);
+            if (cmd->placement && apply_placement(0, cmd->placement) == -1) {
+                _exit(EXIT_FAILURE);
             }
             
-            // Execute the command
-            if (strcmp(cmd->args[0], "hop") == 0 || strcmp(cmd->args[0], "reveal") == 0) {
+            // Execute the command.  Its redirections come after
+            // close_inherited_fds(), which would close those above stderr.
+            int external = cmd->args[0] != NULL && !is_builtin_command(cmd->args[0]);
+            if (external) {
+                close_inherited_fds(&subs[i]);
+            }
+            if (apply_redirections(cmd) == -1) {
+                exit(EXIT_FAILURE);
+            }
+            if (cmd->args[0] == NULL) {
+                exit(0); // A substitution expanded to nothing
+            }
+            if (!external) {
                 int result = execute_builtin_command(cmd->argc, cmd->args);
+                fflush(stdout);
                 exit(result);
             } else {
+                environ = command_environment(cmd);
                 if (execvp(cmd->args[0], cmd->args) == -1) {
-                    fprintf(stderr, "%s: command not found\n", cmd->args[0]);
+                    fprintf(stderr, "%s: %s\n", cmd->args[0], errno == ENOENT ? "command not found" : strerror(errno));
                     exit(EXIT_FAILURE);
                 }
             }
         } else if (pids[i] < 0) {
             perror("fork failed");
+            if (previous_read != -1) close(previous_read);
+            if (next[0] != -1) {
+                close(next[0]);
+                close(next[1]);
+            }
+            joblog_cancel();
             return 1;
         }
+        
+        // Parent process - only the read end for the next stage stays
+        if (previous_read != -1) close(previous_read);
+        if (next[1] != -1) close(next[1]);
+        previous_read = next[0];
     }
     
-    // Parent process - close all pipe file descriptors
-    for (int i = 0; i < num_pipes; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        if (threaded[i]) {
+            start_builtin_stage(&stages[i], &pipeline->commands[i], stage_fds[i][0], stage_fds[i][1]);
+        }
+    }
+    close_fanout_input(&fanout);
+    for (int i = 0; i < pipeline->num_commands; i++) {
+        if (!threaded[i]) close_process_subs(&subs[i]);
     }
     
     if (pipeline->background) {
         // For background pipeline, add the first process to job list
         // (or you could track the entire pipeline)
-        add_background_job(pids[0], get_command_name(pipeline->commands[0].args));
+        int job_id = add_background_job(pids[0], get_command_name(pipeline->commands[0].args));
+        joblog_attach(job_id, get_command_name(pipeline->commands[0].args));
+        for (int i = 0; i < pipeline->num_commands; i++) {
+            reap_process_subs(&subs[i], 0);
+        }
+        finish_fanout(&fanout, 0);
         return 0;
     } else {
-        // Wait for all child processes
+        // Wait for all child processes, then for the builtin threads
         int status, last_status = 0;
         for (int i = 0; i < pipeline->num_commands; i++) {
+            if (threaded[i]) continue;
             waitpid(pids[i], &status, 0);
-            if (i == pipeline->num_commands - 1) {
+            if (i == last) {
                 last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
             }
         }
+        for (int i = 0; i < pipeline->num_commands; i++) {
+            if (!threaded[i]) continue;
+            int stage_status = finish_builtin_stage(&stages[i]);
+            close_process_subs(&subs[i]);
+            if (i == last) {
+                last_status = stage_status;
+            }
+        }
+        for (int i = 0; i < pipeline->num_commands; i++) {
+            reap_process_subs(&subs[i], 1);
+        }
+        // With a fan-out, the last consumer counts as the last command
+        if (pipeline->num_branches > 0) {
+            last_status = finish_fanout(&fanout, 1);
+        }
         return last_status;
     }
 }
@@ -340,48 +621,98 @@ int execute_pipeline(pipeline_t *pipeline) {
 // }
 
 // Main shell execution function
-// Updated main shell execution function
+// Parsing (validation, tokenizing and building the pipelines) goes through
+// the parse cache, so a line seen before runs straight from its cached form.
 int execute_command_line(char *input_line) {
-    token_t tokens[MAX_TOKENS];
-    
-    // Tokenize the input
-    int token_count = tokenize(input_line, tokens);
-    if (token_count == 0) {
-        return 0;
+    // if/while/until/for/case blocks are compiled and run by control.c
+    if (control_is_block(input_line)) {
+        return last_exit_status = control_execute(input_line);
     }
-    
-    // Check if input contains semicolons (command sequence)
-    int has_semicolon = 0;
-    for (int i = 0; i < token_count; i++) {
-        if (tokens[i].type == TOKEN_SEMICOLON) {
-            has_semicolon = 1;
-            break;
-        }
+
+    parse_cache_entry_t *parsed = parse_cache_acquire(input_line);
+    if (parsed == NULL) {
+        return last_exit_status = 1;
     }
-    
-    if (has_semicolon) {
-        // Parse and execute as command sequence
-        command_sequence_t sequence;
-        if (parse_command_sequence(tokens, &sequence)) {
-            int result = execute_command_sequence(&sequence);
-            free_command_sequence(&sequence);
-            return result;
-        } else {
-            printf("Parse error in command sequence\n");
-            return 1;
-        }
+    return execute_parsed_line(parsed);
+}
+
+// Run a line already parsed by parse_cache_acquire() and release it
+int execute_parsed_line(parse_cache_entry_t *parsed) {
+    reset_expansions();
+
+    int result;
+    if (parsed->is_sequence) {
+        // Command sequence separated by semicolons
+        result = execute_command_sequence(&parsed->sequence);
     } else {
-        // Single pipeline - use existing logic
-        pipeline_t pipeline;
-        if (parse_pipeline(tokens, &pipeline)) {
-            int result = execute_pipeline(&pipeline);
-            free_pipeline(&pipeline);
-            return result;
-        } else {
-            printf("Parse error\n");
+        // Single pipeline
+        result = execute_pipeline(&parsed->sequence.pipelines[0]);
+    }
+
+    parse_cache_release(parsed);
+    return last_exit_status = result;
+}
+
+// Replace the shell with pipeline's command if it is a single external
+// command in the foreground; otherwise run it as usual.  Returns only if
+// the command was not exec'd, or could not be.
+static int exec_in_place(pipeline_t *pipeline) {
+    pipeline_t expanded;
+
+    if (pipeline->num_commands != 1 || pipeline->num_branches > 0 || pipeline->background ||
+        pipeline->commands[0].num_subs > 0) {
+        return execute_pipeline(pipeline);  // needs the shell to stay around
+    }
+    if (pipeline_needs_expansion(pipeline)) {
+        if (expand_pipeline(pipeline, &expanded) == -1) {
             return 1;
         }
+        pipeline = &expanded;
     }
+    command_t *cmd = &pipeline->commands[0];
+    if (cmd->args[0] == NULL || is_builtin_command(cmd->args[0])) {
+        return execute_single_command(cmd);
+    }
+
+    // Same setup as a forked child, minus the fork: the command keeps the
+    // shell's pid and process group
+    fflush(stdout);
+    fflush(stderr);
+    if (cmd->placement && apply_placement(0, cmd->placement) == -1) {
+        return 1;
+    }
+    if (apply_redirections(cmd) == -1) {
+        return 1;
+    }
+    environ = command_environment(cmd);
+    execvp(cmd->args[0], cmd->args);
+    fprintf(stderr, "%s: %s\n", cmd->args[0], errno == ENOENT ? "command not found" : strerror(errno));
+    return 1;
+}
+
+// Run input_line as the last thing the shell does (shell.out -c).  Like
+// execute_command_line(), except that the final pipeline is exec'd in
+// place when it is a single external command.
+int execute_final_command_line(char *input_line) {
+    if (control_is_block(input_line)) {
+        return last_exit_status = control_execute(input_line);
+    }
+
+    parse_cache_entry_t *parsed = parse_cache_acquire(input_line);
+    if (parsed == NULL) {
+        return last_exit_status = 1;
+    }
+    reset_expansions();
+
+    command_sequence_t *sequence = &parsed->sequence;
+    int count = parsed->is_sequence ? sequence->num_pipelines : 1;
+    for (int i = 0; i < count - 1; i++) {
+        last_exit_status = execute_pipeline(&sequence->pipelines[i]);
+    }
+    int result = exec_in_place(&sequence->pipelines[count - 1]);
+
+    parse_cache_release(parsed);
+    return last_exit_status = result;
 }
 
 // Execute a sequence of commands separated by semicolons
@@ -390,8 +721,6 @@ int execute_command_sequence(command_sequence_t *sequence) {
         return 0;
     }
     
-    int last_exit_status = 0;
-    
     // Execute each pipeline in sequence
     for (int i = 0; i < sequence->num_pipelines; i++) {
         pipeline_t *pipeline = &sequence->pipelines[i];
@@ -411,17 +740,18 @@ int execute_command_sequence(command_sequence_t *sequence) {
 
 // Enhanced main shell loop
 
-// Enhanced command parsing to handle multiple input redirections
-// (Only the last input redirection takes effect)
+// Enhanced command parsing to handle multiple redirections
 int parse_command_with_multiple_redirections(token_t tokens[], int *token_index, command_t *cmd)
 {
     init_command(cmd);
 
     while (tokens[*token_index].type != TOKEN_EOF &&
            tokens[*token_index].type != TOKEN_PIPE &&
+           tokens[*token_index].type != TOKEN_FANOUT &&
            tokens[*token_index].type != TOKEN_SEMICOLON &&
            tokens[*token_index].type != TOKEN_AND &&
-           tokens[*token_index].type != TOKEN_OR)
+           tokens[*token_index].type != TOKEN_OR &&
+           tokens[*token_index].type != TOKEN_BACKGROUND)
     {
 
         token_t *current = &tokens[*token_index];
@@ -429,80 +759,36 @@ int parse_command_with_multiple_redirections(token_t tokens[], int *token_index,
         switch (current->type)
         {
         case TOKEN_WORD:
-            if (cmd->argc < MAX_TOKENS - 1)
-            {
-                cmd->args[cmd->argc] = malloc(strlen(current->value) + 1);
-                strcpy(cmd->args[cmd->argc], current->value);
-                cmd->argc++;
-            }
+            command_add_word(cmd, current);
             break;
 
-        case TOKEN_REDIRECT_IN:
-            (*token_index)++;
-            if (tokens[*token_index].type == TOKEN_WORD)
-            {
-                // Free previous input file if exists (multiple redirections)
-                if (cmd->input_file)
-                {
-                    free(cmd->input_file);
-                }
-                // Set the new input file (last one takes effect)
-                cmd->input_file = malloc(strlen(tokens[*token_index].value) + 1);
-                strcpy(cmd->input_file, tokens[*token_index].value);
-            }
+        case TOKEN_PROCSUB_IN:
+        case TOKEN_PROCSUB_OUT:
+            command_add_process_sub(cmd, current);
             break;
 
+        case TOKEN_REDIRECT_IN:
         case TOKEN_REDIRECT_OUT:
-            (*token_index)++;
-            if (tokens[*token_index].type == TOKEN_WORD)
-            {
-                // Create the intermediate file (even if it won't receive output)
-                if (cmd->output_file) {
-                    // Create/truncate the previous output file
-                    int temp_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (temp_fd != -1) {
-                        close(temp_fd);
-                    }
-                    free(cmd->output_file);
-                }
-                
-                // Set the new output file (this will be the final destination)
-                cmd->output_file = malloc(strlen(tokens[*token_index].value) + 1);
-                strcpy(cmd->output_file, tokens[*token_index].value);
-                cmd->append_output = 0;
-            }
-            break;
-
         case TOKEN_REDIRECT_APPEND:
+        case TOKEN_REDIRECT_READ_WRITE:
+        case TOKEN_DUP_IN:
+        case TOKEN_DUP_OUT:
+        case TOKEN_REDIRECT_ALL:
+        case TOKEN_APPEND_ALL:
+        case TOKEN_HEREDOC:
+        case TOKEN_HERESTRING:
+            // Kept in order and carried out when the command starts, so
+            // intermediate files are created on every run
             (*token_index)++;
-            if (tokens[*token_index].type == TOKEN_WORD)
+            if ((tokens[*token_index].type == TOKEN_WORD ||
+                 tokens[*token_index].type == TOKEN_PROCSUB_IN ||
+                 tokens[*token_index].type == TOKEN_PROCSUB_OUT) &&
+                command_add_redirection(cmd, current, &tokens[*token_index]) == -1)
             {
-                // Create the intermediate file (even if it won't receive output)
-                if (cmd->output_file) {
-                    // For previous file, create it based on the previous append_output flag
-                    int temp_fd;
-                    if (cmd->append_output) {
-                        temp_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    } else {
-                        temp_fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    }
-                    if (temp_fd != -1) {
-                        close(temp_fd);
-                    }
-                    free(cmd->output_file);
-                }
-                
-                // Set the new output file (this will be the final destination)
-                cmd->output_file = malloc(strlen(tokens[*token_index].value) + 1);
-                strcpy(cmd->output_file, tokens[*token_index].value);
-                cmd->append_output = 1;
+                return 0; // Parse error: the line is not run
             }
             break;
 
-        case TOKEN_BACKGROUND:
-            cmd->background = 1;
-            break;
-
         default:
             break;
         }
@@ -510,10 +796,8 @@ int parse_command_with_multiple_redirections(token_t tokens[], int *token_index,
         (*token_index)++;
     }
 
-    // Null-terminate the args array
-    cmd->args[cmd->argc] = NULL;
-
-    return (cmd->argc > 0) ? 1 : 0;
+    command_take_placement(cmd);
+    return (cmd->argc > 0 || cmd->num_assignments > 0) ? 1 : 0;
 }
 
 // LLM CODE ENDS
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include "jobs.h"
+#include "dirscan.h"
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+// CPU affinity, nice value and I/O priority for commands and jobs.
+//
+//   place [-c cpus] [-n nice] [-i class[:level]] command [args...]
+//   place [-c cpus] [-n nice] [-i class[:level]] %job
+//
+// The first form is taken apart by the parser (command_take_placement())
+// and applied in the child between fork and exec, so a pipeline stage can
+// be pinned on its own.  The second re-places a running job, every
+// process and thread in its process group included.
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_WHO_PGRP 2
+
+static const char *ioprio_classes[] = { "none", "rt", "be", "idle" };
+
+static int ioprio_set(int which, int who, int ioprio) {
+    return (int)syscall(SYS_ioprio_set, which, who, ioprio);
+}
+
+static int ioprio_get(int which, int who) {
+    return (int)syscall(SYS_ioprio_get, which, who);
+}
+
+// "0-3,8,10-11"
+static int parse_cpu_list(const char *text, unsigned char *cpus) {
+    const char *p = text;
+    int any = 0;
+
+    memset(cpus, 0, PLACEMENT_MAX_CPUS / 8);
+    while (*p) {
+        char *end;
+        long low = strtol(p, &end, 10);
+        long high = low;
+        if (end == p || low < 0) return 0;
+        if (*end == '-') {
+            p = end + 1;
+            high = strtol(p, &end, 10);
+            if (end == p || high < low) return 0;
+        }
+        if (high >= PLACEMENT_MAX_CPUS) return 0;
+        for (long cpu = low; cpu <= high; cpu++) {
+            cpus[cpu / 8] |= (unsigned char)(1u << (cpu % 8));
+            any = 1;
+        }
+        if (*end == ',') end++;
+        else if (*end != '\0') return 0;
+        p = end;
+    }
+    return any;
+}
+
+// "idle", "be:4", "rt:0" or "none"
+static int parse_ioprio(const char *text, int *ioprio) {
+    const char *colon = strchr(text, ':');
+    size_t length = colon ? (size_t)(colon - text) : strlen(text);
+    long level = 0;
+
+    for (int class = 0; class < 4; class++) {
+        if (strlen(ioprio_classes[class]) != length ||
+            strncmp(text, ioprio_classes[class], length) != 0) {
+            continue;
+        }
+        if (colon != NULL) {
+            char *end;
+            level = strtol(colon + 1, &end, 10);
+            if (*end != '\0' || level < 0 || level > 7) return 0;
+        }
+        *ioprio = (class << IOPRIO_CLASS_SHIFT) | (int)level;
+        return 1;
+    }
+    return 0;
+}
+
+// Parse the options after argv[0] into placement.  Returns the index of
+// the first operand, or -1 on a bad option (reported when report is set).
+int parse_placement(int argc, char *argv[], placement_t *placement, int report) {
+    int i = 1;
+
+    memset(placement, 0, sizeof(*placement));
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char *option = argv[i];
+        const char *value;
+
+        if (strcmp(option, "--") == 0) {
+            return i + 1;
+        }
+        if (option[2] != '\0') {
+            value = option + 2;       // -c0-3
+        } else if (i + 1 < argc) {
+            value = argv[++i];        // -c 0-3
+        } else {
+            if (report) printf("place: option %s needs a value\n", option);
+            return -1;
+        }
+
+        char *end;
+        switch (option[1]) {
+            case 'c':
+                if (!parse_cpu_list(value, placement->cpus)) {
+                    if (report) printf("place: invalid CPU list: %s\n", value);
+                    return -1;
+                }
+                placement->has_cpus = 1;
+                break;
+            case 'n':
+                placement->nice = (int)strtol(value, &end, 10);
+                if (*end != '\0' || placement->nice < -20 || placement->nice > 19) {
+                    if (report) printf("place: invalid nice value: %s\n", value);
+                    return -1;
+                }
+                placement->has_nice = 1;
+                break;
+            case 'i':
+                if (!parse_ioprio(value, &placement->ioprio)) {
+                    if (report) printf("place: invalid I/O class: %s\n", value);
+                    return -1;
+                }
+                placement->has_ioprio = 1;
+                break;
+            default:
+                if (report) printf("place: unknown option: %s\n", option);
+                return -1;
+        }
+    }
+    return i;
+}
+
+static void to_cpu_set(const unsigned char *cpus, cpu_set_t *set) {
+    CPU_ZERO(set);
+    for (int cpu = 0; cpu < PLACEMENT_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (cpus[cpu / 8] & (1u << (cpu % 8))) {
+            CPU_SET(cpu, set);
+        }
+    }
+}
+
+// Apply placement to one process (0 for the caller).  Returns -1 after
+// reporting the first failure.
+int apply_placement(pid_t pid, const placement_t *placement) {
+    if (placement->has_cpus) {
+        cpu_set_t set;
+        to_cpu_set(placement->cpus, &set);
+        if (sched_setaffinity(pid, sizeof(set), &set) == -1) {
+            perror("place: sched_setaffinity");
+            return -1;
+        }
+    }
+    if (placement->has_nice && setpriority(PRIO_PROCESS, pid, placement->nice) == -1) {
+        perror("place: setpriority");
+        return -1;
+    }
+    if (placement->has_ioprio && ioprio_set(IOPRIO_WHO_PROCESS, pid, placement->ioprio) == -1) {
+        perror("place: ioprio_set");
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    pid_t pgid;
+    cpu_set_t set;
+    int failed;
+} group_affinity_t;
+
+static int set_thread_affinity(const dirscan_entry_t *entry, void *context) {
+    group_affinity_t *group = context;
+    pid_t tid = (pid_t)strtol(entry->name, NULL, 10);
+
+    if (tid > 0 && sched_setaffinity(tid, sizeof(group->set), &group->set) == -1 &&
+        errno != ESRCH) {
+        group->failed = 1;
+    }
+    return 1;
+}
+
+// Affinity is per thread, so walk /proc for every thread in the group
+static int set_group_member_affinity(const dirscan_entry_t *entry, void *context) {
+    group_affinity_t *group = context;
+    char path[64], stat[512];
+
+    if (!isdigit((unsigned char)entry->name[0])) {
+        return 1;
+    }
+    snprintf(path, sizeof(path), "/proc/%s/stat", entry->name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 1;
+    }
+    ssize_t n = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 1;
+    }
+    stat[n] = '\0';
+
+    // pid (comm) state ppid pgrp ...; comm may contain spaces or parens
+    char state;
+    int ppid, pgrp;
+    char *rest = strrchr(stat, ')');
+    if (rest == NULL || sscanf(rest + 1, " %c %d %d", &state, &ppid, &pgrp) != 3 ||
+        pgrp != group->pgid) {
+        return 1;
+    }
+    snprintf(path, sizeof(path), "/proc/%s/task", entry->name);
+    dirscan(path, set_thread_affinity, group);
+    return 1;
+}
+
+// Apply placement to a job: its whole process group when the job leads
+// one, otherwise just its process
+static int apply_placement_to_job(pid_t pid, const placement_t *placement) {
+    if (getpgid(pid) != pid) {
+        return apply_placement(pid, placement);
+    }
+
+    if (placement->has_cpus) {
+        group_affinity_t group;
+        group.pgid = pid;
+        group.failed = 0;
+        to_cpu_set(placement->cpus, &group.set);
+        dirscan("/proc", set_group_member_affinity, &group);
+        if (group.failed) {
+            printf("place: could not set the affinity of every thread in the job\n");
+            return -1;
+        }
+    }
+    if (placement->has_nice && setpriority(PRIO_PGRP, pid, placement->nice) == -1) {
+        perror("place: setpriority");
+        return -1;
+    }
+    if (placement->has_ioprio && ioprio_set(IOPRIO_WHO_PGRP, pid, placement->ioprio) == -1) {
+        perror("place: ioprio_set");
+        return -1;
+    }
+    return 0;
+}
+
+// Append "0-3,8" style text for set to buffer
+static size_t format_cpu_set(const cpu_set_t *set, char *buffer, size_t size) {
+    size_t used = 0;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && used < size; cpu++) {
+        if (!CPU_ISSET(cpu, set)) continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) last++;
+        int n = last > cpu ? snprintf(buffer + used, size - used, "%s%d-%d", used ? "," : "", cpu, last)
+                           : snprintf(buffer + used, size - used, "%s%d", used ? "," : "", cpu);
+        used += n > 0 ? (size_t)n : 0;
+        cpu = last;
+    }
+    return used < size ? used : size - 1;
+}
+
+// Describe how pid is placed where that differs from the shell itself,
+// e.g. "cpus 0-3, nice 10, io idle".  Returns the length, 0 for none.
+int describe_placement(pid_t pid, char *buffer, size_t size) {
+    cpu_set_t mine, theirs;
+    size_t used = 0;
+
+    buffer[0] = '\0';
+    if (sched_getaffinity(0, sizeof(mine), &mine) == 0 &&
+        sched_getaffinity(pid, sizeof(theirs), &theirs) == 0 && !CPU_EQUAL(&mine, &theirs)) {
+        used += snprintf(buffer + used, size - used, "cpus ");
+        used += format_cpu_set(&theirs, buffer + used, size - used);
+    }
+
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, pid);
+    if (errno == 0 && nice != getpriority(PRIO_PROCESS, 0) && used < size) {
+        used += snprintf(buffer + used, size - used, "%snice %d", used ? ", " : "", nice);
+    }
+
+    int ioprio = ioprio_get(IOPRIO_WHO_PROCESS, pid);
+    if (ioprio != -1 && ioprio != ioprio_get(IOPRIO_WHO_PROCESS, 0) && used < size) {
+        int class = (ioprio >> IOPRIO_CLASS_SHIFT) & 3;
+        if (class == 3 || class == 0) {
+            used += snprintf(buffer + used, size - used, "%sio %s", used ? ", " : "",
+                             ioprio_classes[class]);
+        } else {
+            used += snprintf(buffer + used, size - used, "%sio %s:%d", used ? ", " : "",
+                             ioprio_classes[class], ioprio & 7);
+        }
+    }
+    return used < size ? (int)used : (int)size - 1;
+}
+
+// place [options] %job: change or show a running job's placement.  A
+// command after the options only gets here when the parser could not take
+// the placement apart, i.e. when the options are invalid.
+int place_command(int argc, char *argv[]) {
+    placement_t placement;
+    int first = parse_placement(argc, argv, &placement, 1);
+
+    if (first == -1) {
+        return 1;
+    }
+    if (first != argc - 1 || argv[first][0] != '%') {
+        printf("Usage: place [-c cpus] [-n nice] [-i class[:level]] command [args...]\n");
+        printf("       place [-c cpus] [-n nice] [-i class[:level]] %%job\n");
+        return 1;
+    }
+
+    char *end;
+    int job_id = (int)strtol(argv[first] + 1, &end, 10);
+    job_t *job = (*end == '\0' && job_id > 0) ? find_job_by_id(job_id) : NULL;
+    if (job == NULL) {
+        printf("No such job\n");
+        return 1;
+    }
+    if (job->state == JOB_QUEUED) {
+        printf("Job %d has not started yet\n", job->job_id);
+        return 1;
+    }
+
+    if ((placement.has_cpus || placement.has_nice || placement.has_ioprio) &&
+        apply_placement_to_job(job->pid, &placement) == -1) {
+        return 1;
+    }
+
+    char description[256];
+    describe_placement(job->pid, description, sizeof(description));
+    printf("[%d] %s: %s\n", job->job_id, job->command_name,
+           description[0] ? description : "default placement");
+    return 0;
+}
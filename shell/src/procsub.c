@@ -0,0 +1,130 @@
+#include "procsub.h"
+#include "pipes.h"
+
+// Process substitution: <(command) and >(command).
+//
+// Before the command is forked, each substitution gets a pipe and a
+// producer process running the inner command line with its stdout (or,
+// for >(...), its stdin) on the far end.  The command inherits the near
+// end and sees it as /dev/fd/N in place of the argument, or as the
+// descriptor a redirection such as "2> >(logger)" names.
+
+// Near ends currently open in the shell.  Producers and unrelated
+// pipeline stages close them so that end-of-file is not held up.
+static int open_fds[MAX_PIPELINE_COMMANDS * MAX_PROCESS_SUBS];
+static int open_fd_count = 0;
+
+static void forget_fd(int fd) {
+    for (int i = 0; i < open_fd_count; i++) {
+        if (open_fds[i] == fd) {
+            open_fds[i] = open_fds[--open_fd_count];
+            return;
+        }
+    }
+}
+
+// Close every near end except those in keep (child side)
+static void close_foreign_fds(const procsub_state_t *keep) {
+    for (int i = 0; i < open_fd_count; i++) {
+        int mine = 0;
+        for (int j = 0; keep && j < keep->count; j++) {
+            if (keep->fds[j] == open_fds[i]) mine = 1;
+        }
+        if (!mine) close(open_fds[i]);
+    }
+}
+
+// Close every near end (child side, in processes that take none of them)
+void close_all_process_subs() {
+    close_foreign_fds(NULL);
+}
+
+// Create the pipes and producers for cmd.  Returns 0 on success; on
+// failure everything started so far is cleaned up and -1 is returned.
+int start_process_subs(const command_t *cmd, procsub_state_t *state) {
+    state->count = 0;
+
+    for (int i = 0; i < cmd->num_subs; i++) {
+        const process_sub_t *sub = &cmd->subs[i];
+        int fds[2];
+
+        if (pipe(fds) == -1) {
+            perror("Process substitution failed");
+            close_process_subs(state);
+            reap_process_subs(state, 1);
+            return -1;
+        }
+        // fds[0] is read by whoever consumes the data
+        int near = sub->output ? fds[1] : fds[0];
+        int far = sub->output ? fds[0] : fds[1];
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTSTP, SIG_DFL);
+            close_foreign_fds(NULL);
+            dup2(far, sub->output ? STDIN_FILENO : STDOUT_FILENO);
+            close(far);
+            close(near);
+            int status = execute_command_line(sub->command);
+            fflush(stdout);
+            exit(status);
+        } else if (pid < 0) {
+            perror("fork failed");
+            close(near);
+            close(far);
+            close_process_subs(state);
+            reap_process_subs(state, 1);
+            return -1;
+        }
+
+        close(far);
+        state->pids[state->count] = pid;
+        state->fds[state->count] = near;
+        state->count++;
+        open_fds[open_fd_count++] = near;
+    }
+    return 0;
+}
+
+// Replace the substituted arguments with their /dev/fd paths, point the
+// redirections into or out of a substitution at its near end, and drop
+// near ends that belong to other commands (child side, before the
+// redirections are applied)
+void attach_process_subs(command_t *cmd, const procsub_state_t *state) {
+    static char paths[MAX_PROCESS_SUBS][32];
+
+    close_foreign_fds(state);
+    for (int i = 0; i < state->count; i++) {
+        if (cmd->subs[i].redirection >= 0) {
+            cmd->redirections[cmd->subs[i].redirection].source_fd = state->fds[i];
+            continue;
+        }
+        snprintf(paths[i], sizeof(paths[i]), "/dev/fd/%d", state->fds[i]);
+        cmd->args[cmd->subs[i].arg_index] = paths[i];
+    }
+}
+
+// The command has been forked: the shell's copies of the near ends go
+void close_process_subs(procsub_state_t *state) {
+    for (int i = 0; i < state->count; i++) {
+        if (state->fds[i] != -1) {
+            forget_fd(state->fds[i]);
+            close(state->fds[i]);
+            state->fds[i] = -1;
+        }
+    }
+}
+
+// Wait for the producers now, or leave them to the job system when the
+// command itself was not waited for (background or stopped)
+void reap_process_subs(procsub_state_t *state, int wait_now) {
+    for (int i = 0; i < state->count; i++) {
+        if (wait_now) {
+            waitpid(state->pids[i], NULL, 0);
+        } else {
+            add_job_helper(state->pids[i]);
+        }
+    }
+    state->count = 0;
+}
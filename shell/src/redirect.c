@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include "redirect.h"
+#include "heredoc.h"
+
+// Carrying out a command's redirections.
+//
+// The redirections are first run through on paper.  Starting from "every
+// descriptor is what the command inherited", each one changes what one
+// descriptor will refer to: a file it opens, whatever another descriptor
+// refers to at that point (n>&m), or nothing (n>&-).  What is left is one
+// move per descriptor whose final state differs from the inherited one.
+// A redirection that a later one overrides still opens its file, since
+// that creates or truncates it (or fails), but it costs no dup2().
+//
+// The files are then opened close-on-exec, and the moves are ordered so
+// that no descriptor is overwritten while another move still copies from
+// it; a cycle (3>&1 1>&2 2>&3 3>&-) parks one descriptor out of the way.
+// ">file" comes down to open() and dup2(), and ">file 2>&1" to one more
+// dup2().  The opened descriptors need no close(): exec closes them.
+
+// What a move's descriptor ends up referring to, before anything is
+// opened: an inherited descriptor (>= 0), nothing, or the file of
+// redirection r as FILE_SOURCE(r) (the macro is its own inverse)
+#define SOURCE_CLOSED (-1)
+#define FILE_SOURCE(r) (-2 - (r))
+
+typedef struct {
+    int fd;
+    int source;
+    int fresh;               // source was opened (close-on-exec) for this command
+} move_t;
+
+static int current_source(const move_t moves[], int count, int fd) {
+    for (int i = 0; i < count; i++) {
+        if (moves[i].fd == fd) return moves[i].source;
+    }
+    return fd;
+}
+
+// Run through cmd's redirections on paper.  Returns the number of moves.
+static int resolve(const command_t *cmd, move_t moves[]) {
+    int count = 0;
+
+    for (int r = 0; r < cmd->num_redirections; r++) {
+        const redirection_t *redirection = &cmd->redirections[r];
+        int source = FILE_SOURCE(r);
+        int i = 0;
+
+        if (redirection->type == REDIRECT_DUP) {
+            source = current_source(moves, count, redirection->source_fd);
+        } else if (redirection->type == REDIRECT_CLOSE) {
+            source = SOURCE_CLOSED;
+        }
+        while (i < count && moves[i].fd != redirection->fd) i++;
+        if (i == count) {
+            moves[count++].fd = redirection->fd;
+        }
+        moves[i].source = source;
+    }
+
+    // 2>&2, or 1>&2 2>&1 once 1 is back: nothing to do
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (moves[i].source != moves[i].fd) moves[kept++] = moves[i];
+    }
+    return kept;
+}
+
+static int open_redirection(const redirection_t *redirection) {
+    switch (redirection->type) {
+        case REDIRECT_READ:
+            return open(redirection->target, O_RDONLY | O_CLOEXEC);
+        case REDIRECT_WRITE:
+            return open(redirection->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        case REDIRECT_APPEND:
+            return open(redirection->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        case REDIRECT_READ_WRITE:
+            return open(redirection->target, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        case REDIRECT_TEXT:
+            return heredoc_open(redirection->target, redirection->length);
+        default:
+            return -1;
+    }
+}
+
+// Open the file of every redirection that has one into opened[] (-1 for
+// the others), in order.  On failure, report it, close what was opened and
+// return -1.
+static int open_files(const command_t *cmd, int opened[]) {
+    for (int r = 0; r < cmd->num_redirections; r++) {
+        const redirection_t *redirection = &cmd->redirections[r];
+
+        opened[r] = -1;
+        if (redirection->type == REDIRECT_DUP || redirection->type == REDIRECT_CLOSE) {
+            continue;
+        }
+        opened[r] = open_redirection(redirection);
+        if (opened[r] == -1) {
+            perror(redirection->type == REDIRECT_TEXT ? "Here-document failed" : redirection->target);
+            while (r-- > 0) {
+                if (opened[r] != -1) close(opened[r]);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Whether a move other than moves[skip] still copies from fd
+static int still_read(const move_t moves[], int count, int fd, int skip) {
+    for (int i = 0; i < count; i++) {
+        if (i != skip && moves[i].source == fd) return 1;
+    }
+    return 0;
+}
+
+// Carry out moves whose sources are now descriptors (or SOURCE_CLOSED)
+static int run_moves(move_t moves[], int count) {
+    while (count > 0) {
+        int done = 0;
+
+        for (int i = 0; i < count;) {
+            move_t *move = &moves[i];
+            int result = 0;
+
+            if (still_read(moves, count, move->fd, i)) {
+                i++;
+                continue;
+            }
+            if (move->source == SOURCE_CLOSED) {
+                close(move->fd);
+            } else if (move->source != move->fd) {
+                result = dup2(move->source, move->fd);
+            } else if (move->fresh) {
+                result = fcntl(move->fd, F_SETFD, 0);  // opened right where it belongs
+            }
+            if (result == -1) {
+                fprintf(stderr, "%d: %s\n", move->source, strerror(errno));
+                return -1;
+            }
+            moves[i] = moves[--count];
+            done = 1;
+        }
+        if (!done) {
+            // Every descriptor left is still to be copied from: a cycle
+            int parked = fcntl(moves[0].fd, F_DUPFD_CLOEXEC, REDIRECT_PARK_FD);
+            if (parked == -1) {
+                fprintf(stderr, "%d: %s\n", moves[0].fd, strerror(errno));
+                return -1;
+            }
+            for (int i = 0; i < count; i++) {
+                if (moves[i].source == moves[0].fd) moves[i].source = parked;
+            }
+        }
+    }
+    return 0;
+}
+
+// Carry out cmd's redirections on the calling process's descriptors
+// (child side, or the shell just before exec).  Returns -1 after reporting
+// an error.
+int apply_redirections(const command_t *cmd) {
+    move_t moves[MAX_REDIRECTIONS];
+    int opened[MAX_REDIRECTIONS];
+
+    if (cmd->num_redirections == 0) {
+        return 0;
+    }
+    int count = resolve(cmd, moves);
+    if (open_files(cmd, opened) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        moves[i].fresh = moves[i].source < SOURCE_CLOSED;
+        if (moves[i].fresh) {
+            moves[i].source = opened[FILE_SOURCE(moves[i].source)];
+        }
+    }
+    return run_moves(moves, count);
+}
+
+// Work out what stdin, stdout and stderr become for a command started
+// with fds[0..2] as its descriptors, opening the files in the shell (for
+// a spawn that takes three descriptors).  Returns 1, having opened
+// nothing, if the redirections touch other descriptors or close one; -1
+// after reporting an error; else 0, with fds updated.  Files in fds are
+// the caller's to close (see close_standard_fds()).
+int redirect_standard_fds(const command_t *cmd, int fds[3]) {
+    move_t moves[MAX_REDIRECTIONS];
+    int opened[MAX_REDIRECTIONS];
+    int base[3] = { fds[0], fds[1], fds[2] };
+    int count = resolve(cmd, moves);
+
+    for (int i = 0; i < count; i++) {
+        if (moves[i].fd > STDERR_FILENO || moves[i].source == SOURCE_CLOSED ||
+            moves[i].source > STDERR_FILENO) {
+            return 1;
+        }
+    }
+    if (open_files(cmd, opened) == -1) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        int source = moves[i].source;
+        fds[moves[i].fd] = source >= 0 ? base[source] : opened[FILE_SOURCE(source)];
+    }
+
+    // Files only opened to create or truncate them
+    for (int r = 0; r < cmd->num_redirections; r++) {
+        if (opened[r] != -1 && opened[r] != fds[0] && opened[r] != fds[1] && opened[r] != fds[2]) {
+            close(opened[r]);
+        }
+    }
+    return 0;
+}
+
+// Close the files redirect_standard_fds() put into fds in place of base
+void close_standard_fds(const int fds[3], const int base[3]) {
+    for (int i = 0; i < 3; i++) {
+        int opened = fds[i] != base[0] && fds[i] != base[1] && fds[i] != base[2];
+        for (int j = 0; j < i; j++) {
+            if (fds[j] == fds[i]) opened = 0;  // shared, closed already
+        }
+        if (opened) close(fds[i]);
+    }
+}
+
+// Whether cmd's redirections only point stdin and stdout at files, which
+// a builtin running on a thread of the shell can carry out
+int redirects_stdio_to_files(const command_t *cmd) {
+    for (int r = 0; r < cmd->num_redirections; r++) {
+        const redirection_t *redirection = &cmd->redirections[r];
+        if (redirection->type == REDIRECT_DUP || redirection->type == REDIRECT_CLOSE ||
+            redirection->fd > STDOUT_FILENO) {
+            return 0;
+        }
+    }
+    return 1;
+}
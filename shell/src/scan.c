@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include "scan.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Finding where a run of ordinary characters ends, for the tokenizer.
+//
+// A word ends at whitespace, at | < > & ; or a quote, and is interrupted
+// by $ and ` (which may start a substitution); inside "..." only " \ $
+// and ` matter.  Rather than testing each byte against that list, the
+// scanners below compare 16 (SSE2) or 32 (AVX2) bytes at a time with all
+// of it and take the first match from the compare mask.  The widest one
+// the CPU has is picked on first use; CSHELL_SCAN=scalar or sse2 caps it,
+// to compare them.  The scalar scanner looks each byte up in a table.
+
+enum {
+    STOPS_WORD = 1,
+    STOPS_QUOTED = 2
+};
+
+static const unsigned char stops[256] = {
+    ['\t'] = STOPS_WORD, ['\n'] = STOPS_WORD, ['\v'] = STOPS_WORD,
+    ['\f'] = STOPS_WORD, ['\r'] = STOPS_WORD, [' '] = STOPS_WORD,
+    ['|'] = STOPS_WORD, ['<'] = STOPS_WORD, ['>'] = STOPS_WORD,
+    ['&'] = STOPS_WORD, [';'] = STOPS_WORD, ['\''] = STOPS_WORD,
+    ['"'] = STOPS_WORD | STOPS_QUOTED, ['$'] = STOPS_WORD | STOPS_QUOTED,
+    ['`'] = STOPS_WORD | STOPS_QUOTED, ['\\'] = STOPS_QUOTED,
+};
+
+typedef size_t (*scanner_t)(const char *s, size_t length);
+
+static size_t scan_class(const char *s, size_t length, unsigned char class) {
+    size_t i = 0;
+    while (i < length && !(stops[(unsigned char)s[i]] & class)) i++;
+    return i;
+}
+
+static size_t scan_word_scalar(const char *s, size_t length) {
+    return scan_class(s, length, STOPS_WORD);
+}
+
+static size_t scan_quoted_scalar(const char *s, size_t length) {
+    return scan_class(s, length, STOPS_QUOTED);
+}
+
+#ifdef SCAN_X86
+
+// Lanes of x holding one of the stops are set to all ones.  Whitespace
+// other than ' ' is the range \t..\r, found as min(x - '\t', 4) ==
+// x - '\t' on unsigned bytes.
+
+static __m128i equal_sse2(__m128i x, char c) {
+    return _mm_cmpeq_epi8(x, _mm_set1_epi8(c));
+}
+
+static __m128i word_stops_sse2(__m128i x) {
+    __m128i control = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+    __m128i stops = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control);
+
+    stops = _mm_or_si128(stops, equal_sse2(x, ' '));
+    stops = _mm_or_si128(stops, _mm_or_si128(equal_sse2(x, '|'), equal_sse2(x, '<')));
+    stops = _mm_or_si128(stops, _mm_or_si128(equal_sse2(x, '>'), equal_sse2(x, '&')));
+    stops = _mm_or_si128(stops, _mm_or_si128(equal_sse2(x, ';'), equal_sse2(x, '\'')));
+    stops = _mm_or_si128(stops, _mm_or_si128(equal_sse2(x, '"'), equal_sse2(x, '$')));
+    return _mm_or_si128(stops, equal_sse2(x, '`'));
+}
+
+static __m128i quoted_stops_sse2(__m128i x) {
+    return _mm_or_si128(_mm_or_si128(equal_sse2(x, '"'), equal_sse2(x, '\\')),
+                        _mm_or_si128(equal_sse2(x, '$'), equal_sse2(x, '`')));
+}
+
+__attribute__((target("avx2")))
+static __m256i equal_avx2(__m256i x, char c) {
+    return _mm256_cmpeq_epi8(x, _mm256_set1_epi8(c));
+}
+
+__attribute__((target("avx2")))
+static __m256i word_stops_avx2(__m256i x) {
+    __m256i control = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+    __m256i stops = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8(4)), control);
+
+    stops = _mm256_or_si256(stops, equal_avx2(x, ' '));
+    stops = _mm256_or_si256(stops, _mm256_or_si256(equal_avx2(x, '|'), equal_avx2(x, '<')));
+    stops = _mm256_or_si256(stops, _mm256_or_si256(equal_avx2(x, '>'), equal_avx2(x, '&')));
+    stops = _mm256_or_si256(stops, _mm256_or_si256(equal_avx2(x, ';'), equal_avx2(x, '\'')));
+    stops = _mm256_or_si256(stops, _mm256_or_si256(equal_avx2(x, '"'), equal_avx2(x, '$')));
+    return _mm256_or_si256(stops, equal_avx2(x, '`'));
+}
+
+__attribute__((target("avx2")))
+static __m256i quoted_stops_avx2(__m256i x) {
+    return _mm256_or_si256(_mm256_or_si256(equal_avx2(x, '"'), equal_avx2(x, '\\')),
+                           _mm256_or_si256(equal_avx2(x, '$'), equal_avx2(x, '`')));
+}
+
+static size_t scan_word_sse2(const char *s, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned mask = _mm_movemask_epi8(word_stops_sse2(x));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_word_scalar(s + i, length - i);
+}
+
+static size_t scan_quoted_sse2(const char *s, size_t length) {
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned mask = _mm_movemask_epi8(quoted_stops_sse2(x));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_quoted_scalar(s + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_word_avx2(const char *s, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned mask = _mm256_movemask_epi8(word_stops_avx2(x));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_word_sse2(s + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_quoted_avx2(const char *s, size_t length) {
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned mask = _mm256_movemask_epi8(quoted_stops_avx2(x));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_quoted_sse2(s + i, length - i);
+}
+
+#endif
+
+static scanner_t word_scanner = scan_word_scalar;
+static scanner_t quoted_scanner = scan_quoted_scalar;
+static const char *implementation = "scalar";
+static pthread_once_t chosen = PTHREAD_ONCE_INIT;
+
+static void choose_scanners() {
+#ifdef SCAN_X86
+    const char *cap = getenv(SCAN_ENV);
+
+    if (cap != NULL && strcmp(cap, "scalar") == 0) {
+        return;
+    }
+    word_scanner = scan_word_sse2;
+    quoted_scanner = scan_quoted_sse2;
+    implementation = "sse2";
+    if ((cap == NULL || strcmp(cap, "sse2") != 0) && __builtin_cpu_supports("avx2")) {
+        word_scanner = scan_word_avx2;
+        quoted_scanner = scan_quoted_avx2;
+        implementation = "avx2";
+    }
+#endif
+}
+
+// Length of the run of ordinary word characters at s
+size_t scan_word(const char *s, size_t length) {
+    pthread_once(&chosen, choose_scanners);
+    return word_scanner(s, length);
+}
+
+// Length of the run at s, inside "...", that needs no special handling
+size_t scan_double_quoted(const char *s, size_t length) {
+    pthread_once(&chosen, choose_scanners);
+    return quoted_scanner(s, length);
+}
+
+// Name of the scanner in use, for benchmarks
+const char *scan_implementation() {
+    pthread_once(&chosen, choose_scanners);
+    return implementation;
+}
@@ -0,0 +1,274 @@
+#define _GNU_SOURCE
+#include "script.h"
+#include "pipes.h"
+#include "jobs.h"
+#include "lineedit.h"
+#include "control.h"
+#include "admission.h"
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+
+// shell.out FILE: run the lines of a script.
+//
+// The lines run one after another as if typed at the prompt, without the
+// prompt, history or line editor.  Reading and parsing them happens on a
+// thread of its own, up to CSHELL_PARSE_AHEAD lines (default 64, or none
+// on a single CPU) ahead of the line running, so a script of many short
+// commands does not stop to parse between them.
+//
+// A line's parse does not depend on what the lines before it do: wildcards
+// are left to expand when the command runs (as in blocks), files are only
+// opened then, and nothing but the script is read.  The lines therefore
+// run in the same order with the same effect, a hop included.  What reading
+// and parsing a line prints (a syntax error, a here-document warning) is
+// collected and printed just before the line would have run.  A line with
+// "<<" in it may read from the script when it runs (a here-document in a
+// block or substitution), so the reader waits for it to finish first.
+
+typedef struct {
+    parse_cache_entry_t *parsed;   // the line, parsed
+    char *block;                   // or an if/while/until/for/case block to run
+    int failed;                    // or neither: the line did not parse
+    int last;                      // exit, or the end of the script
+    int reads_input;               // read on only once this line has run
+    char *output;                  // messages to print before running it
+    size_t output_length;
+    char *errors;
+    size_t errors_length;
+} script_line_t;
+
+typedef struct {
+    FILE *output;                  // collect the reader's messages
+    FILE *errors;
+    char *output_buffer;
+    char *errors_buffer;
+    size_t output_size;
+    size_t errors_size;
+
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;          // a line was queued
+    pthread_cond_t space;          // a line was taken, or one that reads input ran
+    script_line_t *queue;          // capacity lines, count of them from head
+    int capacity;
+    int head;
+    int count;
+    int input_line_ran;
+} script_t;
+
+// Lines to parse ahead when CSHELL_PARSE_AHEAD does not say: none when
+// the shell may only run on one CPU, where the reader could only take turns
+// with the commands it reads ahead of
+static int default_lines_ahead() {
+    cpu_set_t cpus;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) < 2) {
+        return 0;
+    }
+    return SCRIPT_AHEAD_DEFAULT;
+}
+
+// Number of lines to parse ahead, from CSHELL_PARSE_AHEAD
+static int lines_ahead() {
+    const char *setting = getenv(SCRIPT_AHEAD_ENV);
+    char *end;
+
+    if (setting == NULL || *setting == '\0') {
+        return default_lines_ahead();
+    }
+    long lines = strtol(setting, &end, 10);
+    if (*end != '\0' || lines < 0) {
+        return default_lines_ahead();
+    }
+    return lines > SCRIPT_AHEAD_MAX ? SCRIPT_AHEAD_MAX : (int)lines;
+}
+
+// What was collected in stream (an open_memstream() on *buffer), in a
+// string of its own, and empty the stream.  NULL if nothing was.
+static char *take_collected(FILE *stream, char **buffer, size_t *length) {
+    char *copy = NULL;
+
+    *length = 0;
+    if (stream == NULL) {
+        return NULL;
+    }
+    long used = ftell(stream);
+    if (used <= 0) {
+        return NULL;
+    }
+    fflush(stream);
+    if ((copy = malloc(used)) != NULL) {
+        memcpy(copy, *buffer, used);
+        *length = used;
+    }
+    rewind(stream);
+    return copy;
+}
+
+// Read the next line of the script (with the lines it continues onto) and
+// parse it, the way the prompt loop does
+static void read_script_line(script_t *script, script_line_t *line) {
+    char input[MAX_INPUT_LENGTH];
+
+    memset(line, 0, sizeof(*line));
+    for (;;) {
+        if (!read_line(input, sizeof(input))) {
+            line->last = 1;
+            break;
+        }
+        input[strcspn(input, "\n")] = '\0';
+        if (input[0] == '\0') {
+            continue;
+        }
+        line->reads_input = strstr(input, "<<") != NULL;
+        if (control_block_open(input)) {
+            // NULL (after a message) when the block does not end
+            const char *block = control_read_block(input);
+            if (block != NULL) {
+                line->block = strdup(block);
+                line->reads_input = strstr(block, "<<") != NULL;
+            }
+        } else if (strcmp(input, "exit") == 0) {
+            line->last = 1;
+        } else if (control_is_block(input)) {
+            line->block = strdup(input);
+        } else {
+            line->parsed = parse_cache_acquire(input);
+            line->failed = line->parsed == NULL;
+        }
+        break;
+    }
+    if (script != NULL) {
+        line->output = take_collected(script->output, &script->output_buffer, &line->output_length);
+        line->errors = take_collected(script->errors, &script->errors_buffer, &line->errors_length);
+    }
+}
+
+static void *read_ahead(void *arg) {
+    script_t *script = arg;
+    script_line_t line;
+
+    parser_defer_wildcards(1);
+    parser_collect_messages(script->output, script->errors);
+    do {
+        read_script_line(script, &line);
+
+        // The main thread only waits on an empty queue, so only a line
+        // queued onto one needs to wake it
+        pthread_mutex_lock(&script->lock);
+        while (script->count == script->capacity) {
+            pthread_cond_wait(&script->space, &script->lock);
+        }
+        script->queue[(script->head + script->count) % script->capacity] = line;
+        if (script->count++ == 0) {
+            pthread_cond_signal(&script->ready);
+        }
+        while (line.reads_input && !script->input_line_ran) {
+            pthread_cond_wait(&script->space, &script->lock);
+        }
+        script->input_line_ran = 0;
+        pthread_mutex_unlock(&script->lock);
+    } while (!line.last);
+
+    parser_collect_messages(NULL, NULL);
+    return NULL;
+}
+
+// Start the reader thread, with every signal left to the main thread.
+// Returns -1 (and the script is read in line) if it cannot be started.
+static int start_reader(script_t *script, int capacity) {
+    sigset_t all, previous;
+
+    memset(script, 0, sizeof(*script));
+    script->queue = calloc(capacity, sizeof(script_line_t));
+    script->output = open_memstream(&script->output_buffer, &script->output_size);
+    script->errors = open_memstream(&script->errors_buffer, &script->errors_size);
+    if (script->queue == NULL || script->output == NULL || script->errors == NULL) {
+        return -1;
+    }
+    script->capacity = capacity;
+    pthread_mutex_init(&script->lock, NULL);
+    pthread_cond_init(&script->ready, NULL);
+    pthread_cond_init(&script->space, NULL);
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    int result = pthread_create(&script->reader, NULL, read_ahead, script);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    return result == 0 ? 0 : -1;
+}
+
+static void take_line(script_t *script, script_line_t *line) {
+    pthread_mutex_lock(&script->lock);
+    while (script->count == 0) {
+        pthread_cond_wait(&script->ready, &script->lock);
+    }
+    *line = script->queue[script->head];
+    script->head = (script->head + 1) % script->capacity;
+    if (script->count-- == script->capacity) {
+        pthread_cond_signal(&script->space);
+    }
+    pthread_mutex_unlock(&script->lock);
+}
+
+// Let the reader go on past a line that may have read from the script
+static void input_line_done(script_t *script) {
+    pthread_mutex_lock(&script->lock);
+    script->input_line_ran = 1;
+    pthread_cond_signal(&script->space);
+    pthread_mutex_unlock(&script->lock);
+}
+
+// Run the script at path and return the status of its last command
+int run_script(const char *path) {
+    int input = open(path, O_RDONLY | O_CLOEXEC);
+    script_t script;
+    script_line_t line;
+
+    if (input == -1) {
+        perror(path);
+        return 1;
+    }
+    set_line_input(input);
+    int capacity = lines_ahead();
+    int ahead = capacity > 0 && start_reader(&script, capacity) == 0;
+
+    for (;;) {
+        check_background_jobs();
+        run_admission();
+        if (ahead) {
+            take_line(&script, &line);
+        } else {
+            read_script_line(NULL, &line);
+        }
+        fwrite(line.output, 1, line.output_length, stdout);
+        fwrite(line.errors, 1, line.errors_length, stderr);
+        free(line.output);
+        free(line.errors);
+        if (line.last) {
+            break;
+        }
+
+        if (line.parsed != NULL) {
+            execute_parsed_line(line.parsed);
+        } else if (line.block != NULL) {
+            execute_command_line(line.block);
+            free(line.block);
+        } else if (line.failed) {
+            last_exit_status = 1;
+        }
+        if (ahead && line.reads_input) {
+            input_line_done(&script);
+        }
+    }
+
+    if (ahead) {
+        pthread_join(script.reader, NULL);
+    }
+    set_line_input(-1);
+    close(input);
+    kill_all_children();
+    return last_exit_status;
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "pipes.h"
+#include "jobs.h"
+#include "admission.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Command server (shell.out --server PATH).
+//
+// One long-lived shell listens on a SOCK_SEQPACKET Unix socket.  A request
+// is one packet holding a command line, with the client's stdin, stdout and
+// stderr attached as SCM_RIGHTS; the reply is one packet with the exit
+// status in decimal.  The line runs through execute_command_line() with
+// the three descriptors dup2()ed over the server's own 0, 1 and 2, so
+// builtins, pipelines and children write straight to the client and
+// nothing is copied through the socket.
+//
+// Requests run one at a time.  Each connection has its own working
+// directory (and hop -), kept as a directory fd and switched to with
+// fchdir() around its requests; the parse cache, PATH lookups and the
+// zygote stay warm for everyone.
+
+typedef struct {
+    int fd;                                 // -1 when the slot is free
+    int cwd_fd;
+    char previous_directory[MAX_PATH_LENGTH];
+} client_t;
+
+static client_t clients[SERVER_MAX_CLIENTS];
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_handler(int sig) {
+    stopping = 1;
+}
+
+// Like SIG_IGN for the server itself, but children get the default back
+// on exec, so `yes | head` still ends
+static void sigpipe_handler(int sig) {
+}
+
+static int listen_on(const char *path) {
+    struct sockaddr_un address;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "server: socket path too long: %s\n", path);
+        return -1;
+    }
+    // A socket left behind by an earlier server is replaced; anything else is not
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("server: socket");
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    mode_t old_mask = umask(077);  // only the owner may connect
+    int bound = bind(fd, (struct sockaddr *)&address, sizeof(address));
+    umask(old_mask);
+    if (bound == -1 || listen(fd, SERVER_BACKLOG) == -1) {
+        perror("server: bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_client(int listen_fd, int start_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd == -1) {
+        if (errno != EINTR && errno != EAGAIN) perror("server: accept");
+        return;
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd == -1) {
+            clients[i].fd = fd;
+            clients[i].cwd_fd = fcntl(start_fd, F_DUPFD_CLOEXEC, 0);
+            clients[i].previous_directory[0] = '\0';
+            return;
+        }
+    }
+    fprintf(stderr, "server: too many clients\n");
+    close(fd);
+}
+
+static void drop_client(client_t *client) {
+    close(client->fd);
+    if (client->cwd_fd != -1) close(client->cwd_fd);
+    client->fd = -1;
+}
+
+// Read one request into line.  Returns 1 with fds set, 0 when the client
+// hung up, -1 for a malformed request (any descriptors it carried closed)
+// and -2 when interrupted before anything arrived.
+static int receive_request(int fd, char *line, size_t size, int fds[3]) {
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct iovec iov = { line, size - 1 };
+    struct msghdr message;
+    int received = 0;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    ssize_t n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        return n == -1 && errno == EINTR ? -2 : 0;
+    }
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            int count = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            int *passed = (int *)CMSG_DATA(c);
+            for (int i = 0; i < count; i++) {
+                if (received < 3) fds[received++] = passed[i];
+                else close(passed[i]);
+            }
+        }
+    }
+    if (received != 3 || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (int i = 0; i < received; i++) close(fds[i]);
+        return -1;
+    }
+    line[n] = '\0';
+    line[strcspn(line, "\n")] = '\0';
+    return 1;
+}
+
+// Run line for client with fds as stdin, stdout and stderr
+static int run_request(client_t *client, char *line, int fds[3]) {
+    int saved[3];
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    swap_previous_directory(client->previous_directory);
+    if (client->cwd_fd == -1 || fchdir(client->cwd_fd) == -1) {
+        perror("server: working directory");
+    }
+
+    int status = line[0] == '\0' ? 0 : execute_command_line(line);
+
+    fflush(stdout);
+    fflush(stderr);
+    int cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd_fd != -1) {
+        if (client->cwd_fd != -1) close(client->cwd_fd);
+        client->cwd_fd = cwd_fd;
+    }
+    swap_previous_directory(client->previous_directory);
+    for (int i = 0; i < 3; i++) {
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    clearerr(stdin);
+    return status;
+}
+
+static void serve_client(client_t *client) {
+    char line[MAX_INPUT_LENGTH];
+    char reply[16];
+    int fds[3];
+
+    int result = receive_request(client->fd, line, sizeof(line), fds);
+    if (result == -2) {
+        return;
+    }
+    if (result == 0) {
+        drop_client(client);
+        return;
+    }
+    if (result == -1) {
+        fprintf(stderr, "server: malformed request, closing the connection\n");
+        drop_client(client);
+        return;
+    }
+
+    int status = run_request(client, line, fds);
+    int length = snprintf(reply, sizeof(reply), "%d", status);
+    if (send(client->fd, reply, length, MSG_NOSIGNAL) == -1) {
+        drop_client(client);
+    }
+}
+
+// Serve requests on a socket at path until SIGTERM.  Returns the exit
+// status for the server.
+int run_server(const char *path) {
+    struct pollfd polled[SERVER_MAX_CLIENTS + 1];
+    int slot_of[SERVER_MAX_CLIENTS + 1];
+    struct sigaction sa;
+
+    int start_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int listen_fd = listen_on(path);
+    if (listen_fd == -1 || start_fd == -1) {
+        if (start_fd == -1) perror("server: open .");
+        return 1;
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = stop_handler;   // no SA_RESTART: poll() returns at once
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = sigpipe_handler;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    while (!stopping) {
+        int count = 0;
+        polled[count].fd = listen_fd;
+        polled[count].events = POLLIN;
+        slot_of[count++] = -1;
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            if (clients[i].fd == -1) continue;
+            polled[count].fd = clients[i].fd;
+            polled[count].events = POLLIN;
+            slot_of[count++] = i;
+        }
+
+        int ready = poll(polled, count, SERVER_CHECK_MS);
+        check_background_jobs();
+        run_admission();
+        if (ready <= 0) {
+            continue;
+        }
+        for (int k = 1; k < count && !stopping; k++) {
+            if (polled[k].revents) serve_client(&clients[slot_of[k]]);
+        }
+        if (polled[0].revents & POLLIN) {
+            accept_client(listen_fd, start_fd);
+        }
+    }
+
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].fd != -1) drop_client(&clients[i]);
+    }
+    close(listen_fd);
+    close(start_fd);
+    unlink(path);
+    kill_all_children();
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include "variables.h"
+
+// Shell variables and the environment.
+//
+// Every variable, exported or not, lives in one open-addressing hash table
+// keyed by name.  Its storage is the "NAME=value" string itself, so an
+// exported variable's entry can go straight into an envp array.  The table
+// is filled from the inherited environment on first use.
+//
+// The exported variables also form an environment snapshot, which environ
+// points to: children inherit it through fork(), and exec, execvp()'s PATH
+// search and the shell's own getenv() calls all read it.  Each exported
+// variable remembers its slot, so export and assignment change one pointer
+// (or append one) instead of rebuilding the array.
+//
+// A command with NAME=value prefixes gets a copy of the snapshot's pointer
+// array with those slots replaced (command_environment()).  The copy lives
+// in a buffer reused from spawn to spawn, and the strings are shared with
+// the snapshot and the parse result, so a per-command variable costs one
+// memcpy() of pointers and one lookup.
+
+extern char **environ;
+
+typedef struct {
+    char *pair;              // "NAME=value", NULL for a free slot
+    size_t name_length;
+    int owned;               // pair was allocated here (not inherited)
+    int exported;
+    int slot;                // index in the snapshot, or -1
+} variable_t;
+
+static variable_t *table = NULL;
+static size_t table_size = 0;    // a power of two
+static size_t table_used = 0;
+
+static char **snapshot = NULL;
+static int snapshot_count = 0;
+static int snapshot_capacity = 0;
+
+static char **overlay = NULL;    // see command_environment()
+static int overlay_capacity = 0;
+
+// FNV-1a
+static size_t hash_name(const char *name, size_t length) {
+    size_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// The entry for name, or the free slot where it would go
+static variable_t *find(const char *name, size_t length) {
+    size_t i = hash_name(name, length) & (table_size - 1);
+    while (table[i].pair != NULL &&
+           (table[i].name_length != length || memcmp(table[i].pair, name, length) != 0)) {
+        i = (i + 1) & (table_size - 1);
+    }
+    return &table[i];
+}
+
+static int grow_table() {
+    variable_t *old = table;
+    size_t old_size = table_size;
+    size_t size = table_size ? table_size * 2 : VARIABLE_TABLE_SIZE;
+    variable_t *grown = calloc(size, sizeof(variable_t));
+
+    if (grown == NULL) {
+        return -1;
+    }
+    table = grown;
+    table_size = size;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].pair != NULL) {
+            *find(old[i].pair, old[i].name_length) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static int reserve(char ***array, int *capacity, int needed) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    int size = *capacity ? *capacity : 64;
+    while (size < needed) size *= 2;
+    char **grown = realloc(*array, size * sizeof(char *));
+    if (grown == NULL) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = size;
+    return 0;
+}
+
+// Give an exported variable its place in the snapshot
+static int publish(variable_t *variable) {
+    if (variable->slot >= 0) {
+        snapshot[variable->slot] = variable->pair;
+        return 0;
+    }
+    if (reserve(&snapshot, &snapshot_capacity, snapshot_count + 2) == -1) {
+        return -1;
+    }
+    variable->slot = snapshot_count;
+    snapshot[snapshot_count++] = variable->pair;
+    snapshot[snapshot_count] = NULL;
+    environ = snapshot;  // the array may have moved
+    return 0;
+}
+
+// Load the inherited environment, keeping its order in the snapshot
+static int init_variables() {
+    if (table != NULL) {
+        return 0;
+    }
+    if (grow_table() == -1) {
+        return -1;
+    }
+    int count = 0;
+    while (environ[count] != NULL) count++;
+    if (reserve(&snapshot, &snapshot_capacity, count + 1) == -1) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        char *equals = strchr(environ[i], '=');
+        if (equals == NULL || equals == environ[i]) {
+            continue;
+        }
+        if ((table_used + 1) * 2 > table_size && grow_table() == -1) {
+            return -1;
+        }
+        variable_t *variable = find(environ[i], equals - environ[i]);
+        if (variable->pair != NULL) {
+            continue;  // getenv() sees the first one too
+        }
+        variable->pair = environ[i];
+        variable->name_length = equals - environ[i];
+        variable->owned = 0;
+        variable->exported = 1;
+        variable->slot = snapshot_count;
+        snapshot[snapshot_count++] = environ[i];
+        table_used++;
+    }
+    snapshot[snapshot_count] = NULL;
+    environ = snapshot;
+    return 0;
+}
+
+// Value of the variable name (length bytes, not NUL-terminated), or NULL
+const char *variable_value(const char *name, size_t length) {
+    if (init_variables() == -1) {
+        return NULL;
+    }
+    const variable_t *variable = find(name, length);
+    return variable->pair ? variable->pair + length + 1 : NULL;
+}
+
+// Set name to value, exporting it if export is set.  An exported
+// variable's new value goes into the environment.  Returns -1 when out
+// of memory.
+int set_variable(const char *name, size_t length, const char *value, int export) {
+    size_t value_length = strlen(value);
+
+    if (init_variables() == -1 ||
+        ((table_used + 1) * 2 > table_size && grow_table() == -1)) {
+        return -1;
+    }
+    char *pair = malloc(length + value_length + 2);
+    if (pair == NULL) {
+        return -1;
+    }
+    memcpy(pair, name, length);
+    pair[length] = '=';
+    memcpy(pair + length + 1, value, value_length + 1);
+
+    variable_t *variable = find(name, length);
+    if (variable->pair == NULL) {
+        variable->exported = 0;
+        variable->slot = -1;
+        table_used++;
+    } else if (variable->owned) {
+        free(variable->pair);
+    }
+    variable->pair = pair;
+    variable->name_length = length;
+    variable->owned = 1;
+    variable->exported |= export;
+    return variable->exported ? publish(variable) : 0;
+}
+
+// Run a command made only of NAME=value words: set them in the shell
+int assign_variables(const command_t *cmd) {
+    for (int i = 0; i < cmd->num_assignments; i++) {
+        const char *text = cmd->assignments[i].text;
+        size_t length = strcspn(text, "=");
+        if (set_variable(text, length, text + length + 1, 0) == -1) {
+            fprintf(stderr, "%.*s: out of memory\n", (int)length, text);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The environment to exec cmd with: the snapshot itself, or for a command
+// with NAME=value prefixes, a copy of it with those entries replaced.
+// The copy is overwritten by the next call.  A queued background job's
+// commands carry the environment they had when it was queued.
+char **command_environment(const command_t *cmd) {
+    if (cmd->environment != NULL) {
+        return cmd->environment;
+    }
+    if (cmd->num_assignments == 0 || init_variables() == -1 ||
+        reserve(&overlay, &overlay_capacity, snapshot_count + cmd->num_assignments + 1) == -1) {
+        return environ;
+    }
+    memcpy(overlay, snapshot, snapshot_count * sizeof(char *));
+
+    int count = snapshot_count;
+    for (int i = 0; i < cmd->num_assignments; i++) {
+        char *text = cmd->assignments[i].text;
+        size_t length = strcspn(text, "=");
+        const variable_t *variable = find(text, length);
+        int slot = variable->pair && variable->exported ? variable->slot : -1;
+
+        // Not in the environment yet: maybe an earlier prefix added it
+        for (int j = snapshot_count; j < count && slot == -1; j++) {
+            if (strncmp(overlay[j], text, length + 1) == 0) slot = j;
+        }
+        if (slot == -1) {
+            slot = count++;
+        }
+        overlay[slot] = text;
+    }
+    overlay[count] = NULL;
+    return overlay;
+}
+
+static int is_name(const char *s, size_t length) {
+    if (length == 0 || (!isalpha((unsigned char)s[0]) && s[0] != '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_') return 0;
+    }
+    return 1;
+}
+
+// export [NAME[=value]...]: mark variables for the environment of every
+// command started from now on.  Without arguments, list them.
+int export_command(int argc, char *argv[]) {
+    int status = 0;
+
+    if (init_variables() == -1) {
+        return 1;
+    }
+    if (argc == 1) {
+        for (int i = 0; i < snapshot_count; i++) {
+            printf("export %s\n", snapshot[i]);
+        }
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        size_t length = strcspn(argv[i], "=");
+        if (!is_name(argv[i], length)) {
+            printf("export: not a valid name: %s\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        const char *value = argv[i][length] == '=' ? argv[i] + length + 1 : variable_value(argv[i], length);
+        if (set_variable(argv[i], length, value ? value : "", 1) == -1) {
+            perror("export");
+            return 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,273 @@
+#include "wildcard.h"
+#include "dirscan.h"
+
+// Pathname expansion for unquoted words containing *, ? or [...].
+//
+// The last path component is compiled into a small segment program and
+// matched against the directory listing in-process; the directory part
+// must be literal.  Matches are sorted and added to the command's argument
+// list in the parse arena.  A word without matches is left as it is.
+
+int has_wildcard(const char *word) {
+    for (const char *p = word; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (*p == '*' || *p == '?' || *p == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Parse the bracket expression starting at text[i] == '['.
+// Returns the index just past the closing ']', or 0 if there is none.
+static size_t compile_class(const char *text, size_t i, wildcard_segment_t *segment) {
+    size_t j = i + 1;
+    int negate = 0;
+
+    memset(segment->bits, 0, sizeof(segment->bits));
+    if (text[j] == '!' || text[j] == '^') {
+        negate = 1;
+        j++;
+    }
+
+    // A ']' right after the opening bracket is a member, not the end
+    for (int first = 1; text[j] && (text[j] != ']' || first); first = 0) {
+        unsigned int low = (unsigned char)text[j];
+        unsigned int high = low;
+        if (text[j + 1] == '-' && text[j + 2] && text[j + 2] != ']') {
+            high = (unsigned char)text[j + 2];
+            j += 3;
+        } else {
+            j++;
+        }
+        for (unsigned int c = low; c <= high; c++) {
+            segment->bits[c >> 3] |= (unsigned char)(1u << (c & 7));
+        }
+    }
+    if (text[j] != ']') {
+        return 0;
+    }
+
+    if (negate) {
+        for (size_t k = 0; k < sizeof(segment->bits); k++) {
+            segment->bits[k] = (unsigned char)~segment->bits[k];
+        }
+    }
+    segment->type = WILDCARD_CLASS;
+    return j + 1;
+}
+
+// Compile text into pattern.  Returns 0 if the pattern is too complex.
+int wildcard_compile(wildcard_t *pattern, const char *text) {
+    size_t out = 0;
+    int n = 0;
+
+    pattern->min_length = 0;
+    for (size_t i = 0; text[i];) {
+        wildcard_segment_t *segment = &pattern->segments[n];
+        size_t class_end;
+
+        if (text[i] == '*') {
+            while (text[i] == '*') i++;
+            segment->type = WILDCARD_ANY_STRING;
+        } else if (text[i] == '?') {
+            segment->type = WILDCARD_ANY_CHAR;
+            pattern->min_length++;
+            i++;
+        } else if (text[i] == '[' && (class_end = compile_class(text, i, segment)) != 0) {
+            pattern->min_length++;
+            i = class_end;
+        } else {
+            // Literal byte, merged into the previous literal when possible
+            char c = text[i++];
+            if (c == '\\' && text[i]) c = text[i++];
+            if (out + 1 >= sizeof(pattern->text)) return 0;
+
+            pattern->text[out] = c;
+            pattern->min_length++;
+            if (n > 0 && pattern->segments[n - 1].type == WILDCARD_LITERAL) {
+                pattern->segments[n - 1].length++;
+                out++;
+                continue;
+            }
+            segment->type = WILDCARD_LITERAL;
+            segment->literal = &pattern->text[out++];
+            segment->length = 1;
+        }
+
+        if (++n == WILDCARD_MAX_SEGMENTS) return 0;
+    }
+    pattern->num_segments = n;
+
+    // Peel literal prefix and suffix off for the fast filter
+    pattern->first = 0;
+    pattern->last = n;
+    pattern->prefix = pattern->suffix = NULL;
+    pattern->prefix_length = pattern->suffix_length = 0;
+    if (n > 0 && pattern->segments[0].type == WILDCARD_LITERAL) {
+        pattern->prefix = pattern->segments[0].literal;
+        pattern->prefix_length = pattern->segments[0].length;
+        pattern->first = 1;
+    }
+    if (pattern->last > pattern->first && pattern->segments[n - 1].type == WILDCARD_LITERAL) {
+        pattern->suffix = pattern->segments[n - 1].literal;
+        pattern->suffix_length = pattern->segments[n - 1].length;
+        pattern->last = n - 1;
+    }
+
+    pattern->only_star = (pattern->last - pattern->first == 1 &&
+                          pattern->segments[pattern->first].type == WILDCARD_ANY_STRING);
+    pattern->match_hidden = (pattern->prefix != NULL && pattern->prefix[0] == '.');
+    return 1;
+}
+
+static int class_has(const wildcard_segment_t *segment, unsigned char c) {
+    return (segment->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+// Match a run of segments against s[0..length).  Every segment except *
+// has a fixed width, so backtracking only ever has to revisit the most
+// recent star.
+static int match_segments(const wildcard_segment_t *segments, int count,
+                          const char *s, size_t length) {
+    int si = 0;
+    size_t pos = 0;
+    int star = -1;
+    size_t star_pos = 0;
+
+    for (;;) {
+        if (si < count && segments[si].type == WILDCARD_ANY_STRING) {
+            if (si == count - 1) return 1;  // trailing star takes the rest
+            star = si++;
+            star_pos = pos;
+            continue;
+        }
+
+        if (si == count) {
+            if (pos == length) return 1;
+        } else {
+            const wildcard_segment_t *segment = &segments[si];
+            int ok = 0;
+            size_t width = segment->type == WILDCARD_LITERAL ? segment->length : 1;
+
+            if (pos + width <= length) {
+                switch (segment->type) {
+                    case WILDCARD_LITERAL:
+                        ok = memcmp(s + pos, segment->literal, width) == 0;
+                        break;
+                    case WILDCARD_ANY_CHAR:
+                        ok = 1;
+                        break;
+                    case WILDCARD_CLASS:
+                        ok = class_has(segment, (unsigned char)s[pos]);
+                        break;
+                    default:
+                        break;
+                }
+            }
+            if (ok) {
+                pos += width;
+                si++;
+                continue;
+            }
+        }
+
+        // Let the last star swallow one more byte and retry
+        if (star < 0 || star_pos >= length) return 0;
+        pos = ++star_pos;
+        si = star + 1;
+    }
+}
+
+int wildcard_match(const wildcard_t *pattern, const char *name, size_t length) {
+    if (length < pattern->min_length) return 0;
+    if (name[0] == '.' && !pattern->match_hidden) return 0;
+    if (pattern->prefix_length && memcmp(name, pattern->prefix, pattern->prefix_length) != 0) {
+        return 0;
+    }
+    if (pattern->suffix_length &&
+        memcmp(name + length - pattern->suffix_length, pattern->suffix, pattern->suffix_length) != 0) {
+        return 0;
+    }
+    if (pattern->only_star) return 1;
+
+    return match_segments(&pattern->segments[pattern->first], pattern->last - pattern->first,
+                          name + pattern->prefix_length,
+                          length - pattern->prefix_length - pattern->suffix_length);
+}
+
+typedef struct {
+    const wildcard_t *pattern;
+    const char *dir_prefix;       // directory part of the word, including the '/'
+    size_t dir_prefix_length;
+    char **matches;
+    int count;
+    int capacity;
+} expansion_t;
+
+static int collect_match(const dirscan_entry_t *entry, void *context) {
+    expansion_t *expansion = context;
+    const char *name = entry->name;
+
+    // "." and ".." are never produced, even by a pattern starting with '.'
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return 1;
+    }
+    if (!wildcard_match(expansion->pattern, entry->name, entry->name_length)) {
+        return 1;
+    }
+
+    if (expansion->count == expansion->capacity) {
+        int new_capacity = expansion->capacity ? expansion->capacity * 2 : 64;
+        char **grown = realloc(expansion->matches, new_capacity * sizeof(char *));
+        if (grown == NULL) {
+            return 0;
+        }
+        expansion->matches = grown;
+        expansion->capacity = new_capacity;
+    }
+
+    char *path = parser_alloc(expansion->dir_prefix_length + entry->name_length + 1);
+    memcpy(path, expansion->dir_prefix, expansion->dir_prefix_length);
+    memcpy(path + expansion->dir_prefix_length, entry->name, entry->name_length + 1);
+    expansion->matches[expansion->count++] = path;
+    return 1;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Add the sorted expansion of word to cmd.
+// Returns the number of arguments added; 0 means the word should be kept.
+int expand_wildcard(const char *word, command_t *cmd) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(word, '/');
+    const char *base = slash ? slash + 1 : word;
+    size_t dir_length = slash ? (size_t)(slash - word) + 1 : 0;
+    wildcard_t pattern;
+
+    if (*base == '\0' || dir_length >= sizeof(dir)) {
+        return 0;
+    }
+    memcpy(dir, word, dir_length);
+    dir[dir_length] = '\0';
+    if (has_wildcard(dir) || !wildcard_compile(&pattern, base)) {
+        return 0;
+    }
+    if (pattern.num_segments == 1 && pattern.segments[0].type == WILDCARD_LITERAL) {
+        return 0; // Only escapes or an unclosed bracket, nothing to expand
+    }
+
+    expansion_t expansion = { &pattern, word, dir_length, NULL, 0, 0 };
+    dirscan(dir_length ? dir : ".", collect_match, &expansion);
+
+    qsort(expansion.matches, expansion.count, sizeof(char *), compare_paths);
+    for (int i = 0; i < expansion.count; i++) {
+        command_add_argument(cmd, expansion.matches[i]);
+    }
+
+    free(expansion.matches);
+    return expansion.count;
+}
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include "zygote.h"
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+
+// Optional spawn helper ("zygote").
+//
+// fork() has to copy the page tables of the whole shell, so launch cost
+// grows with the history mapping, caches and job table.  With
+// CSHELL_ZYGOTE set, a helper is forked at startup while the shell is
+// still small.  External commands are then started by sending argv, the
+// working directory, the environment and the three stdio descriptors to
+// the helper, which forks from its own small image.  The helper is the
+// real parent, so it reports each child's pid and every wait status back;
+// wait_process() hides the difference from the job code.
+
+extern char **environ;
+
+static int zygote_fd = -1;
+static pid_t zygote_pid = -1;
+static pid_t zygote_owner = -1;   // the shell process that started it
+
+// Children started by the zygote that have not been reaped through
+// wait_process() yet, and status events not yet consumed
+static pid_t *zygote_children = NULL;
+static int zygote_child_count = 0;
+static int zygote_child_capacity = 0;
+
+static zygote_event_t *pending_events = NULL;
+static int pending_count = 0;
+static int pending_capacity = 0;
+
+// ---- helper process ------------------------------------------------------
+
+static void send_event(int fd, zygote_event_type_t type, pid_t pid, int status) {
+    zygote_event_t event = { type, pid, status };
+    while (send(fd, &event, sizeof(event), MSG_NOSIGNAL) == -1 && errno == EINTR) {
+    }
+}
+
+static void reap_children(int fd) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
+        send_event(fd, ZYGOTE_STATUS, pid, status);
+    }
+}
+
+// Unpack one request and fork the command.  Returns 0 when the shell has
+// gone away.
+static int handle_request(int fd, char *buffer, const sigset_t *child_mask) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { buffer, ZYGOTE_MAX_MESSAGE };
+    struct msghdr msg;
+    int fds[3] = { -1, -1, -1 };
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n == 0 || (n == -1 && errno != EINTR)) {
+        return 0;
+    }
+    if (n == -1) {
+        return 1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+
+    zygote_request_t *request = (zygote_request_t *)buffer;
+    if ((size_t)n < sizeof(*request) || sizeof(*request) + request->length != (size_t)n ||
+        fds[0] == -1 || request->argc <= 0) {
+        for (int i = 0; i < 3; i++) {
+            if (fds[i] != -1) close(fds[i]);
+        }
+        send_event(fd, ZYGOTE_SPAWNED, -1, 0);
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *strings = buffer + sizeof(*request);
+        char *end = strings + request->length;
+        char **argv = malloc((request->argc + 1) * sizeof(char *));
+        char **envp = malloc((request->envc + 1) * sizeof(char *));
+        const char *cwd = strings;
+
+        if (argv == NULL || envp == NULL) {
+            _exit(EXIT_FAILURE);
+        }
+        char *p = strings + strlen(strings) + 1;
+        for (int i = 0; i < request->argc && p < end; i++, p += strlen(p) + 1) {
+            argv[i] = p;
+        }
+        argv[request->argc] = NULL;
+        for (int i = 0; i < request->envc && p < end; i++, p += strlen(p) + 1) {
+            envp[i] = p;
+        }
+        envp[request->envc] = NULL;
+
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        sigprocmask(SIG_SETMASK, child_mask, NULL);
+        setpgid(0, 0);
+        for (int i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+        }
+        if (chdir(cwd) == -1) {
+            perror("chdir failed");
+        }
+        if (apply_placement(0, &request->placement) == -1) {
+            _exit(EXIT_FAILURE);
+        }
+
+        // execvpe() would search the zygote's own PATH: search the command's
+        environ = envp;
+        execvp(argv[0], argv);
+        fprintf(stderr, "%s: %s\n", argv[0], errno == ENOENT ? "command not found" : strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+
+    if (pid > 0) {
+        setpgid(pid, pid);
+    }
+    for (int i = 0; i < 3; i++) {
+        close(fds[i]);
+    }
+    send_event(fd, ZYGOTE_SPAWNED, pid, 0);
+    return 1;
+}
+
+static void zygote_main(int fd) {
+    sigset_t mask, child_mask;
+
+    // Terminal signals are meant for the shell's foreground job
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &child_mask);
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    char *buffer = malloc(ZYGOTE_MAX_MESSAGE);
+    if (sfd == -1 || buffer == NULL) {
+        _exit(EXIT_FAILURE);
+    }
+
+    struct pollfd polls[2] = { { fd, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+    for (;;) {
+        if (poll(polls, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (polls[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(sfd, &info, sizeof(info)) > 0) {
+                reap_children(fd);
+            }
+        }
+        if (polls[0].revents & POLLIN) {
+            if (!handle_request(fd, buffer, &child_mask)) break;
+        } else if (polls[0].revents & (POLLHUP | POLLERR)) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+// ---- shell side ----------------------------------------------------------
+
+// Fork the zygote if CSHELL_ZYGOTE asks for it.  Call before the shell
+// allocates anything large.
+void start_zygote() {
+    const char *setting = getenv(ZYGOTE_ENV);
+    int sv[2];
+
+    if (setting == NULL || *setting == '\0' || strcmp(setting, "0") == 0) {
+        return;
+    }
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("zygote: socketpair failed");
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(sv[0]);
+        zygote_main(sv[1]);
+    }
+    close(sv[1]);
+    if (pid < 0) {
+        perror("zygote: fork failed");
+        close(sv[0]);
+        return;
+    }
+    zygote_fd = sv[0];
+    zygote_pid = pid;
+    zygote_owner = getpid();
+}
+
+// Forked copies of the shell (builtins in pipelines, substitutions) must
+// not talk to the owner's zygote: they would steal its replies
+int zygote_running() {
+    return zygote_fd != -1 && getpid() == zygote_owner;
+}
+
+// The zygote is gone: its children now belong to init and can no longer be
+// waited for.  Plain fork() takes over.
+static void zygote_lost() {
+    close(zygote_fd);
+    zygote_fd = -1;
+    waitpid(zygote_pid, NULL, 0);
+    zygote_pid = -1;
+    fprintf(stderr, "zygote: helper exited, using fork()\n");
+}
+
+static int find_child(pid_t pid) {
+    for (int i = 0; i < zygote_child_count; i++) {
+        if (zygote_children[i] == pid) return i;
+    }
+    return -1;
+}
+
+static void add_child(pid_t pid) {
+    if (zygote_child_count == zygote_child_capacity) {
+        int new_capacity = zygote_child_capacity ? zygote_child_capacity * 2 : 16;
+        pid_t *grown = realloc(zygote_children, new_capacity * sizeof(pid_t));
+        if (grown == NULL) return;
+        zygote_children = grown;
+        zygote_child_capacity = new_capacity;
+    }
+    zygote_children[zygote_child_count++] = pid;
+}
+
+// Read one event from the zygote.  Status events are queued; a spawn reply
+// is returned through spawned.  Returns 0 if nothing could be read.
+static int read_event(int blocking, pid_t *spawned) {
+    zygote_event_t event;
+    ssize_t n = recv(zygote_fd, &event, sizeof(event), blocking ? 0 : MSG_DONTWAIT);
+
+    // Interrupted (e.g. by Ctrl-C being forwarded) or nothing there yet
+    if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    if (n <= 0) {
+        zygote_lost();
+        return 0;
+    }
+    if (n != (ssize_t)sizeof(event)) {
+        return 0;
+    }
+
+    if (event.type == ZYGOTE_SPAWNED) {
+        if (spawned) *spawned = event.pid;
+        return 1;
+    }
+    if (pending_count == pending_capacity) {
+        int new_capacity = pending_capacity ? pending_capacity * 2 : 16;
+        zygote_event_t *grown = realloc(pending_events, new_capacity * sizeof(zygote_event_t));
+        if (grown == NULL) return 1;
+        pending_events = grown;
+        pending_capacity = new_capacity;
+    }
+    pending_events[pending_count++] = event;
+    return 1;
+}
+
+// Start argv in the zygote with the given stdin, stdout and stderr.
+// Returns the child's pid, or -1 if the zygote could not start it.
+pid_t zygote_spawn(char *const argv[], char *const envp[], const int fds[3], const placement_t *placement) {
+    char *message = malloc(ZYGOTE_MAX_MESSAGE);
+    char cwd[PATH_MAX];
+    size_t used = sizeof(zygote_request_t);
+    zygote_request_t *request = (zygote_request_t *)message;
+
+    if (message == NULL || getcwd(cwd, sizeof(cwd)) == NULL) {
+        free(message);
+        return -1;
+    }
+
+    // cwd, then argv, then the environment, each string NUL-terminated
+    int overflow = 0;
+    request->argc = 0;
+    request->envc = 0;
+    for (int part = 0; part < 3 && !overflow; part++) {
+        char *const *list = part == 0 ? NULL : part == 1 ? argv : envp;
+        int count = part == 0 ? 1 : 0;
+        if (part > 0) {
+            while (list[count] != NULL) count++;
+        }
+        for (int i = 0; i < count; i++) {
+            const char *s = part == 0 ? cwd : list[i];
+            size_t length = strlen(s) + 1;
+            if (used + length > ZYGOTE_MAX_MESSAGE) {
+                overflow = 1;
+                break;
+            }
+            memcpy(message + used, s, length);
+            used += length;
+        }
+        if (part == 1) request->argc = count;
+        if (part == 2) request->envc = count;
+    }
+    if (overflow) {
+        free(message);
+        return -1; // Too large for one message, let fork() handle it
+    }
+    request->length = used - sizeof(zygote_request_t);
+    if (placement != NULL) {
+        request->placement = *placement;
+    } else {
+        memset(&request->placement, 0, sizeof(request->placement));
+    }
+
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { message, used };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 3 * sizeof(int));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    free(message);
+    if (sent == -1) {
+        zygote_lost();
+        return -1;
+    }
+
+    // Status events of other children may arrive before the reply
+    pid_t pid = -1;
+    while (zygote_running()) {
+        pid_t spawned = 0;
+        if (read_event(1, &spawned) && spawned != 0) {
+            pid = spawned;
+            break;
+        }
+    }
+    if (pid > 0) {
+        add_child(pid);
+    }
+    return pid;
+}
+
+// Take the oldest queued status of pid, if any
+static int take_event(pid_t pid, int *status) {
+    for (int i = 0; i < pending_count; i++) {
+        if (pending_events[i].pid == pid) {
+            *status = pending_events[i].status;
+            memmove(&pending_events[i], &pending_events[i + 1],
+                    (pending_count - i - 1) * sizeof(zygote_event_t));
+            pending_count--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// waitpid() for children of the shell and of the zygote alike.
+// Supports WNOHANG and WUNTRACED (the zygote always reports stops).
+pid_t wait_process(pid_t pid, int *status, int options) {
+    int index = zygote_running() ? find_child(pid) : -1;
+    int local_status;
+
+    if (index == -1) {
+        return waitpid(pid, status, options);
+    }
+    if (status == NULL) {
+        status = &local_status;
+    }
+
+    for (;;) {
+        while (take_event(pid, status)) {
+            if (WIFSTOPPED(*status) && !(options & WUNTRACED)) {
+                continue;
+            }
+            if (WIFEXITED(*status) || WIFSIGNALED(*status)) {
+                zygote_children[index] = zygote_children[--zygote_child_count];
+            }
+            return pid;
+        }
+        if (!zygote_running()) {
+            zygote_children[index] = zygote_children[--zygote_child_count];
+            errno = ECHILD;
+            return -1;
+        }
+        if (!read_event(!(options & WNOHANG), NULL) && (options & WNOHANG)) {
+            return 0;
+        }
+    }
+}